@@ -0,0 +1,59 @@
+/**
+ * measures the throughput of BufferedStream::readUntilDelimiter for line oriented input of various line lengths,
+ * the data is passed through shared memory, so the scan and the copy out of the buffer dominate
+ * usage: bench_delimiter_scan [megabytes per run]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "socket_wrapper/BufferedStream.h"
+#include "socket_wrapper/StreamFactory.h"
+
+using namespace socket_wrapper;
+
+namespace {
+    double measure(size_t line_length, const std::string &delimiter, size_t total_bytes) {
+        std::string line(line_length - delimiter.size(), 'x');
+        line += delimiter;
+        std::string block;
+        while (block.size() < (1 << 16)) {
+            block += line;
+        }
+        size_t lines_per_block = block.size() / line.size();
+        size_t blocks = std::max<size_t>(total_bytes / block.size(), 1);
+
+        auto streams = StreamFactory::CreateShmPipe(1 << 22);
+        BufferedStream buffered(std::move(streams[1]), 1 << 20);
+        auto writer = std::thread([&]() {
+            for (size_t i = 0; i < blocks; i++) {
+                streams[0].writeBlocking(block.data(), block.size());
+            }
+        });
+        auto start = std::chrono::steady_clock::now();
+        size_t read_bytes = 0;
+        for (size_t i = 0; i < blocks * lines_per_block; i++) {
+            auto view = buffered.peekUntilDelimiter(delimiter);
+            read_bytes += view.size + delimiter.size();
+            buffered.consume(view.size + delimiter.size());
+        }
+        auto elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        writer.join();
+        return (double) read_bytes / (double) elapsed_ns;
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+    printf("%12s %10s %12s\n", "line_length", "delimiter", "bytes/ns");
+    for (const std::string delimiter: {"\n", "\r\n"}) {
+        for (size_t line_length: {16, 128, 1024, 16384, 262144}) {
+            double throughput = measure(line_length, delimiter, megabytes << 20);
+            printf("%12zu %10s %12.3f\n", line_length, delimiter == "\n" ? "\\n" : "\\r\\n", throughput);
+        }
+    }
+    return 0;
+}
@@ -3,6 +3,8 @@
 
 #include <map>
 #include <string>
+#include <cstdint>
+#include <cstddef>
 namespace socket_wrapper{
 
     struct NetworkInterface{
@@ -15,6 +17,25 @@ namespace socket_wrapper{
         IPv4,
         IPv6
     };
+    /**
+     * an address a Stream can connect to
+     */
+    struct Endpoint{
+        std::string ip_address;
+        uint16_t port;
+        IP_VERSION version;
+    };
+    /**
+     * a read-only view of bytes owned by someone else, e.g. the buffer of a BufferedStream
+     */
+    struct BufferView{
+        const char *data;
+        size_t size;
+        const char *begin() const { return data; }
+        const char *end() const { return data + size; }
+        bool empty() const { return size == 0; }
+    };
+    bool operator<(const Endpoint &a, const Endpoint &b);
     IP_VERSION IpVersionfromString(std::string v);
     extern std::map<IP_VERSION,std::string> getName;
     // some forward declarations
@@ -23,6 +44,11 @@ namespace socket_wrapper{
     class ListenerBase;
     class Listener;
     class ConditionalBufferedStream;
+    class UdpDatagram;
+    class Reactor;
+    class StreamPool;
+    class StreamRelay;
+    class BufferedStream;
 }
 
 #endif //SOCKET_WRAPPER_BASETYPES_H
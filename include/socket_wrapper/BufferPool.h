@@ -0,0 +1,67 @@
+#ifndef SOCKET_WRAPPER_BUFFERPOOL_H
+#define SOCKET_WRAPPER_BUFFERPOOL_H
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "RingBuffer.h"
+
+namespace socket_wrapper {
+    /**
+     * @brief A pool of read buffers, shared by the BufferedStreams of a process
+     * Buffers are grouped in size classes (powers of two, at least a page). A BufferedStream takes a buffer once
+     * data arrives and returns it once all data was read, so the memory in use follows the traffic instead of the
+     * number of connections. Returned buffers are kept for reuse, up to a limit of bytes, the rest is freed.
+     * Example:
+     * auto pool = std::make_shared<BufferPool>(256 << 20);
+     * BufferedStream buffered(listener.accept(), 64 << 10, pool);
+     */
+    class BufferPool {
+    public:
+        static size_t const kDefaultMaxCachedBytes = 64 << 20;
+
+        /**
+         * @param max_cached_bytes the maximum number of bytes kept in unused buffers
+         */
+        explicit BufferPool(size_t max_cached_bytes = kDefaultMaxCachedBytes);
+
+        BufferPool(BufferPool const &) = delete;
+
+        /**
+         * @param min_capacity the minimum capacity of the buffer
+         * @return an empty buffer of the size class of min_capacity, a cached one if available
+         */
+        std::unique_ptr<RingBuffer> acquire(size_t min_capacity);
+
+        /**
+         * returns a buffer for reuse, its content is discarded
+         * @param buffer a buffer taken with acquire
+         */
+        void release(std::unique_ptr<RingBuffer> buffer);
+
+        /**
+         * @return the number of bytes in unused buffers
+         */
+        size_t getCachedBytes();
+
+        /**
+         * @return the capacity of the buffers acquire returns for min_capacity
+         */
+        static size_t getSizeClass(size_t min_capacity);
+
+        /**
+         * @return the pool of all BufferedStreams which are not given a pool
+         */
+        static std::shared_ptr<BufferPool> getDefault();
+
+    private:
+        std::mutex pool_mtx;
+        std::map<size_t, std::vector<std::unique_ptr<RingBuffer>>> cached_buffers; // by size class
+        size_t cached_bytes = 0;
+        size_t max_cached_bytes;
+    };
+}
+#endif //SOCKET_WRAPPER_BUFFERPOOL_H
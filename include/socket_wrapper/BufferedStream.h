@@ -2,10 +2,16 @@
 #define EZNETWORK_STREAMANALYZER_H
 
 #include <vector>
+#include <chrono>
+#include <functional>
+#include <mutex>
 #include <sys/eventfd.h>
 #include <list>
 #include "BaseTypes.h"
 #include "Stream.h"
+#include "RingBuffer.h"
+#include "BufferPool.h"
+#include "FrameFormat.h"
 
 namespace socket_wrapper {
     /**
@@ -14,16 +20,39 @@ namespace socket_wrapper {
     class BufferedStream {
         friend ConditionalBufferedStream;
     public :
+        /**
+         * when buffered writes are handed to the underlying Stream
+         */
+        enum FLUSH_POLICY {
+            FLUSH_IMMEDIATELY, // every write is passed through, nothing is buffered (the default)
+            FLUSH_ON_SIZE, // writes are buffered until at least flush_threshold bytes are pending
+            FLUSH_ON_DEADLINE, // like FLUSH_ON_SIZE, but also once the oldest pending byte waited for the deadline,
+                               // no timer is armed, an idle Stream is only flushed by calls to flushIfDue
+            FLUSH_EXPLICIT // like FLUSH_ON_SIZE, but also on flush, e.g. at the end of an event loop iteration
+        };
+
+        /**
+         * the default number of pending bytes after which buffered writes are flushed
+         */
+        static size_t const kDefaultFlushThreshold = 16 * 1024;
+
+        /**
+         * the default time after which buffered writes are flushed with FLUSH_ON_DEADLINE
+         */
+        static int const kDefaultFlushDeadlineUs = 200;
+
         BufferedStream() = delete;
         /**
          * creates a Buffer on top of a given stream, the stream has to be moved
          * @param src_stream the stream to encapsulate
-         * @param buffer_size the size of the internal buffer.
+         * @param buffer_size the size of the internal buffer, it is rounded up to a size class of the pool
+         * @param pool the pool the buffer is taken from once data arrives, and returned to once it was read
          */
-        BufferedStream(Stream src_stream, size_t buffer_size);
+        BufferedStream(Stream src_stream, size_t buffer_size,
+                       std::shared_ptr<BufferPool> pool = BufferPool::getDefault());
 
         /**
-         * frees all internal buffers
+         * returns the buffer to the pool
          */
         ~BufferedStream() noexcept;
 
@@ -37,11 +66,31 @@ namespace socket_wrapper {
         /**
          * blocks execution until the delimiter has been read
          * @param delimiter_sequence
-         * @return the characters read including the delimiter
+         * @return the characters read, without the delimiter
          * @throws SocketException in case of invalid reads
          */
         std::vector<char> readUntilDelimiter(char delimiter_sequence);
 
+        /**
+         * blocks execution until the delimiter has been read, the delimiter may consist of several bytes (e.g. "\r\n")
+         * The scan continues where the previous one stopped, so long lines are scanned once in total.
+         * @param delimiter the delimiter, must not be empty
+         * @param timeout_ms the maximum time to wait for each read, -1 waits indefinitely
+         * @return the characters read, without the delimiter
+         * @throws SocketException in case of invalid reads
+         * @throws std::logic_error if the buffer is full without containing the delimiter
+         */
+        std::vector<char> readUntilDelimiter(const std::string &delimiter, int timeout_ms = -1);
+
+        /**
+         * like readUntilDelimiter, but without copying or removing the data from the buffer
+         * The view stays valid until consume or another read is called, consume(view.size + delimiter.size())
+         * removes the data and the delimiter.
+         * @return a view of the characters in front of the delimiter
+         * @see readUntilDelimiter
+         */
+        BufferView peekUntilDelimiter(const std::string &delimiter, int timeout_ms = -1);
+
         /**
          * reads a given number of bytes from the underlying stream
          * @param bytes_to_read the number of bytes to read
@@ -50,24 +99,192 @@ namespace socket_wrapper {
         std::vector<char> read(size_t bytes_to_read, int timeout_ms = -1);
 
         size_t read(char *buffer, size_t max_bytes_to_read, size_t min_bytes_to_read, int timeout_ms = -1);
+
+        /**
+         * waits until at least min_bytes are buffered and returns all buffered data, without copying it
+         * The view stays valid until consume or another read is called, so there should be a single reader.
+         * Example:
+         * auto view = buffered_stream.peek(sizeof(header));
+         * size_t message_size = parseMessage(view.data, view.size);
+         * buffered_stream.consume(message_size);
+         * @param min_bytes the number of bytes to wait for, at most the buffer size
+         * @param timeout_ms the maximum time to wait for each read, -1 waits indefinitely
+         * @return a view of the buffered data
+         * @throws SocketException in case of read errors
+         */
+        BufferView peek(size_t min_bytes = 1, int timeout_ms = -1);
+
+        /**
+         * waits for a complete length prefixed frame and returns its payload, without copying it
+         * The frame is removed from the buffer, the view stays valid until the next read call.
+         * @param format the layout of the frames
+         * @param timeout_ms the maximum time to wait for each read, -1 waits indefinitely
+         * @return a view of the payload
+         * @throws SocketException in case of read errors, SOCKET_INVALID_FRAME if the frame exceeds
+         *         format.max_frame_size (it is left in the buffer) or its CRC32C does not match (it is removed)
+         * @throws std::logic_error if the frame does not fit into the buffer, use the overload taking on_chunk
+         */
+        BufferView readFrame(const FrameFormat &format, int timeout_ms = -1);
+
+        /**
+         * reads a length prefixed frame of any size up to format.max_frame_size, its payload is passed on in
+         * pieces as it arrives, without copying it. A frame which fits into the buffer may still be split up.
+         * on_chunk must not read from this BufferedStream. If reading fails (e.g. a timeout) in the middle of
+         * the frame, the rest of it is left in the stream.
+         * @param format the layout of the frames
+         * @param on_chunk called with consecutive pieces of the payload, the views are only valid during the call
+         * @param timeout_ms the maximum time to wait for each read, -1 waits indefinitely
+         * @return the size of the payload
+         * @throws SocketException in case of read errors, SOCKET_INVALID_FRAME if the frame exceeds
+         *         format.max_frame_size or its CRC32C does not match (after all chunks were passed on)
+         */
+        uint64_t readFrame(const FrameFormat &format, const std::function<void(BufferView)> &on_chunk,
+                           int timeout_ms = -1);
+
+        /**
+         * removes data from the front of the buffer, after it was processed through peek
+         * @param bytes the number of bytes to remove
+         * @throws std::out_of_range if less data is buffered
+         */
+        void consume(size_t bytes);
+
+        /**
+         * selects when writes are handed to the underlying Stream, pending writes are flushed first
+         * Small writes are copied into an outbound buffer and written with a single syscall once the policy says so.
+         * With cork set, the socket is corked (TCP_CORK) as well: flushes triggered by the size threshold leave an
+         * incomplete segment in the kernel to be completed by the next flush, while flush and the deadline push it.
+         * Example (flushing at the end of every event loop iteration):
+         * buffered_stream.setFlushPolicy(BufferedStream::FLUSH_EXPLICIT);
+         * reactor.addIterationHook([&]() { buffered_stream.flush(); });
+         * @param policy the flush policy
+         * @param flush_threshold the number of pending bytes written at once, ignored by FLUSH_IMMEDIATELY
+         * @param deadline_us the maximum time data stays pending with FLUSH_ON_DEADLINE, it is only checked on
+         *        writes and by flushIfDue, which the caller has to call while data is pending, e.g.
+         *        reactor.addIterationHook([&]() { buffered_stream.flushIfDue(); }, 1);
+         * @param cork true to cork the socket while buffering, only for TCP Streams
+         * @throws SocketException SOCKET_SET_OPTION if the socket could not be corked or uncorked
+         */
+        void setFlushPolicy(FLUSH_POLICY policy, size_t flush_threshold = kDefaultFlushThreshold,
+                            int deadline_us = kDefaultFlushDeadlineUs, bool cork = false);
+
+        /**
+         * writes all pending data to the underlying Stream, and pushes out an incomplete segment of a corked socket
+         * @throws SocketException in case of write errors, the data not written stays pending
+         */
+        void flush();
+
         /**
-         * Writes a given buffer to a Buffered Stream
+         * flushes if the oldest pending byte waited for the deadline of FLUSH_ON_DEADLINE
+         * @return true if data was flushed
+         * @throws SocketException in case of write errors, the data not written stays pending
+         */
+        bool flushIfDue();
+
+        /**
+         * @return the number of bytes written, but not yet handed to the underlying Stream
+         */
+        size_t getPendingWriteSize();
+
+        /**
+         * Writes a given buffer to a Buffered Stream, it is buffered according to the flush policy
          * @param buffer the data to write to the stream
          * @param buffer_length the length of the data to write
+         * @throws SocketException in case of write errors, the data written before stays pending unless it was sent,
+         *         processed_bytes is the number of bytes of buffer which were sent, the rest of it is not kept
          */
         void write(char const *buffer, size_t buffer_length);
+
+        /**
+         * Writes several buffers to the Buffered Stream using a single scatter/gather write where possible
+         * @param buffers the buffers to write, in order
+         * @param buffer_count the number of buffers
+         * @return the number of bytes written
+         * @throws SocketException in case of write errors, like write
+         */
+        size_t writev(const iovec *buffers, size_t buffer_count);
+
+        /**
+         * Writes several buffers to the Buffered Stream using a single scatter/gather write where possible
+         * @param buffers the buffers to write, in order
+         * @return the number of bytes written
+         */
+        size_t writev(const std::vector<iovec> &buffers);
+
+        /**
+         * Sends the content of a file to the Buffered Stream without copying it to userspace,
+         * pending writes are flushed first
+         * @see Stream::sendFile
+         */
+        size_t sendFile(int fd, off_t offset, size_t len, int timeout_ms = -1);
         /**
          * stops current reads, should only be called before destruction
          */
         void stopReads();
+
+        /**
+         * starts counting, the underlying Stream counts into the same block
+         * @see Stream::enableStats
+         */
+        void enableStats(std::shared_ptr<Stats> shared_stats = std::make_shared<Stats>());
+
+        /**
+         * @return the counters, all zero if enableStats was not called
+         */
+        StatsSnapshot getStats();
     private:
         Stream stream;
         std::recursive_mutex buffer_lock;
-        size_t stream_buffer_size;
-        char *stream_buffer;
-        size_t buffer_write_offset; // the number of bytes currently in the buffer
+        size_t buffer_size;
+        std::shared_ptr<BufferPool> buffer_pool;
+        // taken from the pool while there is buffered data (or a read is running), nullptr while idle
+        std::unique_ptr<RingBuffer> buffer;
+        // the delimiter scanned for last, and how many buffered bytes were scanned for it without a match
+        std::string scanned_delimiter;
+        size_t scanned_bytes = 0;
+        std::shared_ptr<Stats> stats; // nullptr unless enableStats was called
+        // the outbound buffer, guarded by write_lock
+        std::mutex write_lock;
+        FLUSH_POLICY flush_policy = FLUSH_IMMEDIATELY;
+        size_t flush_threshold = kDefaultFlushThreshold;
+        std::chrono::microseconds flush_deadline{kDefaultFlushDeadlineUs};
+        bool corked = false;
+        std::vector<char> pending_writes;
+        std::chrono::steady_clock::time_point pending_since; // when the oldest pending byte was written
+        /**
+         * reads into the buffer, an idle Stream returns its empty buffer to the pool before waiting for data, unless
+         * it waits in Stream::read (busy polling, io_uring)
+         */
         size_t readAvailableDataIntoBuffer(int timeout_ms = -1);
+        /**
+         * @return the buffered data, empty while no buffer is held
+         */
+        BufferView getBufferedData();
         std::vector<char> PopFromBuffer(size_t bytes_to_read);
+        /**
+         * removes data from the front of the buffer, keeping the scan position in place
+         */
+        void dropFromBuffer(size_t bytes);
+        /**
+         * reads until the header of the next frame is buffered
+         */
+        void waitForFrameHeader(const FrameFormat &format, size_t &header_size, uint64_t &payload_size,
+                                int timeout_ms);
+        /**
+         * reads until at least bytes are buffered
+         */
+        void waitForBufferedBytes(size_t bytes, int timeout_ms);
+        /**
+         * appends buffers to the outbound buffer and flushes it if due, write_lock has to be held
+         */
+        void appendPendingWrites(const iovec *buffers, size_t buffer_count);
+        /**
+         * writes the pending data, and optionally extra buffers behind it, with a single scatter/gather write,
+         * write_lock has to be held
+         * @param push true to push an incomplete segment out of a corked socket
+         * @throws SocketException in case of write errors, the pending data not written is kept, processed_bytes
+         *         counts the bytes of the extra buffers written
+         */
+        void flushPendingWrites(bool push, const iovec *extra_buffers = nullptr, size_t extra_buffer_count = 0);
 
     };
 }
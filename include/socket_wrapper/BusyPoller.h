@@ -0,0 +1,73 @@
+#ifndef SOCKET_WRAPPER_BUSYPOLLER_H
+#define SOCKET_WRAPPER_BUSYPOLLER_H
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace socket_wrapper {
+    /**
+     * @brief The spin phase of busy polling reads (Stream::enableBusyPolling, UdpDatagram::enableBusyPolling)
+     * Before a read blocks in poll, the socket is read with MSG_DONTWAIT in a loop for a time budget. In adaptive
+     * mode the budget follows the moving average of the time between two messages: the reader spins a little
+     * longer than the next message is expected to take, and does not spin at all if messages arrive too rarely
+     * for spinning to pay off.
+     */
+    class BusyPoller {
+    public:
+        static int const kDefaultMaxSpinUs = 50;
+
+        /**
+         * @param max_spin_us the upper limit of the spin budget
+         * @param adaptive true to adapt the budget to the message inter-arrival times, false to always spin max_spin_us
+         */
+        BusyPoller(int max_spin_us, bool adaptive);
+
+        /**
+         * calls receive until it returns data, an error other than EAGAIN, or the spin budget is used up.
+         * receive is called at least once
+         * @param receive a non blocking receive, returning the number of bytes received or -1 and setting errno
+         * @return the result of the last receive, -1 with errno EAGAIN if the budget was used up
+         */
+        template<typename Receive>
+        ssize_t spin(Receive receive) {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(getSpinBudgetUs());
+            while (true) {
+                ssize_t result = receive();
+                if (result >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    return result;
+                }
+                if (std::chrono::steady_clock::now() >= deadline) {
+                    errno = EAGAIN;
+                    return -1;
+                }
+                cpuRelax();
+            }
+        }
+
+        /**
+         * updates the inter-arrival average, should be called whenever a message was received
+         */
+        void recordArrival();
+
+        /**
+         * @return the current spin budget in microseconds
+         */
+        int getSpinBudgetUs() const;
+
+    private:
+        int max_spin_us;
+        bool adaptive;
+        std::atomic<int64_t> last_arrival_ns{0};
+        std::atomic<int64_t> average_gap_ns{0}; // exponentially weighted, 0 until two messages were received
+        // the weight of a new gap is 1 / 2^kAverageShift
+        static int const kAverageShift = 2;
+        // spin this many times longer than the expected gap, to absorb jitter
+        static int const kGapMultiplier = 2;
+
+        static void cpuRelax();
+    };
+}
+#endif //SOCKET_WRAPPER_BUSYPOLLER_H
@@ -0,0 +1,130 @@
+#ifndef SOCKET_WRAPPER_CANCELLATIONDOMAIN_H
+#define SOCKET_WRAPPER_CANCELLATIONDOMAIN_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace socket_wrapper {
+    /**
+     * @brief A group of sockets (Streams, UdpDatagrams, Listeners) which can be cancelled together
+     * All sockets of a domain share a single eventfd, blocking operations wait on it next to their socket.
+     * cancelAll() aborts all running and future blocking operations of all sockets in the domain with a single write,
+     * a single socket is still cancelled on its own through its stopReads()/stopAccepting(), which wakes up its blocked
+ * operations through the same eventfd (see StopRequest).
+     * Sockets which are not assigned a domain share the default domain.
+     * Example:
+     * auto domain = std::make_shared<CancellationDomain>();
+     * stream.setCancellationDomain(domain);
+     * ...
+     * domain->cancelAll(); // every read on every Stream of the domain throws SOCKET_TERMINATION_REQUEST
+     */
+    class CancellationDomain {
+    public:
+        /**
+         * @throws std::runtime_error if the eventfd could not be created
+         */
+        CancellationDomain();
+
+        CancellationDomain(CancellationDomain const &) = delete;
+
+        ~CancellationDomain() noexcept;
+
+        /**
+         * aborts all blocking operations of all sockets in the domain, this can not be undone
+         */
+        void cancelAll();
+
+        /**
+         * @return true after cancelAll was called
+         */
+        bool isCancelled() const;
+
+        /**
+         * @return the eventfd becoming readable on cancelAll, to be used with poll
+         */
+        int getFdForPoll() const;
+
+        /**
+         * @return the domain of all sockets without an explicitly assigned domain, it is never cancelled
+         */
+        static std::shared_ptr<CancellationDomain> getDefault();
+
+    private:
+        friend class StopRequest;
+        int event_fd;
+        std::atomic<bool> cancelled{false};
+        std::mutex wakeup_mtx; // orders writing and draining the eventfd
+        int running_wakeups = 0; // the StopRequests whose waiters did not all leave yet, guarded by wakeup_mtx
+
+        /**
+         * makes the eventfd readable until the matching endWakeup
+         */
+        void beginWakeup();
+
+        /**
+         * drains the eventfd once the last wakeup ended, unless the domain was cancelled
+         */
+        void endWakeup();
+    };
+
+    /**
+     * @brief The stop flag of a single socket (Stream::stopReads, UdpDatagram::stopReads)
+     * Requesting the stop wakes up the operations blocked on the socket through the eventfd of its domain, without
+     * touching the connection. The eventfd stays readable until every operation which waited on the socket left,
+     * blocked operations of other sockets of the domain see their own flag unset and wait again meanwhile.
+     * A blocking operation holds a Waiter while it waits on the eventfd of the domain.
+     */
+    class StopRequest {
+    public:
+        /**
+         * the registration of a blocked operation
+         */
+        class Waiter {
+        public:
+            Waiter(StopRequest &request, CancellationDomain &domain);
+
+            Waiter(Waiter const &) = delete;
+
+            ~Waiter() noexcept;
+
+        private:
+            StopRequest &request;
+            CancellationDomain &domain;
+        };
+
+        /**
+         * sets the flag and wakes up the blocked operations, this can not be undone
+         * @param domain the domain the operations wait on
+         */
+        void request(CancellationDomain &domain);
+
+        /**
+         * @return true after request was called
+         */
+        bool isRequested() const;
+
+        /**
+         * takes over the flag of a moved socket, no operation may be blocked on either
+         */
+        void assign(const StopRequest &other);
+
+    private:
+        std::atomic<bool> requested{false};
+        std::atomic<int> waiters{0};
+        std::atomic<bool> wakeup_running{false};
+
+        /**
+         * ends the wakeup once no operation waits anymore, called by the requester and by every leaving waiter
+         */
+        void finishWakeup(CancellationDomain &domain);
+    };
+
+    /**
+     * wakes up all threads blocked on a listening socket (shutdown of the receiving side), only used right before
+     * the socket is closed, a connected socket is woken up with a StopRequest instead
+     * @param socket_fd the listening socket to wake up
+     */
+    void wakeUpBlockedOperations(int socket_fd);
+}
+#endif //SOCKET_WRAPPER_CANCELLATIONDOMAIN_H
@@ -2,7 +2,10 @@
 #define SOCKET_WRAPPER_CONDITIONAL_BUFFERED_STREAM_H
 #include "socket_wrapper/BufferedStream.h"
 #include "SocketException.h"
+#include "LockFreeQueue.h"
+#include <condition_variable>
 #include <functional>
+#include <mutex>
 #include <stdexcept>
 
 namespace socket_wrapper {
@@ -12,10 +15,22 @@ namespace socket_wrapper {
      */
     using buffer_event_condition = std::function<int(const std::vector<char> &)>;
 
+    /**
+     * a buffer event condition evaluated on the buffered data in place, returning the same as buffer_event_condition
+     * scanned_bytes is the number of bytes at the front of data which the condition already saw, unchanged, in its
+     * previous call (and did not trigger on), so the condition only has to look at the new data. It is 0 after data
+     * was removed from the buffer. The view is only valid during the call. The condition may keep further state
+     * of its own (e.g. in a mutable lambda), it is only called by the worker thread.
+     */
+    using buffer_view_condition = std::function<int(BufferView data, size_t scanned_bytes)>;
+
     /**
      * This Stream splits incoming data into segments depending on a condition,
      * Example where a stream is split into newlines and every line is read individually.
-     * Furthermore poll() can be used on the fd returned by createEventfdOnCondition();
+     * Furthermore poll() can be used on the fd returned by createEventfdOnCondition(), it is readable while segments
+     * are queued for the condition. The worker adds the segments found after each read in one batch. The read
+     * functions reset the eventfd and set it again if segments are left, so a consumer of many small segments
+     * should poll and then readAll, instead of reading the segments one by one.
      * auto s = ConditionalBufferedStream(stream);
      * auto newline_condition = ConditionalBufferedStream::getDelimiterCondition('\n');
      * auto read_line_fd = s.createEventfdOnCondition(newline_condition);
@@ -28,12 +43,30 @@ namespace socket_wrapper {
 
         ~ConditionalBufferedStream();
 
+        /**
+         * the default number of segments a condition queues, until the worker waits for them to be read
+         */
+        static size_t const kDefaultQueueCapacity = 1024;
+
         /**
          * created a Buffered Stream which triggers events, when specific conditions are met
+         * The segments of each condition are queued in a bounded lock free queue. While it is full, the worker stops
+         * reading from the stream (and the peer is slowed down by the flow control of the socket).
          * @param condition
+         * @param queue_capacity the number of segments queued for the condition, rounded up to a power of two
+         * @param multi_consumer true if several threads read the condition at the same time, otherwise only one
+         *        thread may read it at a time
          * @return
          */
-        int createEventfdOnCondition(buffer_event_condition condition);
+        int createEventfdOnCondition(buffer_event_condition condition, size_t queue_capacity = kDefaultQueueCapacity,
+                                     bool multi_consumer = false);
+
+        /**
+         * creates an eventfd, which is triggered when a condition evaluated on the buffer in place is met
+         * @see createEventfdOnCondition
+         */
+        int createEventfdOnCondition(buffer_view_condition condition, size_t queue_capacity = kDefaultQueueCapacity,
+                                     bool multi_consumer = false);
 
         /**
          * starts processing the buffer, and triggering events, createEventfdOnCondition should no longer be called
@@ -42,10 +75,26 @@ namespace socket_wrapper {
 
         /**
          * reads available data, (non-blocking)
+         * only one thread may read a condition at a time, unless it was created with multi_consumer
          * @param condition_fd the condition providing the data segments
          * @return the data segment read
          */
         std::vector<char> read(int condition_fd);
+
+        /**
+         * reads all queued segments of a condition (non-blocking), taking them under a single lock
+         * only one thread may read a condition at a time, unless it was created with multi_consumer
+         * @param condition_fd the condition providing the data segments
+         * @return the segments in the order they were received, empty if none are queued
+         * @throws SocketException if none are queued and the stream failed or stopReads was called
+         */
+        std::vector<std::vector<char>> readAll(int condition_fd);
+
+        /**
+         * reads up to max_segments queued segments of a condition (non-blocking)
+         * @see readAll
+         */
+        std::vector<std::vector<char>> readBatch(int condition_fd, size_t max_segments);
         /**
          * writes the characters of a string to the stream
          * @param data
@@ -56,9 +105,27 @@ namespace socket_wrapper {
          * @param data the data to write
          */
         void write(std::vector<char> data);
+        /**
+         * writes several buffers to the stream, using a single scatter/gather write where possible
+         * @param buffers the buffers to write, in order
+         * @return the number of bytes written
+         */
+        size_t writev(const std::vector<iovec> &buffers);
+        /**
+         * writes a batch of messages to the stream, without copying them into a single buffer
+         * @param messages the messages to write, in order
+         * @return the number of bytes written
+         */
+        size_t writeBatch(const std::vector<std::vector<char>> &messages);
+        /**
+         * writes the data buffered by the flush policy of the BufferedStream
+         * @see BufferedStream::flush
+         */
+        void flush();
 
         /**
-         * performs a blocking read
+         * performs a blocking read, spurious wakeups of the eventfd are waited out
+         * only one thread may read a condition at a time, unless it was created with multi_consumer
          * @param condition_fd
          * @return
          */
@@ -69,19 +136,73 @@ namespace socket_wrapper {
          * @return the read string
          */
         std::string readBlockingStr(int condition_fd, int timeout_ms = -1);
+        /**
+         * a condition triggered by every line ending with the delimiter, including the delimiter,
+         * it is evaluated on a copy of the buffered data, getDelimiterViewCondition avoids the copy
+         */
         static buffer_event_condition getDelimiterCondition(char c);
+        /**
+         * a condition triggered by every line ending with the delimiter, including the delimiter,
+         * evaluated on the buffer in place, each byte is only scanned once
+         */
+        static buffer_view_condition getDelimiterViewCondition(char c);
+        /**
+         * a condition triggered by every complete length prefixed frame, the segments read are whole frames
+         * (including the header and the checksum), frames failing the CRC32C check are discarded
+         * @param format the layout of the frames, max_frame_size has to be less than the buffer size
+         */
+        static buffer_view_condition getFrameCondition(const FrameFormat &format);
         /**
          * aborts all currently running reads on the Stream
          */
         void stopReads();
+
+        /**
+         * starts counting condition evaluations and the time segments stay queued until they are read,
+         * should be called before start
+         * @see Stream::enableStats
+         */
+        void enableStats(std::shared_ptr<Stats> shared_stats = std::make_shared<Stats>());
+
+        /**
+         * @return the counters, all zero if enableStats was not called
+         */
+        StatsSnapshot getStats();
     private:
         SocketException::Type last_ex = SocketException::SOCKET_OK;
         std::thread worker;
         BufferedStream stream;
         std::atomic<bool> termination_requested{false};
+        struct received_segment {
+            std::vector<char> data;
+            std::chrono::steady_clock::time_point received_at; // only set if stats are enabled
+        };
+        /**
+         * the segments of a condition, pushed by the worker and popped by the readers
+         */
+        struct segment_queue {
+            std::unique_ptr<SpscQueue<received_segment>> single_consumer; // nullptr for multiple consumers
+            std::unique_ptr<MpmcQueue<received_segment>> multi_consumer;
+
+            bool tryPush(received_segment &&segment) {
+                return single_consumer ? single_consumer->tryPush(std::move(segment))
+                                       : multi_consumer->tryPush(std::move(segment));
+            }
+
+            bool tryPop(received_segment &segment) {
+                return single_consumer ? single_consumer->tryPop(segment) : multi_consumer->tryPop(segment);
+            }
+
+            bool empty() const {
+                return single_consumer ? single_consumer->empty() : multi_consumer->empty();
+            }
+        };
         struct buffer_event_handler {
-            buffer_event_condition condition;
+            buffer_view_condition condition;
             int fd;
+            size_t scanned_bytes; // the bytes at the front of the buffer the condition did not trigger on
+            std::unique_ptr<segment_queue> queue;
+            uint64_t unpublished_segments; // the segments pushed since the eventfd was written
         };
         /**
          * all conditions waited for
@@ -89,12 +210,56 @@ namespace socket_wrapper {
         std::list<buffer_event_handler> buffer_event_handlers;
         std::recursive_mutex buffer_event_handlers_mtx;
 
-        std::map<int, std::list<std::vector<char>>> received_data_per_condition;
-        std::recursive_mutex received_data_per_condition_mtx;
+        struct condition_queue {
+            int fd;
+            segment_queue *queue;
+        };
+        // the queues with the eventfd of their condition, in creation order, not modified after start
+        std::vector<condition_queue> queues_by_fd;
+        /**
+         * counts the segments taken by the readers, the worker waits for it to change while a queue is full
+         */
+        uint64_t segments_read = 0;
+        std::mutex queue_space_mtx;
+        std::condition_variable queue_space_freed;
+        std::shared_ptr<Stats> stats; // nullptr unless enableStats was called
 
         void ConditionalBufferWorker();
 
-        void processDataSendSignals(const std::vector<char> &data);
+        /**
+         * evaluates the conditions on the buffered data in a single pass, removes the segments they trigger on and
+         * publishes them, with one eventfd write per condition
+         */
+        void processDataSendSignals();
+
+        /**
+         * writes the eventfds of the conditions which got segments since they were last written,
+         * buffer_event_handlers_mtx has to be held
+         */
+        void publishSegments();
+
+        /**
+         * @return the number of segments taken by the readers so far
+         */
+        uint64_t segmentsRead();
+
+        /**
+         * blocks the worker until a reader took a segment after segmentsRead returned segments_read_before,
+         * buffer_event_handlers_mtx must not be held
+         * @throws SocketException SOCKET_TERMINATION_REQUEST if the reads were stopped
+         */
+        void waitForQueueSpace(uint64_t segments_read_before);
+
+        /**
+         * wakes up a worker waiting for space in a queue, so it notices the termination
+         */
+        void wakeUpWorker();
+
+        /**
+         * @return the queue of a condition
+         * @throws SocketException SOCKET_INVALID_CONDITION if the fd does not belong to a condition
+         */
+        segment_queue &getQueue(int condition_fd);
     };
 }
 #endif
\ No newline at end of file
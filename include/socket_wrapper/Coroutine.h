@@ -0,0 +1,214 @@
+#ifndef SOCKET_WRAPPER_COROUTINE_H
+#define SOCKET_WRAPPER_COROUTINE_H
+
+#if __cplusplus < 202002L
+#error "socket_wrapper/Coroutine.h requires C++20"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "Reactor.h"
+#include "Stream.h"
+#include "Listener.h"
+#include "UdpDatagram.h"
+#include "ConditionalBufferedStream.h"
+
+namespace socket_wrapper {
+    namespace detail {
+        /**
+         * the part of a Task promise which does not depend on the result type
+         */
+        struct TaskPromiseBase {
+            std::coroutine_handle<> continuation = std::noop_coroutine();
+            std::exception_ptr exception;
+
+            struct FinalAwaiter {
+                bool await_ready() noexcept { return false; }
+
+                // resumes the awaiting coroutine without growing the stack
+                template<typename Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept {
+                    return finished.promise().continuation;
+                }
+
+                void await_resume() noexcept {}
+            };
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            FinalAwaiter final_suspend() noexcept { return {}; }
+
+            void unhandled_exception() noexcept { exception = std::current_exception(); }
+        };
+    }
+
+    /**
+     * @brief A lazily started coroutine, it runs once it is co_awaited (or passed to spawn)
+     * Exceptions thrown by the coroutine are rethrown to the awaiting coroutine.
+     * Example:
+     * Task<size_t> echo(Reactor &reactor, Stream &stream) {
+     *     char buffer[64];
+     *     size_t n = co_await asyncRead(reactor, stream, buffer, sizeof(buffer));
+     *     co_await asyncWrite(reactor, stream, buffer, n);
+     *     co_return n;
+     * }
+     */
+    template<typename T = void>
+    class Task {
+    public:
+        struct promise_type : detail::TaskPromiseBase {
+            std::optional<T> value;
+
+            Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+            template<typename U>
+            void return_value(U &&result) { value.emplace(std::forward<U>(result)); }
+        };
+
+        Task(Task const &) = delete;
+
+        Task(Task &&src) noexcept: coroutine(std::exchange(src.coroutine, nullptr)) {}
+
+        ~Task() noexcept {
+            if (coroutine) {
+                coroutine.destroy();
+            }
+        }
+
+        bool await_ready() noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            coroutine.promise().continuation = awaiting;
+            return coroutine;
+        }
+
+        T await_resume() {
+            if (coroutine.promise().exception) {
+                std::rethrow_exception(coroutine.promise().exception);
+            }
+            return std::move(*coroutine.promise().value);
+        }
+
+    private:
+        explicit Task(std::coroutine_handle<promise_type> coroutine) : coroutine(coroutine) {}
+
+        std::coroutine_handle<promise_type> coroutine;
+    };
+
+    template<>
+    class Task<void> {
+    public:
+        struct promise_type : detail::TaskPromiseBase {
+            Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+            void return_void() noexcept {}
+        };
+
+        Task(Task const &) = delete;
+
+        Task(Task &&src) noexcept: coroutine(std::exchange(src.coroutine, nullptr)) {}
+
+        ~Task() noexcept {
+            if (coroutine) {
+                coroutine.destroy();
+            }
+        }
+
+        bool await_ready() noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            coroutine.promise().continuation = awaiting;
+            return coroutine;
+        }
+
+        void await_resume() {
+            if (coroutine.promise().exception) {
+                std::rethrow_exception(coroutine.promise().exception);
+            }
+        }
+
+    private:
+        explicit Task(std::coroutine_handle<promise_type> coroutine) : coroutine(coroutine) {}
+
+        std::coroutine_handle<promise_type> coroutine;
+    };
+
+    /**
+     * @brief Suspends the awaiting coroutine until a file descriptor is readable (or writable)
+     * The file descriptor is registered with the Reactor for a single wakeup, the coroutine is resumed on a
+     * worker thread of the Reactor. Only one coroutine may wait on a file descriptor at a time.
+     */
+    class ReadinessAwaitable {
+    public:
+        ReadinessAwaitable(Reactor &reactor, int fd, bool wait_for_writable);
+
+        bool await_ready() noexcept { return false; }
+
+        /**
+         * @throws SocketException if the file descriptor could not be registered
+         */
+        void await_suspend(std::coroutine_handle<> awaiting);
+
+        void await_resume() noexcept {}
+
+    private:
+        Reactor &reactor;
+        int fd;
+        bool wait_for_writable;
+    };
+
+    /**
+     * @return an awaitable resuming once fd is readable, or an error/hangup occurred
+     */
+    ReadinessAwaitable readable(Reactor &reactor, int fd);
+
+    /**
+     * @return an awaitable resuming once fd is writable, or an error/hangup occurred
+     */
+    ReadinessAwaitable writable(Reactor &reactor, int fd);
+
+    /**
+     * starts a coroutine, which is not awaited by anyone. Exceptions escaping it are logged.
+     * @param task the coroutine, it runs on the calling thread until its first suspension
+     */
+    void spawn(Task<> task);
+
+    /**
+     * reads from the Stream, suspending instead of blocking while no data is available
+     * @see Stream::read
+     * @return the number of bytes read
+     * @throws SocketException in case of read errors, if the stream was closed or stopReads was called
+     */
+    Task<size_t> asyncRead(Reactor &reactor, Stream &stream, char *buffer, size_t max_bytes_to_read,
+                           size_t min_bytes_to_read = 1);
+
+    /**
+     * writes the whole buffer to the Stream, suspending while the socket is not writable
+     * @throws SocketException in case of write errors
+     */
+    Task<> asyncWrite(Reactor &reactor, Stream &stream, const char *buffer, size_t size);
+
+    /**
+     * waits for and accepts a connection, a connection taken by someone else in the meantime is waited out
+     * @throws SocketException on errors
+     */
+    Task<Stream> asyncAccept(Reactor &reactor, Listener &listener);
+
+    /**
+     * waits for and reads a datagram
+     * @see UdpDatagram::read
+     */
+    Task<std::vector<char>> asyncRead(Reactor &reactor, UdpDatagram &datagram);
+
+    /**
+     * waits for a condition to be met and reads its data segment
+     * @see ConditionalBufferedStream::readBlocking
+     * @param condition_fd the fd returned by createEventfdOnCondition
+     */
+    Task<std::vector<char>> asyncReadBlocking(Reactor &reactor, ConditionalBufferedStream &stream, int condition_fd);
+}
+#endif //SOCKET_WRAPPER_COROUTINE_H
@@ -0,0 +1,63 @@
+#ifndef SOCKET_WRAPPER_FRAMEFORMAT_H
+#define SOCKET_WRAPPER_FRAMEFORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace socket_wrapper {
+    /**
+     * The layout of length prefixed binary frames: a header holding the payload size, the payload and optionally
+     * a CRC32C of the payload (4 bytes, little endian). Read with BufferedStream::readFrame.
+     * Example (a 2 byte big endian length, frames of at most 4 KiB):
+     * FrameFormat format;
+     * format.length_bytes = 2;
+     * format.max_frame_size = 4096;
+     * auto payload = buffered_stream.readFrame(format);
+     */
+    struct FrameFormat {
+        enum LENGTH_ENCODING {
+            LENGTH_FIXED, // length_bytes bytes, in the byte order given by big_endian
+            LENGTH_VARINT // 7 bits per byte, least significant group first, the high bit marks a following byte
+        };
+        static size_t const kMaxHeaderSize = 10; // the longest varint encoding of a 64 bit length
+        static size_t const kChecksumSize = 4;
+        LENGTH_ENCODING length_encoding = LENGTH_FIXED;
+        size_t length_bytes = 4; // 1, 2, 4 or 8, only used by LENGTH_FIXED
+        bool big_endian = true;
+        uint64_t max_frame_size = 16 << 20; // the maximum payload size, larger frames are rejected
+        bool crc32c = false; // true if the payload is followed by its CRC32C
+    };
+
+    /**
+     * decodes the header in front of a frame
+     * @param format the frame format
+     * @param data the buffered data, starting at the header
+     * @param size the number of bytes in data
+     * @param header_size set to the size of the header
+     * @param payload_size set to the size of the payload
+     * @return false if data does not contain the complete header yet
+     * @throws SocketException SOCKET_INVALID_FRAME with EMSGSIZE if the payload exceeds max_frame_size,
+     *         with EBADMSG if a varint is longer than kMaxHeaderSize
+     */
+    bool decodeFrameHeader(const FrameFormat &format, const char *data, size_t size, size_t &header_size,
+                           uint64_t &payload_size);
+
+    /**
+     * encodes the header of a frame
+     * @param format the frame format
+     * @param payload_size the size of the payload
+     * @param header receives the header, at least kMaxHeaderSize bytes
+     * @return the size of the header
+     */
+    size_t encodeFrameHeader(const FrameFormat &format, uint64_t payload_size, char *header);
+
+    /**
+     * computes the CRC32C (Castagnoli) checksum, with the SSE4.2 crc32 instruction if the CPU supports it
+     * @param data the data to checksum
+     * @param size the number of bytes
+     * @param previous the checksum of the preceding data, to checksum data in pieces, 0 for the first piece
+     * @return the checksum
+     */
+    uint32_t crc32c(const char *data, size_t size, uint32_t previous = 0);
+}
+#endif //SOCKET_WRAPPER_FRAMEFORMAT_H
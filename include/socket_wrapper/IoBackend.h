@@ -0,0 +1,130 @@
+#ifndef SOCKET_WRAPPER_IOBACKEND_H
+#define SOCKET_WRAPPER_IOBACKEND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <vector>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace socket_wrapper {
+    /**
+     * the mechanism blocking reads (Stream::read, UdpDatagram::read) and Listener::accept wait with
+     */
+    enum IO_BACKEND {
+        IO_BACKEND_POLL, // poll() followed by the operation, two syscalls
+        IO_BACKEND_IO_URING // the operation, its timeout and the termination request submitted as one io_uring batch
+    };
+
+    /**
+     * selects the backend used by all threads, falls back to IO_BACKEND_POLL if io_uring is not supported
+     * @param backend the backend to use
+     * @return the backend actually in use
+     */
+    IO_BACKEND setIoBackend(IO_BACKEND backend);
+
+    IO_BACKEND getIoBackend();
+
+    /**
+     * @brief A minimal io_uring, every thread using the IO_BACKEND_IO_URING backend owns one
+     * Every operation is submitted together with a linked timeout and a poll on the termination eventfd,
+     * so waiting for and performing the operation costs a single io_uring_enter.
+     */
+    class IoUring {
+    public:
+        /**
+         * the result of an operation aborted, because the termination eventfd became readable
+         */
+        static int const kTerminated = -ECANCELED;
+        /**
+         * the result of an operation which timed out
+         */
+        static int const kTimedOut = -ETIME;
+
+        /**
+         * @return true if the kernel supports all operations required
+         */
+        static bool isSupported();
+
+        /**
+         * @return the ring of the calling thread, nullptr if the poll backend is selected or no ring could be created
+         */
+        static IoUring *forCurrentThread();
+
+        IoUring(IoUring const &) = delete;
+
+        ~IoUring() noexcept;
+
+        /**
+         * waits for and receives data from a socket
+         * @param fd the socket
+         * @param stop_fd an eventfd aborting the operation when readable, -1 for none
+         * @param timeout_ms the maximum time to wait, -1 waits indefinitely
+         * @return the number of bytes received, or -errno, kTerminated or kTimedOut
+         */
+        ssize_t recv(int fd, char *buffer, size_t len, int stop_fd, int timeout_ms);
+
+        /**
+         * waits for and receives a message from a socket
+         * @see recv
+         */
+        ssize_t recvmsg(int fd, msghdr *msg, int stop_fd, int timeout_ms);
+
+        /**
+         * waits for and accepts a connection
+         * @return the accepted socket, or -errno, kTerminated or kTimedOut
+         * @see recv
+         */
+        int accept(int fd, sockaddr *addr, socklen_t *addr_length, int stop_fd, int timeout_ms);
+
+    private:
+        IoUring();
+
+        int ring_fd = -1;
+        void *sq_ring = nullptr;
+        size_t sq_ring_size = 0;
+        void *cq_ring = nullptr;
+        size_t cq_ring_size = 0;
+        io_uring_sqe *sqes = nullptr;
+        size_t sqes_size = 0;
+        unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+        unsigned sq_entries;
+        unsigned *cq_head, *cq_tail, *cq_mask;
+        io_uring_cqe *cqes;
+        uint64_t sequence = 0;
+        // termination polls of finished operations, they are cancelled with the next submission
+        std::vector<uint64_t> pending_cancels;
+        // set if an operation could not be waited for, the ring was torn down then and is no longer used
+        bool unusable = false;
+
+        /**
+         * submits an operation and waits for its completion, it is cancelled if io_uring_enter fails
+         */
+        int submitAndWait(io_uring_sqe &operation, int stop_fd, int timeout_ms);
+
+        /**
+         * submits queued entries until count entries are free
+         * @return false (with errno set) if io_uring_enter failed
+         */
+        bool reserveSqes(unsigned count);
+
+        /**
+         * @return the next entry of the submission queue, nullptr (with errno set) if it is full and the queued
+         *         entries could not be submitted
+         */
+        io_uring_sqe *nextSqe();
+
+        /**
+         * unmaps the rings and closes the ring fd, which cancels the outstanding requests, may be called repeatedly
+         */
+        void unmap() noexcept;
+
+        static int const kRingEntries = 8;
+        static int const kMaxEnterFailures = 100;
+    };
+}
+#endif //SOCKET_WRAPPER_IOBACKEND_H
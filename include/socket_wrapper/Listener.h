@@ -6,9 +6,13 @@
 #include <atomic>
 #include <cstdint>
 #include <memory>
+#include <string>
 
 #include "Stream.h"
 #include "BaseTypes.h"
+#include "StreamOptions.h"
+#include "CancellationDomain.h"
+#include "Stats.h"
 
 namespace socket_wrapper {
 /**
@@ -22,9 +26,11 @@ namespace socket_wrapper {
          * @param onIncomingStream a callback for receiving incoming Streams
          * @param port the port to start the listener on
          * @param version The version of the ip (v4,v6) to use
+         * @param options socket options set on the listening socket and on every accepted Stream
          * @throws SocketException on errors
          */
-        explicit ListenerBase(int port = 23, IP_VERSION version = socket_wrapper::IPv4);
+        explicit ListenerBase(int port = 23, IP_VERSION version = socket_wrapper::IPv4,
+                              const StreamOptions &options = StreamOptions());
         /**
          * closes the underlying socket, and thread
          */
@@ -38,12 +44,19 @@ namespace socket_wrapper {
          * after this call onIncomingStream will no longer be called
         */
         void stopAccepting();
+        /**
+         * should only be called before startAccepting
+         * @param domain the domain whose cancelAll stops accepting, accepted Streams join it as well
+         */
+        void setCancellationDomain(std::shared_ptr<CancellationDomain> domain);
     private:
         virtual void onIncomingStream(Stream stream) = 0;
         std::thread handle_incoming_streams_task;
         std::atomic<int> listener_socket_fd;
-        std::atomic<int> listener_end_fd;
+        std::shared_ptr<CancellationDomain> cancellation_domain = CancellationDomain::getDefault();
+        std::atomic<bool> stop_requested{false};
         std::atomic<bool>stopped_accepting;
+        StreamOptions accepted_stream_options;
         void handleIncomingStreams();
     };
 /**
@@ -57,9 +70,22 @@ namespace socket_wrapper {
          * @param onIncomingStream a callback for receiving incoming Streams
          * @param port the port to start the listener on
          * @param version The version of the ip (v4,v6) to use
+         * @param reuse sets SO_REUSEADDR and SO_REUSEPORT
+         * @param options socket options set on the listening socket and on every accepted Stream
          * @throws SocketException on errors
          */
-        explicit Listener(int port = 23, IP_VERSION version = socket_wrapper::IPv4, bool reuse = true);
+        explicit Listener(int port = 23, IP_VERSION version = socket_wrapper::IPv4, bool reuse = true,
+                          const StreamOptions &options = StreamOptions());
+        /**
+         * Creates a Listener on a Unix domain socket, local peers connect with StreamFactory::CreateUnixStream
+         * A stale socket file left at path (e.g. by a crashed process) is replaced if connecting to it is refused,
+         * the file is removed again when the Listener is closed.
+         * @param unix_path a filesystem path, or a name in the abstract namespace if it starts with '@'
+         * @param options socket options set on the listening socket and on every accepted Stream,
+         *                TCP options do not apply to Unix sockets
+         * @throws SocketException on errors
+         */
+        explicit Listener(const std::string &unix_path, const StreamOptions &options = StreamOptions());
         Stream accept(int timeout = -1);
 
         /**
@@ -67,15 +93,37 @@ namespace socket_wrapper {
         * after this call onIncomingStream will no longer be called
         */
         void stopAccepting();
+        /**
+         * starts counting poll and accept syscalls, should be called before accepting
+         * @param shared_stats the block to count in, may be shared with other objects to aggregate them
+         */
+        void enableStats(std::shared_ptr<Stats> shared_stats = std::make_shared<Stats>());
+        /**
+         * @return the counters, all zero if enableStats was not called
+         */
+        StatsSnapshot getStats();
+        /**
+         * should not be called while accepting
+         * @param domain the domain whose cancelAll aborts accept, accepted Streams join it as well
+         */
+        void setCancellationDomain(std::shared_ptr<CancellationDomain> domain);
         /**
          * closes the underlying socket
          */
         ~Listener() noexcept;
         int getFdForPoll();
+        /**
+         * @return the effective socket options of the listening socket
+         */
+        StreamOptions getOptions();
     private:
         std::atomic<int> listener_socket_fd;
-        std::atomic<int> listener_end_fd;
+        std::shared_ptr<CancellationDomain> cancellation_domain = CancellationDomain::getDefault();
+        std::atomic<bool> stop_requested{false};
         std::atomic<bool>stopped_accepting;
+        StreamOptions accepted_stream_options;
+        std::shared_ptr<Stats> stats; // nullptr unless enableStats was called
+        std::string unix_path; // the socket file to remove on close, empty for TCP and abstract Unix sockets
     };
 }
 
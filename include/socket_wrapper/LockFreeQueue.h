@@ -0,0 +1,198 @@
+#ifndef SOCKET_WRAPPER_LOCKFREEQUEUE_H
+#define SOCKET_WRAPPER_LOCKFREEQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace socket_wrapper {
+    namespace detail {
+        // the producer and consumer positions are kept this far apart, so they do not share a cache line
+        size_t const kCacheLineSize = 64;
+
+        inline size_t roundUpToPowerOfTwo(size_t value) {
+            size_t result = 1;
+            while (result < value) {
+                result <<= 1;
+            }
+            return result;
+        }
+    }
+
+    /**
+     * @brief A bounded queue for one producer thread and one consumer thread, without locks
+     * The producer only writes the tail and the consumer only writes the head, each side keeps a copy of the other
+     * position and only reloads it when the queue looks full (or empty), so most operations touch no shared cache line.
+     */
+    template<typename T>
+    class SpscQueue {
+    public:
+        /**
+         * @param capacity the maximum number of elements, rounded up to a power of two
+         */
+        explicit SpscQueue(size_t capacity) : mask(detail::roundUpToPowerOfTwo(capacity) - 1),
+                                              slots(new T[mask + 1]) {}
+
+        SpscQueue(SpscQueue const &) = delete;
+
+        /**
+         * appends an element, only called by the producer
+         * @param value the element, it is only moved from if there was space
+         * @return false if the queue is full
+         */
+        bool tryPush(T &&value) {
+            size_t current_tail = tail.load(std::memory_order_relaxed);
+            if (current_tail - cached_head > mask) {
+                cached_head = head.load(std::memory_order_acquire);
+                if (current_tail - cached_head > mask) {
+                    return false;
+                }
+            }
+            slots[current_tail & mask] = std::move(value);
+            tail.store(current_tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * removes the first element, only called by the consumer
+         * @param value receives the element
+         * @return false if the queue is empty
+         */
+        bool tryPop(T &value) {
+            size_t current_head = head.load(std::memory_order_relaxed);
+            if (current_head == cached_tail) {
+                cached_tail = tail.load(std::memory_order_acquire);
+                if (current_head == cached_tail) {
+                    return false;
+                }
+            }
+            value = std::move(slots[current_head & mask]);
+            head.store(current_head + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @return true if the queue is empty, may be outdated once it returns
+         */
+        bool empty() const {
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+        }
+
+        size_t capacity() const { return mask + 1; }
+
+    private:
+        size_t const mask;
+        std::unique_ptr<T[]> slots;
+        char head_padding[detail::kCacheLineSize];
+        std::atomic<size_t> head{0}; // the position of the next element to pop, written by the consumer
+        size_t cached_tail = 0; // the consumer's copy of tail
+        char tail_padding[detail::kCacheLineSize];
+        std::atomic<size_t> tail{0}; // the position of the next element to push, written by the producer
+        size_t cached_head = 0; // the producer's copy of head
+        char end_padding[detail::kCacheLineSize];
+    };
+
+    /**
+     * @brief A bounded queue for any number of producer and consumer threads, without locks (Dmitry Vyukov's design)
+     * Every cell carries a sequence number telling whether it is free for the push or filled for the pop at a given
+     * position. Producers and consumers claim a position with a single compare and swap and then only touch their cell.
+     */
+    template<typename T>
+    class MpmcQueue {
+    public:
+        /**
+         * @param capacity the maximum number of elements, rounded up to a power of two
+         */
+        explicit MpmcQueue(size_t capacity) : mask(detail::roundUpToPowerOfTwo(capacity) - 1),
+                                              cells(new Cell[mask + 1]) {
+            for (size_t i = 0; i <= mask; i++) {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MpmcQueue(MpmcQueue const &) = delete;
+
+        /**
+         * appends an element
+         * @param value the element, it is only moved from if there was space
+         * @return false if the queue is full
+         */
+        bool tryPush(T &&value) {
+            size_t position = enqueue_position.load(std::memory_order_relaxed);
+            Cell *cell;
+            while (true) {
+                cell = &cells[position & mask];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                auto difference = (intptr_t) sequence - (intptr_t) position;
+                if (difference == 0) {
+                    // the cell is free, claim the position
+                    if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (difference < 0) {
+                    return false; // the cell still holds the element pushed one round earlier
+                } else {
+                    position = enqueue_position.load(std::memory_order_relaxed);
+                }
+            }
+            cell->value = std::move(value);
+            cell->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * removes the first element
+         * @param value receives the element
+         * @return false if the queue is empty
+         */
+        bool tryPop(T &value) {
+            size_t position = dequeue_position.load(std::memory_order_relaxed);
+            Cell *cell;
+            while (true) {
+                cell = &cells[position & mask];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                auto difference = (intptr_t) sequence - (intptr_t) (position + 1);
+                if (difference == 0) {
+                    // the cell is filled, claim the position
+                    if (dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (difference < 0) {
+                    return false; // the cell was not filled yet
+                } else {
+                    position = dequeue_position.load(std::memory_order_relaxed);
+                }
+            }
+            value = std::move(cell->value);
+            // frees the cell for the push one round later
+            cell->sequence.store(position + mask + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @return true if the queue is empty, may be outdated once it returns. A push which claimed its position,
+         *         but did not finish yet, makes the queue look not empty.
+         */
+        bool empty() const {
+            return dequeue_position.load(std::memory_order_acquire) == enqueue_position.load(std::memory_order_acquire);
+        }
+
+        size_t capacity() const { return mask + 1; }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+        size_t const mask;
+        std::unique_ptr<Cell[]> cells;
+        char enqueue_padding[detail::kCacheLineSize];
+        std::atomic<size_t> enqueue_position{0};
+        char dequeue_padding[detail::kCacheLineSize];
+        std::atomic<size_t> dequeue_position{0};
+        char end_padding[detail::kCacheLineSize];
+    };
+}
+#endif //SOCKET_WRAPPER_LOCKFREEQUEUE_H
@@ -0,0 +1,157 @@
+#ifndef SOCKET_WRAPPER_REACTOR_H
+#define SOCKET_WRAPPER_REACTOR_H
+
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "BaseTypes.h"
+
+namespace socket_wrapper {
+    /**
+     * a readiness callback, it is executed on one of the worker threads of a Reactor.
+     * File descriptors are registered edge triggered, so the callback should consume all available data
+     * (e.g. call Stream::tryRead until it returns 0). If the callback throws, the file descriptor is removed.
+     */
+    using readiness_callback = std::function<void()>;
+
+    /**
+     * a hook executed by the workers of a Reactor at the end of every event loop iteration, after the callbacks of
+     * the iteration ran, e.g. to flush the writes buffered by these callbacks (see BufferedStream::setFlushPolicy).
+     * With several workers a hook may run on several threads at the same time. If the hook throws, it is removed.
+     */
+    using iteration_hook = std::function<void()>;
+
+    /**
+     * @brief An event loop driving many Streams, Listeners and UdpDatagrams from a small fixed pool of threads
+     * All file descriptors are kept in a single epoll set in edge triggered mode, a callback for a given file
+     * descriptor is never executed on two threads at the same time.
+     * Example:
+     * Reactor reactor(2);
+     * reactor.add(stream, [&]() { while ((n = stream.tryRead(buffer, sizeof(buffer))) > 0) { ... } });
+     * ...
+     * reactor.stop();
+     */
+    class Reactor {
+    public:
+        /**
+         * creates the epoll set and starts the worker threads
+         * @param worker_count the number of threads executing readiness callbacks
+         * @throws SocketException on errors
+         */
+        explicit Reactor(size_t worker_count = 1);
+
+        Reactor(Reactor const &) = delete;
+
+        /**
+         * stops the worker threads and closes the epoll set, registered file descriptors are not closed
+         */
+        ~Reactor() noexcept;
+
+        /**
+         * registers a file descriptor, the file descriptor is switched to non blocking mode
+         * @param fd the file descriptor to watch
+         * @param on_readable called when the file descriptor becomes readable (or an error/hangup occurs)
+         * @param on_writable called when the file descriptor becomes writable, may be empty
+         * @throws SocketException if the file descriptor could not be added
+         */
+        void add(int fd, readiness_callback on_readable, readiness_callback on_writable = nullptr);
+
+        /**
+         * registers a Stream, the Stream has to outlive its registration
+         */
+        void add(Stream &stream, readiness_callback on_readable, readiness_callback on_writable = nullptr);
+
+        /**
+         * registers a Listener, on_readable is called when there are connections waiting to be accepted
+         */
+        void add(Listener &listener, readiness_callback on_readable);
+
+        /**
+         * registers a UdpDatagram, on_readable is called when there are datagrams waiting
+         */
+        void add(UdpDatagram &datagram, readiness_callback on_readable);
+
+        /**
+         * unregisters a file descriptor, waits until a callback running for it on another thread finished, the
+         * callbacks are not executed again once this returns. A callback may remove its own file descriptor, its own
+         * execution is not waited for.
+         * @param fd the file descriptor to remove
+         */
+        void remove(int fd);
+
+        /**
+         * adds a hook executed at the end of every event loop iteration
+         * @param hook the hook to execute
+         * @param interval_ms if not -1, an idle Reactor still executes the hooks at least every interval_ms
+         *        (e.g. to enforce a flush deadline), otherwise they only run after readiness callbacks
+         * @return the id of the hook, to remove it again
+         */
+        size_t addIterationHook(iteration_hook hook, int interval_ms = -1);
+
+        /**
+         * removes a hook, waits until running executions on other threads finished, the hook is not executed again
+         * once this returns. A hook may remove itself, its own execution is not waited for.
+         * @param hook_id the id returned by addIterationHook
+         */
+        void removeIterationHook(size_t hook_id);
+
+        /**
+         * stops all worker threads, no callbacks are executed afterwards. Must not be called from a callback.
+         */
+        void stop();
+
+    private:
+        struct registration {
+            int fd;
+            readiness_callback on_readable;
+            readiness_callback on_writable;
+            bool removed; // guarded by registrations_mtx, like running
+            int running; // the number of workers executing a callback of the registration
+        };
+        struct hook_registration {
+            iteration_hook hook;
+            int interval_ms;
+            bool removed; // guarded by hooks_mtx, like running
+            int running; // the number of workers executing the hook
+        };
+        int epoll_fd;
+        int stop_event_fd;
+        int wakeup_event_fd; // wakes up a worker to pick up a changed epoll_wait timeout
+        std::atomic<bool> stopped{false};
+        std::vector<std::thread> workers;
+        std::map<int, std::shared_ptr<registration>> registrations;
+        std::mutex registrations_mtx;
+        std::condition_variable callback_finished; // notified when a removed registration is no longer running
+        std::map<size_t, std::shared_ptr<hook_registration>> hooks;
+        size_t next_hook_id = 0;
+        std::atomic<bool> has_hooks{false};
+        std::atomic<int> wait_timeout_ms{-1}; // the shortest interval of all hooks
+        std::mutex hooks_mtx;
+        std::condition_variable hook_finished; // notified when a removed hook is no longer running
+        static int const kMaxEventsPerWait = 64;
+
+        void worker();
+
+        void dispatch(int fd, uint32_t events);
+
+        /**
+         * executes all iteration hooks
+         * @param running reused storage for the hooks, to not allocate in every iteration
+         */
+        void runIterationHooks(std::vector<std::shared_ptr<hook_registration>> &running);
+
+        /**
+         * updates has_hooks and wait_timeout_ms, hooks_mtx has to be held
+         */
+        void hooksChanged();
+
+        static uint32_t eventMaskFor(const registration &r);
+    };
+}
+#endif //SOCKET_WRAPPER_REACTOR_H
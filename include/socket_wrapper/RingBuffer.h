@@ -0,0 +1,88 @@
+#ifndef SOCKET_WRAPPER_RINGBUFFER_H
+#define SOCKET_WRAPPER_RINGBUFFER_H
+
+#include <cstddef>
+
+namespace socket_wrapper {
+    /**
+     * @brief The read buffer of a BufferedStream, a circular buffer whose data is always contiguous
+     * The memory is mapped twice, back to back (a memfd mapped at base and base + capacity), so a region wrapping
+     * around the end of the buffer continues seamlessly in the second mapping. Consuming data is a pointer bump,
+     * no data is ever moved. If the double mapping can not be set up, a plain buffer is used instead, which moves
+     * the data to the front once the free space behind it is used up (see compact).
+     */
+    class RingBuffer {
+    public:
+        RingBuffer() = delete;
+
+        /**
+         * @param min_capacity the minimum capacity, it is rounded up to a multiple of the page size
+         */
+        explicit RingBuffer(size_t min_capacity);
+
+        RingBuffer(RingBuffer const &) = delete;
+
+        RingBuffer(RingBuffer &&src) noexcept;
+
+        ~RingBuffer() noexcept;
+
+        /**
+         * @return the first byte of the data, followed by size() contiguous bytes
+         */
+        char *data() const { return base + head; }
+
+        /**
+         * @return the number of bytes in the buffer
+         */
+        size_t size() const { return used; }
+
+        size_t capacity() const { return buffer_capacity; }
+
+        /**
+         * @return the free space behind the data, writableSize() contiguous bytes
+         */
+        char *writableData() const { return base + head + used; }
+
+        /**
+         * @return the size of the free space behind the data, less than the free space of the buffer only if it
+         *         is not double mapped and compact was not called
+         */
+        size_t writableSize() const { return (double_mapped ? buffer_capacity : buffer_capacity - head) - used; }
+
+        /**
+         * appends bytes written to writableData
+         * @param len the number of bytes written, at most writableSize()
+         */
+        void commitWrite(size_t len) { used += len; }
+
+        /**
+         * removes bytes from the front of the data
+         * @param len the number of bytes to remove, at most size()
+         */
+        void consume(size_t len);
+
+        /**
+         * makes all free space writable, by moving the data to the front of a buffer which is not double mapped
+         * @return the number of bytes moved, always 0 for a double mapped buffer
+         */
+        size_t compact();
+
+        /**
+         * @return true if the buffer is double mapped and never moves data
+         */
+        bool isDoubleMapped() const { return double_mapped; }
+
+    private:
+        char *base = nullptr;
+        size_t buffer_capacity = 0;
+        size_t head = 0; // the offset of the data, always < buffer_capacity
+        size_t used = 0;
+        bool double_mapped = false;
+
+        /**
+         * @return true if the double mapping was set up
+         */
+        bool mapTwice();
+    };
+}
+#endif //SOCKET_WRAPPER_RINGBUFFER_H
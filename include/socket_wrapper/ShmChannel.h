@@ -0,0 +1,179 @@
+#ifndef SOCKET_WRAPPER_SHMCHANNEL_H
+#define SOCKET_WRAPPER_SHMCHANNEL_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+
+namespace socket_wrapper {
+    /**
+     * @brief One end of a bidirectional byte channel through shared memory, for peers on the same host
+     * Each direction is a single producer single consumer ring buffer in a memfd, mapped by both ends. Data is
+     * copied into and out of the ring without any syscall. Each ring has two eventfd doorbells: the writer rings
+     * the data doorbell only if the reader is parked in waitUntilReadable, the reader rings the space doorbell only
+     * if the writer is parked in waitUntilWritable. So syscalls are only made by a side which runs out of work.
+     * The interface follows the socket calls (-1 and errno), it backs the Streams created by
+     * StreamFactory::CreateShmPipe and StreamFactory::CreateShmStreamToPeer, which should be used instead.
+     * Reading and writing may happen on two different threads, but only one thread may read and one may write.
+     */
+    class ShmChannel {
+    public:
+        /**
+         * the default capacity of each direction
+         */
+        static size_t const kDefaultCapacity = 1 << 20;
+
+        /**
+         * the number of file descriptors describing a channel, to be passed to the peer process
+         */
+        static size_t const kFdCount = 5;
+
+        /**
+         * creates a new channel, the other end is opened with attach
+         * @param capacity the capacity of each direction in bytes, rounded up to a power of two
+         * @return the creating end of the channel
+         * @throws SocketException SOCKET_SOCKET if the shared memory or the eventfds could not be created
+         */
+        static std::unique_ptr<ShmChannel> create(size_t capacity = kDefaultCapacity);
+
+        /**
+         * creates a new channel with both ends in the calling process
+         * @see create
+         */
+        static std::array<std::unique_ptr<ShmChannel>, 2> createPair(size_t capacity = kDefaultCapacity);
+
+        /**
+         * opens the other end of a channel created (possibly by another process) with create
+         * @param fds the descriptors returned by getFdsForPeer, they are owned by the new end
+         * @return the end opposite to the creating one
+         * @throws SocketException SOCKET_SOCKET if the descriptors do not describe a channel (EPROTO if the memory
+         *         is not sealed against resizing), they are closed
+         */
+        static std::unique_ptr<ShmChannel> attach(const std::vector<int> &fds);
+
+        ShmChannel(ShmChannel const &) = delete;
+
+        /**
+         * closes this end, the peer reads the remaining data and then gets 0 (end of file),
+         * its writes fail with EPIPE
+         */
+        ~ShmChannel() noexcept;
+
+        /**
+         * @return the descriptors the peer needs to attach to this channel (kFdCount descriptors),
+         *         they remain owned by this end, e.g. pass them with Stream::sendFds
+         * @throws std::logic_error if called on an end opened by attach
+         */
+        std::vector<int> getFdsForPeer() const;
+
+        /**
+         * copies as much of the buffers into the outbound ring as fits, without blocking
+         * @return the number of bytes written, -1 with errno EAGAIN if the ring is full, EPIPE if the peer closed
+         * @throws SocketException SOCKET_WRITE with EPROTO if the peer corrupted the ring positions
+         */
+        ssize_t writev(const iovec *buffers, size_t buffer_count);
+
+        /**
+         * copies up to len bytes out of the inbound ring, without blocking
+         * @return the number of bytes read, 0 if the peer closed and everything was read,
+         *         -1 with errno EAGAIN if the ring is empty
+         * @throws SocketException SOCKET_READ with EPROTO if the peer corrupted the ring positions
+         */
+        ssize_t read(char *buffer, size_t len);
+
+        /**
+         * parks the reader until data is available, the peer closed, stop_fd became readable or wakeUpReader was
+         * called
+         * @param stop_fd an additional fd to wait on (e.g. of a CancellationDomain), -1 for none
+         * @param timeout_ms the maximum time to wait, -1 waits indefinitely
+         * @return false if the timeout expired
+         * @throws SocketException SOCKET_POLL on errors
+         */
+        bool waitUntilReadable(int stop_fd, int timeout_ms);
+
+        /**
+         * parks the writer until there is free space in the outbound ring or the peer closed
+         * @param timeout_ms the maximum time to wait, -1 waits indefinitely
+         * @return false if the timeout expired
+         * @throws SocketException SOCKET_POLL on errors
+         */
+        bool waitUntilWritable(int timeout_ms);
+
+        /**
+         * wakes up a parked reader of this end, without data, e.g. to let it notice a termination request
+         */
+        void wakeUpReader();
+
+        /**
+         * @return the capacity of each direction in bytes
+         */
+        size_t getCapacity() const;
+
+    private:
+        /**
+         * the state of one direction, head and tail are only ever increased, in separate cache lines
+         */
+        struct Ring {
+            alignas(64) std::atomic<uint64_t> head; // the position of the next byte to read
+            alignas(64) std::atomic<uint64_t> tail; // the position of the next byte to write
+            alignas(64) std::atomic<uint32_t> reader_parked;
+            std::atomic<uint32_t> writer_parked;
+            std::atomic<uint32_t> reader_closed;
+            std::atomic<uint32_t> writer_closed;
+        };
+
+        /**
+         * the beginning of the shared memory, followed by the data of both rings
+         */
+        struct SharedHeader {
+            uint64_t magic;
+            uint64_t capacity;
+            Ring rings[2];
+        };
+
+        // the indices of the doorbells of a ring in event_fds
+        enum DOORBELL {
+            DOORBELL_DATA,
+            DOORBELL_SPACE
+        };
+
+        ShmChannel(int memory_fd, std::array<int, 4> event_fds, int side);
+
+        void closeFds() noexcept;
+
+        static void ring(int event_fd);
+
+        /**
+         * waits on a doorbell while parked, the flag is set before the condition is checked a last time
+         * @param wakeup a flag ending the wait without the condition (set by wakeUpReader), nullptr for none
+         */
+        bool park(std::atomic<uint32_t> &parked, int doorbell_fd, int stop_fd, int timeout_ms,
+                  bool (ShmChannel::*ready)() const, std::atomic<bool> *wakeup);
+
+        bool isReadable() const;
+
+        bool isWritable() const;
+
+        int memory_fd;
+        std::array<int, 4> event_fds; // the data and space doorbell of ring 0, then of ring 1
+        int side; // this end writes to rings[side] and reads from rings[1 - side]
+        SharedHeader *header = nullptr;
+        size_t mapping_size = 0;
+        uint64_t capacity = 0;
+        char *outbound_data = nullptr;
+        char *inbound_data = nullptr;
+        Ring *outbound = nullptr;
+        Ring *inbound = nullptr;
+        std::atomic<bool> reader_wakeup_requested{false}; // set by wakeUpReader, local to this end
+
+        static uint64_t const kMagic = 0x736f636b73686d31; // "sockshm1"
+        static int const kRequiredSeals = F_SEAL_SHRINK | F_SEAL_GROW;
+    };
+}
+#endif //SOCKET_WRAPPER_SHMCHANNEL_H
@@ -27,7 +27,9 @@ namespace socket_wrapper {
             SOCKET_POLL,
             SOCKET_RECEIVE_BUFFER_TOO_SMALL,
             SOCKET_JOIN_MULTICAST,
-            SOCKET_SET_OPTION
+            SOCKET_SET_OPTION,
+            SOCKET_WRITE_TIMEOUT,
+            SOCKET_INVALID_FRAME
         };
 
         explicit SocketException(Type t, int c_error = -1, ssize_t processed_bytes = -1);
@@ -0,0 +1,125 @@
+#ifndef SOCKET_WRAPPER_STATS_H
+#define SOCKET_WRAPPER_STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace socket_wrapper {
+    /**
+     * @brief A histogram with logarithmic buckets (HDR style) for latencies in microseconds
+     * Every power of two is split into 8 linear sub buckets, so values are reported with a relative error
+     * below 12.5%. Recording a value takes three relaxed atomic additions (bucket, count and sum), plus a
+     * compare and swap loop while the value exceeds the maximum, no locks are taken.
+     */
+    class LatencyHistogram {
+    public:
+        static size_t const kSubBucketBits = 3;
+        static size_t const kBucketCount = (64 - kSubBucketBits + 1) << kSubBucketBits;
+
+        struct Snapshot {
+            std::array<uint64_t, kBucketCount> counts;
+            uint64_t count;
+            uint64_t sum;
+            uint64_t max;
+
+            /**
+             * @param percentile the percentile to compute, from 0 to 100
+             * @return the upper bound of the bucket containing the percentile, 0 if nothing was recorded
+             */
+            uint64_t getPercentile(double percentile) const;
+
+            /**
+             * @return the mean of all recorded values, 0 if nothing was recorded
+             */
+            double getMean() const;
+        };
+
+        void record(uint64_t value);
+
+        Snapshot snapshot() const;
+
+        static size_t bucketIndex(uint64_t value);
+
+        /**
+         * @return the largest value counted in the bucket
+         */
+        static uint64_t bucketUpperBound(size_t index);
+
+    private:
+        std::array<std::atomic<uint64_t>, kBucketCount> counts{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+    };
+
+    /**
+     * a consistent copy of the counters of a Stats block
+     */
+    struct StatsSnapshot {
+        uint64_t bytes_in;
+        uint64_t bytes_out;
+        uint64_t read_syscalls; // read, recv, recvmsg, splice from the socket and io_uring submissions
+        uint64_t write_syscalls; // write, writev, sendmsg, sendto, sendfile and splice to the socket
+        uint64_t poll_syscalls;
+        uint64_t accept_syscalls;
+        uint64_t partial_writes; // writes which did not accept all data offered
+        uint64_t empty_wakeups; // blocking reads woken up without data to read
+        uint64_t retry_sleeps; // writes waiting for the socket to become writable
+        uint64_t memmove_bytes; // bytes moved within read buffers
+        uint64_t condition_evaluations; // calls of ConditionalBufferedStream conditions
+        LatencyHistogram::Snapshot read_wait_us; // the time blocking reads waited for data
+        LatencyHistogram::Snapshot queue_residency_us; // the time segments spent queued until they were read
+
+        /**
+         * exports the counters in the Prometheus text format
+         * @param prefix prepended to every metric name, e.g. "gateway_upstream"
+         * @return one line per counter, and the count, sum and p50/p99/p999 of the histograms
+         */
+        std::string exportText(const std::string &prefix) const;
+    };
+
+    /**
+     * @brief Counters of the hot paths of Streams, BufferedStreams, ConditionalBufferedStreams, UdpDatagrams and
+     * Listeners. They are only maintained after enableStats was called, a disabled object only pays for a null check.
+     * A Stats block may be shared by several objects to aggregate them.
+     * Example:
+     * stream.enableStats();
+     * ...
+     * std::cout << stream.getStats().exportText("upstream");
+     */
+    class Stats {
+    public:
+        std::atomic<uint64_t> bytes_in{0};
+        std::atomic<uint64_t> bytes_out{0};
+        std::atomic<uint64_t> read_syscalls{0};
+        std::atomic<uint64_t> write_syscalls{0};
+        std::atomic<uint64_t> poll_syscalls{0};
+        std::atomic<uint64_t> accept_syscalls{0};
+        std::atomic<uint64_t> partial_writes{0};
+        std::atomic<uint64_t> empty_wakeups{0};
+        std::atomic<uint64_t> retry_sleeps{0};
+        std::atomic<uint64_t> memmove_bytes{0};
+        std::atomic<uint64_t> condition_evaluations{0};
+        LatencyHistogram read_wait_us;
+        LatencyHistogram queue_residency_us;
+
+        StatsSnapshot snapshot() const;
+
+        /**
+         * increments a counter, the counters do not order any other memory accesses
+         */
+        static void add(std::atomic<uint64_t> &counter, uint64_t value = 1) {
+            counter.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        /**
+         * @return the microseconds passed since start
+         */
+        static uint64_t elapsedUs(std::chrono::steady_clock::time_point start);
+    };
+}
+#endif //SOCKET_WRAPPER_STATS_H
@@ -3,10 +3,21 @@
 
 #include <cstddef>
 #include <mutex>
+#include <vector>
+#include <list>
+#include <chrono>
 #include "StreamFactory.h"
 #include "Listener.h"
 #include "BaseTypes.h"
+#include "StreamOptions.h"
+#include "CancellationDomain.h"
+#include "Stats.h"
+#include "Timestamping.h"
+#include "BusyPoller.h"
+#include "ShmChannel.h"
+#include "SocketException.h"
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 namespace socket_wrapper {
 /**
@@ -16,6 +27,9 @@ namespace socket_wrapper {
         friend StreamFactory;
         friend ListenerBase;
         friend Listener;
+        friend StreamRelay;
+        friend UdpDatagram; // shares remainingMs
+        friend BufferedStream; // flushes without SIGPIPE on destruction, shares remainingMs
     public:
         /**
          * a Stream should not be created without an underlying socket
@@ -59,26 +73,243 @@ namespace socket_wrapper {
          */
         size_t read(char *buffer, size_t max_bytes_to_read, size_t min_bytes_to_read, int timeout_ms = -1);
 
+        /**
+         * Reads the data currently available on the socket, without waiting (e.g. from a Reactor callback)
+         * @param buffer the buffer to read the data into
+         * @param max_bytes_to_read the maximum number of bytes to read (has to be <= buffer size)
+         * @return the number of bytes read, 0 if there is no data available
+         * @throws SocketException in case of read errors or if the stream was closed
+         */
+        size_t tryRead(char *buffer, size_t max_bytes_to_read);
+
+        /**
+         * Waits until data is available, without reading it (e.g. to only take a buffer once it is needed)
+         * @param timeout_ms the maximum time to wait, -1 waits indefinitely
+         * @throws SocketException SOCKET_READ_TIMEOUT if the timeout expired, SOCKET_TERMINATION_REQUEST if
+         *                         stopReads was called, SOCKET_POLL on errors. A closed stream counts as readable.
+         */
+        void waitUntilReadable(int timeout_ms = -1);
+
+        /**
+         * @return true if read waits for data itself without poll (busy polling, io_uring), waiting with
+         *         waitUntilReadable first would bypass that
+         */
+        bool waitsInRead();
 
         /**
          * A function to write raw data to a stream
          * @param buffer a pointer to the buffer to write to the socket
          * @param size the length of the buffer to write
-         * @param attempts the number of attempt to write the buffer to the Stream
+         * @param attempts the number of attempt to write the buffer to the Stream, between attempts
+         *                 the socket is waited on to become writable for up to kSocketRetryIntervallMs
          */
         void write(char const *buffer, size_t size, int attempts);
 
+        /**
+         * Writes the whole buffer to the stream, waiting for the socket to become writable until the deadline
+         * @param buffer a pointer to the buffer to write to the socket
+         * @param size the length of the buffer to write
+         * @param timeout_ms the maximum time to wait for the data to be written, -1 waits indefinitely
+         * @throws SocketException SOCKET_WRITE_TIMEOUT (with processed_bytes set) if the deadline passed
+         */
+        void writeBlocking(char const *buffer, size_t size, int timeout_ms = -1);
+
+        /**
+         * Writes as much of the buffer as the socket accepts without waiting
+         * @param buffer a pointer to the buffer to write to the socket
+         * @param size the length of the buffer to write
+         * @return the number of bytes written, 0 if the socket is not writable
+         * @throws SocketException in case of write errors
+         */
+        size_t tryWrite(char const *buffer, size_t size);
+
+        /**
+         * Writes several buffers to the stream with as few syscalls as possible (scatter/gather),
+         * partial writes are continued at the correct position, even across buffer boundaries
+         * @param buffers the buffers to write, in order
+         * @param buffer_count the number of buffers
+         * @param attempts the number of attempt to write the buffers to the Stream
+         * @return the number of bytes written
+         * @throws SocketException SOCKET_WRITE_PARTIAL (with processed_bytes set) if not everything could be written
+         */
+        size_t writev(const iovec *buffers, size_t buffer_count, int attempts);
+
+        /**
+         * Writes several buffers to the stream with as few syscalls as possible (scatter/gather)
+         * @param buffers the buffers to write, in order
+         * @param attempts the number of attempt to write the buffers to the Stream
+         * @return the number of bytes written
+         */
+        size_t writev(const std::vector<iovec> &buffers, int attempts);
+
+        /**
+         * Sends the content of a file to the stream without copying it to userspace (sendfile(2), falling back to
+         * splice(2) through a pipe if the file does not support sendfile), partial transfers are resumed
+         * @param fd the file descriptor to read from
+         * @param offset the position in the file to start at, -1 uses (and advances) the current file position
+         * @param len the number of bytes to send
+         * @param timeout_ms the maximum time to wait for the data to be sent, -1 waits indefinitely
+         * @return the number of bytes sent, less than len only if the end of the file was reached
+         * @throws SocketException SOCKET_WRITE_TIMEOUT (with processed_bytes set) if the deadline passed
+         */
+        size_t sendFile(int fd, off_t offset, size_t len, int timeout_ms = -1);
+
+        /**
+         * Passes file descriptors (e.g. accepted Streams, files, memfds) to the peer process, only supported by
+         * Unix domain sockets (StreamFactory::CreateUnixStream, StreamFactory::CreatePipe). The descriptors are
+         * duplicated into the peer, the caller still owns (and should close) its own copies.
+         * @param fds the file descriptors to pass, at most kMaxFdsPerMessage
+         * @param buffer data sent along with the descriptors, the descriptors arrive with its first byte.
+         *               If empty, a single zero byte is sent, which recvFds(timeout_ms) discards.
+         * @param size the length of the data
+         * @param timeout_ms the maximum time to wait for the data to be sent, -1 waits indefinitely
+         * @throws SocketException SOCKET_WRITE on errors (EINVAL if there are too many fds),
+         *                         SOCKET_WRITE_TIMEOUT (with processed_bytes set) if the deadline passed
+         */
+        void sendFds(const std::vector<int> &fds, char const *buffer = nullptr, size_t size = 0,
+                     int timeout_ms = -1);
+
+        /**
+         * Receives data and the file descriptors passed along with it by sendFds
+         * The read ends in front of the next passed descriptors, so descriptors of two sendFds calls are never
+         * mixed up. The received descriptors are owned by the caller, they have FD_CLOEXEC set.
+         * @param buffer the buffer to read the data into
+         * @param max_bytes_to_read the maximum number of bytes to read (has to be <= buffer size, and > 0)
+         * @param read_bytes set to the number of bytes read
+         * @param timeout_ms the maximum time to wait for data, -1 waits indefinitely
+         * @return the file descriptors received, empty if the data was sent without any
+         * @throws SocketException in case of read errors, if the stream was closed or stopReads was called,
+         *                         SOCKET_RECEIVE_BUFFER_TOO_SMALL if descriptors were dropped
+         */
+        std::vector<int> recvFds(char *buffer, size_t max_bytes_to_read, size_t &read_bytes, int timeout_ms = -1);
+
+        /**
+         * Receives the file descriptors of a sendFds call without data
+         * @see recvFds
+         */
+        std::vector<int> recvFds(int timeout_ms = -1);
+
+        /**
+         * the maximum number of file descriptors passed by a single sendFds call (SCM_MAX_FD of the kernel)
+         */
+        static size_t const kMaxFdsPerMessage = 253;
+
+        /**
+         * Enables the outbound queue of this Stream, data passed to enqueue is sent when the socket becomes writable
+         * All writes should go through enqueue afterwards, to not reorder data.
+         * @param high_watermark the maximum number of bytes the queue holds
+         */
+        void enableSendQueue(size_t high_watermark);
+
+        /**
+         * Sends data without blocking, everything the socket does not accept right away is queued
+         * @param buffer a pointer to the data to send
+         * @param size the length of the data
+         * @return false if nothing could be sent right away and the data would exceed the high watermark, in this case
+         *         nothing was sent or queued
+         * @throws SocketException SOCKET_WRITE_PARTIAL with ENOBUFS if the data was partially sent and the rest would
+         *         exceed the high watermark, nothing was queued then and processed_bytes is the number of bytes sent
+         * @throws SocketException in case of write errors
+         * @throws std::logic_error if enableSendQueue was not called
+         */
+        bool enqueue(char const *buffer, size_t size);
+
+        /**
+         * Writes as much of the queued data as the socket accepts, should be called once the socket is writable
+         * (e.g. from a Reactor on_writable callback)
+         * @return the number of bytes still queued
+         * @throws SocketException in case of write errors
+         */
+        size_t flushSendQueue();
+
+        /**
+         * @return the number of bytes waiting in the outbound queue
+         */
+        size_t getSendQueueSize();
+
 
         /**
-         * aborts all currently running reads on the Stream
+         * aborts all currently running and future reads on the Stream, other Streams of its domain are not affected
+         * The connection is left as it is, blocked reads are woken up through the eventfd of the domain. Waits on
+         * getFdForPoll outside of the Stream (e.g. a Reactor) are not woken up.
          */
         void stopReads();
+
+        /**
+         * makes read spin on the socket for up to max_spin_us before blocking in poll, trading CPU time for the
+         * latency of a wakeup. The spin time is not deducted from the read timeout. SO_BUSY_POLL is set to the same
+         * value where the kernel permits it.
+         * @param max_spin_us the maximum time to spin per read
+         * @param adaptive true to adapt the spin time to the inter-arrival time of the data
+         */
+        void enableBusyPolling(int max_spin_us = BusyPoller::kDefaultMaxSpinUs, bool adaptive = true);
+
+        /**
+         * reads block in poll right away again
+         */
+        void disableBusyPolling();
+
+        /**
+         * enables kernel transmit timestamps (SO_TIMESTAMPING), written data is timestamped when it is passed to
+         * the network device and when the peer acknowledged it, should be called before writing
+         * @throws SocketException SOCKET_SET_OPTION if timestamping is not supported
+         */
+        void enableTimestamps();
+
+        /**
+         * reads the transmit timestamps queued since the last call, without blocking.
+         * The time from TX_TIMESTAMP_SENT to TX_TIMESTAMP_ACKNOWLEDGED of a byte_offset is the time the network
+         * and the peer's kernel took.
+         * @return the timestamps, in the order the kernel queued them
+         */
+        std::vector<TxTimestamp> readTxTimestamps();
+
+        /**
+         * starts counting syscalls, bytes and read wait times, should be called before the Stream is used
+         * @param shared_stats the block to count in, may be shared with other objects to aggregate them
+         */
+        void enableStats(std::shared_ptr<Stats> shared_stats = std::make_shared<Stats>());
+
+        /**
+         * @return the counters, all zero if enableStats was not called
+         */
+        StatsSnapshot getStats();
+
+        /**
+         * moves the Stream into a different CancellationDomain, waits for running reads to finish
+         * @param domain the domain whose cancelAll aborts reads on this Stream
+         */
+        void setCancellationDomain(std::shared_ptr<CancellationDomain> domain);
+
+        /**
+         * @return the domain of the Stream, the default domain unless one was set
+         */
+        std::shared_ptr<CancellationDomain> getCancellationDomain();
+
+        /**
+         * sets socket options on the underlying socket, options left at kUnset are not changed
+         * @param options the options to set
+         * @throws SocketException SOCKET_SET_OPTION if an option could not be set
+         */
+        void setOptions(const StreamOptions &options);
+
+        /**
+         * @return the effective socket options, after the kernel clamped them
+         */
+        StreamOptions getOptions();
+
+        /**
+         * @return the underlying file descriptor, to be used with poll/epoll (e.g. by a Reactor),
+         *         -1 for Streams through shared memory (StreamFactory::CreateShmPipe), which can not be polled
+         */
+        int getFdForPoll();
     private:
         /**
         * creates a Stream object managing the file descriptor, should only be called by StreamFactory
         * @param socket_fd
         */
-        explicit Stream(int socket_fd);
+        explicit Stream(int socket_fd,
+                        std::shared_ptr<CancellationDomain> domain = CancellationDomain::getDefault());
         struct sockaddr destination_addr; // the sockaddr this Stream is connected to
         int stream_file_descriptor;
 
@@ -86,7 +317,65 @@ namespace socket_wrapper {
         std::mutex stream_file_descriptor_read_mtx;
         static int const kInvalidSocketFdMarker = -1;
         static int64_t const kSocketRetryIntervallMs = 50;
-        std::atomic<int> stop_all_operations_event_fd;
+        // the outbound queue, guarded by stream_file_descriptor_write_mtx
+        std::list<std::vector<char>> send_queue;
+        size_t send_queue_front_offset = 0; // bytes of the first element already sent
+        size_t send_queue_size = 0;
+        size_t send_queue_high_watermark = 0;
+        bool send_queue_enabled = false;
+
+        /**
+         * waits for the socket to become writable
+         * @return false if the timeout expired
+         */
+        bool waitUntilWritable(int timeout_ms);
+
+        /**
+         * writes without blocking, stream_file_descriptor_write_mtx has to be held
+         * @param fds file descriptors to pass along with the data, nullptr for none
+         * @return the number of bytes written, 0 if the socket is not writable
+         */
+        size_t sendNonBlocking(const iovec *buffers, size_t buffer_count, const std::vector<int> *fds = nullptr);
+
+        /**
+         * the splice(2) based fallback of sendFile, stream_file_descriptor_write_mtx has to be held
+         */
+        size_t spliceFile(int fd, off_t *offset, size_t len, int timeout_ms,
+                          std::chrono::steady_clock::time_point deadline);
+
+        /**
+         * @return the milliseconds left until the deadline, -1 if timeout_ms is -1
+         * @throws SocketException timeout_type (SOCKET_WRITE_TIMEOUT by default) if the deadline passed
+         */
+        static int remainingMs(int timeout_ms, std::chrono::steady_clock::time_point deadline,
+                               size_t processed_bytes,
+                               SocketException::Type timeout_type = SocketException::SOCKET_WRITE_TIMEOUT);
+        /**
+         * @return true if stopReads was called or the domain was cancelled
+         */
+        bool isTerminationRequested();
+        std::shared_ptr<CancellationDomain> cancellation_domain;
+        StopRequest stop_request; // set by stopReads
+        std::shared_ptr<Stats> stats; // nullptr unless enableStats was called
+        std::atomic<bool> timestamps_enabled{false};
+        // nullptr unless enableBusyPolling was called, guarded by the read mutex, reads use a copy
+        std::shared_ptr<BusyPoller> busy_poller;
+        std::unique_ptr<ShmChannel> shm_channel; // replaces the socket of Streams through shared memory
+        // transmit timestamps read from the error queue while waiting for data
+        std::vector<TxTimestamp> tx_timestamps;
+        std::mutex tx_timestamps_mtx;
+
+        /**
+         * the read of Streams through shared memory
+         * @see read
+         */
+        size_t readShm(char *buffer, size_t max_bytes_to_read, size_t min_bytes_to_read, int timeout_ms);
+
+        /**
+         * moves the transmit timestamps from the error queue to tx_timestamps
+         * @return the number of timestamps moved
+         */
+        size_t collectTxTimestamps();
     };
 }
 
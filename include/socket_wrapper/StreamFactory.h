@@ -1,9 +1,13 @@
 #ifndef EZNETWORK_STREAMFACTORY_H
 #define EZNETWORK_STREAMFACTORY_H
 #include <array>
+#include <vector>
+#include <string>
 
 #include "Stream.h"
 #include "BaseTypes.h"
+#include "StreamOptions.h"
+#include "ShmChannel.h"
 
 namespace socket_wrapper {
     class Stream;
@@ -17,11 +21,79 @@ namespace socket_wrapper {
          * @param ip_address the ip address of the server to connect to
          * @param port the port to connect to
          * @param version the version of ip to use
+         * @param options socket options, set before connecting
+         * @param timeout_ms the maximum time to wait for the connection to be established, -1 waits indefinitely
          * @return a Stream connected to the server specified
+         * @throws SocketException SOCKET_CONNECT on errors, c_error is ETIMEDOUT if the timeout expired
          */
-        static socket_wrapper::Stream CreateTcpStreamToServer(std::string ip_address, uint16_t port, IP_VERSION version = IPv4);
+        static socket_wrapper::Stream CreateTcpStreamToServer(std::string ip_address, uint16_t port,
+                                                              IP_VERSION version = IPv4,
+                                                              const StreamOptions &options = StreamOptions(),
+                                                              int timeout_ms = -1);
+
+        /**
+         * Creates a Tcp Stream to the first of several candidate addresses (IPv4 and IPv6 may be mixed) that accepts
+         * the connection. Connection attempts are started in the given order, every stagger_ms (or as soon as
+         * the previous attempt failed) another attempt is started, while the earlier ones keep running.
+         * @param candidates the addresses to try, in order of preference
+         * @param timeout_ms the maximum time to wait for any connection to be established, -1 waits indefinitely
+         * @param stagger_ms the delay between starting two connection attempts
+         * @param options socket options, set before connecting
+         * @return a Stream connected to the first candidate which accepted the connection
+         * @throws SocketException SOCKET_CONNECT if no candidate could be connected to
+         */
+        static socket_wrapper::Stream CreateTcpStreamToAnyServer(const std::vector<Endpoint> &candidates,
+                                                                 int timeout_ms = -1,
+                                                                 int stagger_ms = kDefaultConnectStaggerMs,
+                                                                 const StreamOptions &options = StreamOptions());
+
+        /**
+         * Creates a Stream to a Listener on a Unix domain socket of the same host, bypassing the TCP stack
+         * @param path the path the Listener was created with, a leading '@' denotes the abstract namespace
+         * @param options socket options, set before connecting, TCP options do not apply to Unix sockets
+         * @param timeout_ms the maximum time to wait while the Listener's backlog is full, -1 waits indefinitely
+         * @return a Stream connected to the Listener, it supports Stream::sendFds and Stream::recvFds
+         * @throws SocketException SOCKET_CONNECT on errors, c_error is ETIMEDOUT if the timeout expired
+         */
+        static socket_wrapper::Stream CreateUnixStream(const std::string &path,
+                                                       const StreamOptions &options = StreamOptions(),
+                                                       int timeout_ms = -1);
 
         static std::array<Stream, 2> CreatePipe();
+
+        /**
+         * Creates two connected Streams through shared memory, for threads of the same process.
+         * Data is copied through a ring buffer per direction, the steady path makes no syscalls.
+         * The Streams support read, write, writev and the send queue, they can be wrapped by a BufferedStream.
+         * They can not be polled and do not support sendFile, sendFds or socket options.
+         * @param capacity the capacity of each direction in bytes
+         * @see ShmChannel
+         * @throws SocketException SOCKET_SOCKET if the shared memory could not be created
+         */
+        static std::array<Stream, 2> CreateShmPipe(size_t capacity = ShmChannel::kDefaultCapacity);
+
+        /**
+         * Creates a Stream through shared memory to another process on the same host, the peer calls
+         * CreateShmStreamFromPeer on the other end of unix_stream
+         * @param unix_stream a Unix domain socket Stream to the peer, used to pass the shared memory and doorbells
+         * @param capacity the capacity of each direction in bytes
+         * @return the Stream through shared memory, unix_stream may be closed afterwards
+         * @throws SocketException SOCKET_SOCKET if the shared memory could not be created,
+         *                         errors of Stream::sendFds otherwise
+         * @see CreateShmPipe
+         */
+        static socket_wrapper::Stream CreateShmStreamToPeer(Stream &unix_stream,
+                                                            size_t capacity = ShmChannel::kDefaultCapacity);
+
+        /**
+         * Accepts a Stream through shared memory offered by CreateShmStreamToPeer
+         * @param unix_stream the Unix domain socket Stream the peer passes the shared memory through
+         * @param timeout_ms the maximum time to wait for the peer, -1 waits indefinitely
+         * @throws SocketException SOCKET_SOCKET if the peer did not pass a channel, errors of Stream::recvFds otherwise
+         */
+        static socket_wrapper::Stream CreateShmStreamFromPeer(Stream &unix_stream, int timeout_ms = -1);
+
+        static int const kDefaultConnectStaggerMs = 250;
     };
 }
 #endif //EZNETWORK_STREAMFACTORY_H
@@ -0,0 +1,43 @@
+#ifndef SOCKET_WRAPPER_STREAMOPTIONS_H
+#define SOCKET_WRAPPER_STREAMOPTIONS_H
+
+namespace socket_wrapper {
+    /**
+     * Socket options applied to Streams, Listeners and UdpDatagrams, options left at kUnset keep the kernel default.
+     * When read back (e.g. Stream::getOptions) the struct holds the effective values, after the kernel clamped them,
+     * options that do not apply to the socket type are reported as kUnset.
+     * Example:
+     * StreamOptions options;
+     * options.tcp_nodelay = 1;
+     * auto stream = StreamFactory::CreateTcpStreamToServer("127.0.0.1", 8000, IPv4, options);
+     */
+    struct StreamOptions {
+        static int const kUnset = -1;
+        int tcp_nodelay = kUnset; // TCP_NODELAY, 1 disables Nagle's algorithm
+        int tcp_quickack = kUnset; // TCP_QUICKACK, 1 sends acks immediately (not permanent, the kernel may reset it)
+        int tcp_cork = kUnset; // TCP_CORK, 1 only sends full segments until uncorked
+        int send_buffer_size = kUnset; // SO_SNDBUF in bytes, the kernel doubles the value
+        int receive_buffer_size = kUnset; // SO_RCVBUF in bytes, the kernel doubles the value
+        int busy_poll_us = kUnset; // SO_BUSY_POLL, microseconds to busy poll the device queue on blocking reads
+        int priority = kUnset; // SO_PRIORITY, the queueing priority of outgoing packets
+        int tcp_notsent_lowat = kUnset; // TCP_NOTSENT_LOWAT, the limit of unsent bytes in the send buffer
+        int ip_tos = kUnset; // IP_TOS for IPv4, IPV6_TCLASS for IPv6
+    };
+
+    /**
+     * sets all options that are not kUnset on a socket
+     * @param fd the socket to configure
+     * @param options the options to set
+     * @throws SocketException SOCKET_SET_OPTION if an option could not be set
+     */
+    void applyStreamOptions(int fd, const StreamOptions &options);
+
+    /**
+     * reads the effective values of all options from a socket
+     * @param fd the socket to query
+     * @return the options, kUnset for options not applicable to the socket
+     */
+    StreamOptions getEffectiveStreamOptions(int fd);
+}
+
+#endif //SOCKET_WRAPPER_STREAMOPTIONS_H
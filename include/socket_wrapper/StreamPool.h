@@ -0,0 +1,129 @@
+#ifndef SOCKET_WRAPPER_STREAMPOOL_H
+#define SOCKET_WRAPPER_STREAMPOOL_H
+
+#include <map>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "Stream.h"
+#include "BaseTypes.h"
+#include "StreamOptions.h"
+
+namespace socket_wrapper {
+    /**
+     * @brief A pool of connected Tcp Streams, reusing idle connections to the same endpoint
+     * Example:
+     * StreamPool pool(2, 16);
+     * {
+     *     auto lease = pool.acquire({"127.0.0.1", 8000, IPv4});
+     *     lease->write("abc", 3, 1);
+     * } // the Stream is returned to the pool
+     */
+    class StreamPool {
+    public:
+        struct Stats {
+            uint64_t hits; // acquires served by an idle Stream
+            uint64_t misses; // acquires which had to connect
+            uint64_t waits; // acquires which had to wait for a free connection slot
+            uint64_t total_wait_us; // the time spent waiting for a free connection slot
+            uint64_t discarded; // Streams closed because they were dead or discarded
+        };
+
+        /**
+         * @brief exclusive access to a pooled Stream, the Stream is returned to the pool on destruction
+         */
+        class Lease {
+            friend StreamPool;
+        public:
+            Lease(Lease const &) = delete;
+
+            Lease(Lease &&src) noexcept;
+
+            /**
+             * returns the Stream to the pool, unless it was discarded
+             */
+            ~Lease() noexcept;
+
+            Stream &operator*();
+
+            Stream *operator->();
+
+            /**
+             * closes the Stream instead of returning it to the pool (e.g. after a protocol error)
+             */
+            void discard();
+
+        private:
+            Lease(StreamPool *pool, Endpoint endpoint, std::unique_ptr<Stream> stream);
+
+            StreamPool *pool;
+            Endpoint endpoint;
+            std::unique_ptr<Stream> stream;
+            bool discarded = false;
+        };
+
+        /**
+         * creates an empty pool, the pool has to outlive all Leases
+         * @param min_idle_per_endpoint the number of idle Streams prefill creates per endpoint
+         * @param max_connections_per_endpoint the maximum number of open (idle and leased) Streams per endpoint
+         * @param options socket options of the Streams created
+         * @param connect_timeout_ms the maximum time to wait for a connection, -1 waits indefinitely
+         */
+        explicit StreamPool(size_t min_idle_per_endpoint = 0, size_t max_connections_per_endpoint = 8,
+                            const StreamOptions &options = StreamOptions(), int connect_timeout_ms = -1);
+
+        StreamPool(StreamPool const &) = delete;
+
+        /**
+         * Hands out an idle Stream to the endpoint, or connects a new one. If max_connections_per_endpoint Streams
+         * are open, waits for one to be returned, waiters are served in the order they arrived.
+         * @param endpoint the endpoint to connect to
+         * @param timeout_ms the maximum time to wait for a free connection slot, -1 waits indefinitely
+         * @return a Lease giving exclusive access to the Stream
+         * @throws SocketException SOCKET_CONNECT on errors, c_error is ETIMEDOUT if the timeout expired
+         */
+        Lease acquire(const Endpoint &endpoint, int timeout_ms = -1);
+
+        /**
+         * connects idle Streams to the endpoint, until min_idle_per_endpoint are available
+         * @throws SocketException if connecting fails
+         */
+        void prefill(const Endpoint &endpoint);
+
+        /**
+         * @return the number of idle Streams to the endpoint
+         */
+        size_t getIdleCount(const Endpoint &endpoint);
+
+        Stats getStats();
+
+    private:
+        struct endpoint_pool {
+            std::list<std::unique_ptr<Stream>> idle;
+            size_t open_connections = 0; // idle, leased and currently connecting Streams
+            std::list<uint64_t> waiters; // tickets of the waiting acquires, in arrival order
+        };
+        size_t min_idle_per_endpoint;
+        size_t max_connections_per_endpoint;
+        StreamOptions options;
+        int connect_timeout_ms;
+        std::map<Endpoint, endpoint_pool> pools;
+        std::mutex pools_mtx;
+        std::condition_variable pools_cv;
+        uint64_t next_ticket = 0;
+        Stats stats{};
+
+        void release(const Endpoint &endpoint, std::unique_ptr<Stream> stream, bool discarded);
+
+        std::unique_ptr<Stream> connect(const Endpoint &endpoint);
+
+        /**
+         * a cheap check, whether the peer closed an idle Stream or the Stream has unexpected data pending
+         */
+        static bool isIdleStreamAlive(Stream &stream);
+    };
+}
+#endif //SOCKET_WRAPPER_STREAMPOOL_H
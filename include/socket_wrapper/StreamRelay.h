@@ -0,0 +1,87 @@
+#ifndef SOCKET_WRAPPER_STREAMRELAY_H
+#define SOCKET_WRAPPER_STREAMRELAY_H
+
+#include <atomic>
+#include <cstdint>
+#include <array>
+
+#include "Stream.h"
+#include "BaseTypes.h"
+
+namespace socket_wrapper {
+    /**
+     * @brief Forwards the data of two Streams to each other, without copying it to user space
+     * Both directions are moved with splice(2) through a kernel pipe. If one side closes its sending direction,
+     * the relay shuts down the sending direction of the other side, after forwarding the remaining data.
+     * Example:
+     * StreamRelay relay(listener.accept(), StreamFactory::CreateTcpStreamToServer("10.0.0.2", 80));
+     * relay.run(); // returns once both directions are closed
+     */
+    class StreamRelay {
+    public:
+        StreamRelay() = delete;
+
+        /**
+         * creates the pipes, the relay does not start before run is called
+         * @param first one of the Streams to connect
+         * @param second the other Stream to connect
+         * @param idle_timeout_ms run fails, if no data was forwarded for this long, -1 for no timeout
+         * @throws SocketException SOCKET_SOCKET if the pipes could not be created
+         */
+        StreamRelay(Stream first, Stream second, int idle_timeout_ms = -1);
+
+        StreamRelay(StreamRelay const &) = delete;
+
+        /**
+         * closes the pipes and both Streams
+         */
+        ~StreamRelay() noexcept;
+
+        /**
+         * forwards data in both directions, until both directions are closed
+         * @throws SocketException SOCKET_READ_TIMEOUT if the relay was idle for longer than idle_timeout_ms,
+         * SOCKET_TERMINATION_REQUEST if stop was called, or on read/write errors
+         */
+        void run();
+
+        /**
+         * aborts run, it can be called from any thread
+         */
+        void stop();
+
+        /**
+         * @return the number of bytes forwarded from the first to the second Stream
+         */
+        uint64_t getBytesFirstToSecond() const;
+
+        /**
+         * @return the number of bytes forwarded from the second to the first Stream
+         */
+        uint64_t getBytesSecondToFirst() const;
+
+    private:
+        struct direction {
+            Stream *source;
+            Stream *destination;
+            std::array<int, 2> pipe_fds;
+            size_t pipe_capacity;
+            size_t bytes_in_pipe = 0;
+            bool source_closed = false;
+            bool destination_shut_down = false;
+            std::atomic<uint64_t> forwarded_bytes{0};
+        };
+        Stream first;
+        Stream second;
+        int idle_timeout_ms;
+        std::array<direction, 2> directions;
+        // the size of the pipes, the kernel default (64KiB) limits every splice to 16 pages
+        static int const kPipeSize = 1 << 20;
+
+        /**
+         * moves as much data as possible without blocking
+         * @return true if any data was moved, or the direction was closed
+         */
+        static bool pump(direction &d);
+    };
+}
+#endif //SOCKET_WRAPPER_STREAMRELAY_H
@@ -0,0 +1,60 @@
+#ifndef SOCKET_WRAPPER_TIMESTAMPING_H
+#define SOCKET_WRAPPER_TIMESTAMPING_H
+
+#include <cstdint>
+#include <vector>
+#include <sys/socket.h>
+
+namespace socket_wrapper {
+    /**
+     * the point in the transmit path a TxTimestamp was taken at
+     */
+    enum TX_TIMESTAMP_TYPE {
+        TX_TIMESTAMP_SCHEDULED, // the data entered the queueing discipline
+        TX_TIMESTAMP_SENT, // the data was passed to the network device
+        TX_TIMESTAMP_ACKNOWLEDGED // all data up to byte_offset was acknowledged by the peer (TCP only)
+    };
+
+    /**
+     * a kernel transmit timestamp, read from the error queue of a socket
+     */
+    struct TxTimestamp {
+        /**
+         * TCP: the offset of the last byte of the write the timestamp belongs to, counted from enableTimestamps
+         * UDP: the number of datagrams sent before the datagram the timestamp belongs to
+         */
+        uint32_t byte_offset;
+        TX_TIMESTAMP_TYPE type;
+        int64_t kernel_time_ns; // CLOCK_REALTIME
+    };
+
+    /**
+     * enables software timestamps of received data (SO_TIMESTAMPING, falling back to SO_TIMESTAMPNS) and
+     * optionally of transmitted data
+     * @param fd the socket
+     * @param transmit true to also queue transmit timestamps on the error queue
+     * @throws SocketException SOCKET_SET_OPTION if the kernel does not support timestamping
+     */
+    void enableKernelTimestamps(int fd, bool transmit);
+
+    /**
+     * @param msg a message received with a control buffer
+     * @return the time the kernel received the message (CLOCK_REALTIME), -1 if it carries no timestamp
+     */
+    int64_t getReceiveTimestampNs(const msghdr &msg);
+
+    /**
+     * reads all transmit timestamps queued on the error queue, without blocking
+     * @param fd the socket
+     * @param timestamps the timestamps read are appended to it
+     * @return the number of timestamps read
+     * @throws SocketException SOCKET_READ on errors
+     */
+    size_t readTxTimestamps(int fd, std::vector<TxTimestamp> &timestamps);
+
+    /**
+     * @return the current CLOCK_REALTIME in nanoseconds, the clock kernel timestamps are taken with
+     */
+    int64_t getRealtimeNs();
+}
+#endif //SOCKET_WRAPPER_TIMESTAMPING_H
@@ -3,25 +3,87 @@
 #include <vector>
 #include <mutex>
 #include <atomic>
+#include <array>
 #include <sys/socket.h>
 
 #include "socket_wrapper/BaseTypes.h"
 #include "socket_wrapper/SocketException.h"
+#include "socket_wrapper/StreamOptions.h"
+#include "socket_wrapper/CancellationDomain.h"
+#include "socket_wrapper/Stats.h"
+#include "socket_wrapper/Timestamping.h"
+#include "socket_wrapper/BusyPoller.h"
 #include "socket_wrapper/BaseTypes.h"
 
 namespace socket_wrapper {
+    /**
+     * a datagram together with the time the kernel received it
+     */
+    struct TimestampedDatagram {
+        std::vector<char> data;
+        // CLOCK_REALTIME, -1 if enableTimestamps was not called or the kernel did not timestamp the datagram
+        // (the kernel switches receive timestamping on asynchronously, datagrams arriving right after the first
+        // socket of the host enabled it may be missed)
+        int64_t kernel_receive_ns;
+    };
 /**
  * @brief A wrapper class for Multicast Udp Datagrams
  */
     class UdpDatagram {
     public:
         UdpDatagram() = delete;
-        UdpDatagram(const std::string &listener_ip_addr, uint16_t listener_port, IP_VERSION version, int buffer_size = 65536);
+        UdpDatagram(const std::string &listener_ip_addr, uint16_t listener_port, IP_VERSION version, int buffer_size = 65536,
+                    const StreamOptions &options = StreamOptions());
         void subscribeToMulticast(const std::string& group_addr);
         std::vector<char> read(int timeout_ms = -1);
+        /**
+         * reads a datagram together with its kernel receive timestamp, the time it waited in the socket queue
+         * is getRealtimeNs() - kernel_receive_ns
+         * @see read
+         */
+        TimestampedDatagram readTimestamped(int timeout_ms = -1);
         void write(const std::vector<char> &msg_data, const std::string &destination_ip, int port);
 
+        /**
+         * aborts all currently running and future reads, other sockets of the domain are not affected
+         */
         void stopReads();
+        /**
+         * @param domain the domain whose cancelAll aborts reads on this UdpDatagram, should be set before reading
+         */
+        void setCancellationDomain(std::shared_ptr<CancellationDomain> domain);
+        /**
+         * makes read spin on the socket before blocking, may be called while reading
+         * @see Stream::enableBusyPolling
+         */
+        void enableBusyPolling(int max_spin_us = BusyPoller::kDefaultMaxSpinUs, bool adaptive = true);
+        /**
+         * reads block in poll right away again, a running read finishes its spin
+         */
+        void disableBusyPolling();
+        /**
+         * enables kernel receive and transmit timestamps (SO_TIMESTAMPING), should be called before reading
+         * @throws SocketException SOCKET_SET_OPTION if timestamping is not supported
+         */
+        void enableTimestamps();
+        /**
+         * @return the transmit timestamps of the datagrams written since the last call, without blocking
+         */
+        std::vector<TxTimestamp> readTxTimestamps();
+        /**
+         * starts counting syscalls, bytes and read wait times, should be called before the UdpDatagram is used
+         * @param shared_stats the block to count in, may be shared with other objects to aggregate them
+         */
+        void enableStats(std::shared_ptr<Stats> shared_stats = std::make_shared<Stats>());
+        /**
+         * @return the counters, all zero if enableStats was not called
+         */
+        StatsSnapshot getStats();
+        int getFdForPoll();
+        /**
+         * @return the effective socket options, after the kernel clamped them
+         */
+        StreamOptions getOptions();
         // moving is allowed
         UdpDatagram &operator=(UdpDatagram &&stream_to_assign) noexcept ;
         UdpDatagram(UdpDatagram const &) = delete;
@@ -31,11 +93,24 @@ namespace socket_wrapper {
         std::vector<char> buffer;
         std::atomic<int> socket_fd;
         IP_VERSION ip_version;
-        std::atomic<int> stop_all_operations_event_fd{};
+        std::shared_ptr<CancellationDomain> cancellation_domain = CancellationDomain::getDefault();
+        StopRequest stop_request; // set by stopReads
+        std::shared_ptr<Stats> stats; // nullptr unless enableStats was called
+        std::atomic<bool> timestamps_enabled{false};
+        // nullptr unless enableBusyPolling was called, guarded by busy_poller_mtx, reads use a copy
+        std::shared_ptr<BusyPoller> busy_poller;
+        std::mutex busy_poller_mtx;
+        std::array<char, 512> control_buffer;
+        // transmit timestamps read from the error queue while waiting for datagrams
+        std::vector<TxTimestamp> tx_timestamps;
+        std::mutex tx_timestamps_mtx;
+        size_t receive(msghdr &msg, int timeout_ms);
+        size_t collectTxTimestamps();
         std::recursive_mutex socket_mutex;
         msghdr &setMsghdrParams(msghdr &msg, iovec &iov);
         static int const kInvalidSocketFdMarker = -1;
         void assertRecvmsgSucceded(const msghdr &msg, ssize_t read_result) const;
+        bool isTerminationRequested();
     };
 }
 #endif //SOCKET_WRAPPER_UDPDATAGRAM_H
\ No newline at end of file
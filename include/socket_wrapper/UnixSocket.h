@@ -0,0 +1,27 @@
+#ifndef SOCKET_WRAPPER_UNIXSOCKET_H
+#define SOCKET_WRAPPER_UNIXSOCKET_H
+
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "SocketException.h"
+
+namespace socket_wrapper {
+    /**
+     * fills a sockaddr_un for a Unix domain socket path, used by the Unix Listener and StreamFactory::CreateUnixStream
+     * @param path a filesystem path, or a name in the abstract namespace if it starts with '@'
+     *             (e.g. "@my_service", which never appears in the filesystem and vanishes with the last socket)
+     * @param address the address to fill
+     * @param error_type the type of the exception thrown if the path does not fit
+     * @return the length of the address, to be passed to bind/connect
+     * @throws SocketException error_type with ENAMETOOLONG if the path is too long, EINVAL if it is empty
+     */
+    socklen_t toUnixAddress(const std::string &path, sockaddr_un &address, SocketException::Type error_type);
+
+    /**
+     * @return true if path names a socket in the abstract namespace
+     */
+    bool isAbstractUnixPath(const std::string &path);
+}
+#endif //SOCKET_WRAPPER_UNIXSOCKET_H
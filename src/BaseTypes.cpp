@@ -1,4 +1,5 @@
 #include <stdexcept>
+#include <tuple>
 #include "socket_wrapper/BaseTypes.h"
 
 std::map<socket_wrapper::IP_VERSION, std::string> socket_wrapper::getName = {
@@ -15,3 +16,7 @@ socket_wrapper::IP_VERSION socket_wrapper::IpVersionfromString(std::string v) {
         throw std::invalid_argument("only supported ip versions are IPv6 and IPv4, not [" + v + "]");
     }
 }
+
+bool socket_wrapper::operator<(const Endpoint &a, const Endpoint &b) {
+    return std::tie(a.ip_address, a.port, a.version) < std::tie(b.ip_address, b.port, b.version);
+}
@@ -0,0 +1,54 @@
+#include <unistd.h>
+#include "socket_wrapper/BufferPool.h"
+
+namespace socket_wrapper {
+    BufferPool::BufferPool(size_t max_cached_bytes) : max_cached_bytes(max_cached_bytes) {}
+
+    std::unique_ptr<RingBuffer> BufferPool::acquire(size_t min_capacity) {
+        size_t size_class = getSizeClass(min_capacity);
+        {
+            std::lock_guard<std::mutex> lk(pool_mtx);
+            auto &buffers = cached_buffers[size_class];
+            if (!buffers.empty()) {
+                auto buffer = std::move(buffers.back());
+                buffers.pop_back();
+                cached_bytes -= size_class;
+                return buffer;
+            }
+        }
+        // mapping a new buffer does not need the lock
+        return std::unique_ptr<RingBuffer>(new RingBuffer(size_class));
+    }
+
+    void BufferPool::release(std::unique_ptr<RingBuffer> buffer) {
+        buffer->consume(buffer->size());
+        size_t size_class = buffer->capacity();
+        {
+            std::lock_guard<std::mutex> lk(pool_mtx);
+            if (cached_bytes + size_class <= max_cached_bytes) {
+                cached_buffers[size_class].push_back(std::move(buffer));
+                cached_bytes += size_class;
+                return;
+            }
+        }
+        // the pool is full, the buffer is unmapped outside of the lock
+    }
+
+    size_t BufferPool::getCachedBytes() {
+        std::lock_guard<std::mutex> lk(pool_mtx);
+        return cached_bytes;
+    }
+
+    size_t BufferPool::getSizeClass(size_t min_capacity) {
+        size_t size_class = (size_t) sysconf(_SC_PAGESIZE);
+        while (size_class < min_capacity) {
+            size_class <<= 1;
+        }
+        return size_class;
+    }
+
+    std::shared_ptr<BufferPool> BufferPool::getDefault() {
+        static std::shared_ptr<BufferPool> default_pool = std::make_shared<BufferPool>();
+        return default_pool;
+    }
+}
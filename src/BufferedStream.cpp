@@ -1,87 +1,407 @@
 #include <algorithm>
 #include <cstring>
+#include <endian.h>
 #include "socket_wrapper/BufferedStream.h"
 #include "socket_wrapper/SocketException.h"
 #include <stdexcept>
 namespace socket_wrapper {
+    namespace {
+        /**
+         * @return the first occurrence of delimiter in [begin, end), nullptr if there is none
+         * memchr finds the candidates, glibc vectorizes it with SSE2/AVX2 (chosen at runtime)
+         */
+        const char *findDelimiter(const char *begin, const char *end, const std::string &delimiter) {
+            const char first = delimiter[0];
+            const size_t length = delimiter.size();
+            while ((size_t) (end - begin) >= length) {
+                auto candidate = (const char *) memchr(begin, first, end - begin - length + 1);
+                if (candidate == nullptr) {
+                    return nullptr;
+                }
+                if (length == 1 || memcmp(candidate + 1, delimiter.data() + 1, length - 1) == 0) {
+                    return candidate;
+                }
+                begin = candidate + 1;
+            }
+            return nullptr;
+        }
+    }
 
-    BufferedStream::BufferedStream(Stream src_stream, size_t buffer_size) : stream(std::move(src_stream)),
-                                                                            stream_buffer_size(buffer_size),
-                                                                            buffer_write_offset(0) {
-        stream_buffer = (char *) calloc(buffer_size, 1);
+    size_t const BufferedStream::kDefaultFlushThreshold;
+    int const BufferedStream::kDefaultFlushDeadlineUs;
+
+    BufferedStream::BufferedStream(Stream src_stream, size_t buffer_size, std::shared_ptr<BufferPool> pool)
+            : stream(std::move(src_stream)), buffer_size(buffer_size), buffer_pool(std::move(pool)) {
     }
-    BufferedStream::BufferedStream(BufferedStream &&src) noexcept: stream(std::move(src.stream)),stream_buffer_size(src.stream_buffer_size),stream_buffer(src.stream_buffer),buffer_write_offset(src.buffer_write_offset) {
-        src.stream_buffer = (char*)-1; // invalidate the pointer
+    BufferedStream::BufferedStream(BufferedStream &&src) noexcept: stream(std::move(src.stream)),buffer_size(src.buffer_size),buffer_pool(std::move(src.buffer_pool)),buffer(std::move(src.buffer)),scanned_delimiter(std::move(src.scanned_delimiter)),scanned_bytes(src.scanned_bytes),stats(std::move(src.stats)),flush_policy(src.flush_policy),flush_threshold(src.flush_threshold),flush_deadline(src.flush_deadline),corked(src.corked),pending_writes(std::move(src.pending_writes)),pending_since(src.pending_since) {
     }
 
     std::vector<char> BufferedStream::readUntilDelimiter(char delimiter_sequence) {
-        while (buffer_write_offset < stream_buffer_size) {
-            buffer_write_offset += stream.read(stream_buffer + buffer_write_offset,
-                                               stream_buffer_size - buffer_write_offset, 1);
-            auto delimiter_pos = std::find(stream_buffer, stream_buffer + buffer_write_offset, delimiter_sequence);
-            if (delimiter_pos != stream_buffer + buffer_write_offset) {
+        return readUntilDelimiter(std::string(1, delimiter_sequence));
+    }
+
+    std::vector<char> BufferedStream::readUntilDelimiter(const std::string &delimiter, int timeout_ms) {
+        std::lock_guard<std::recursive_mutex> lk(buffer_lock);
+        auto line = peekUntilDelimiter(delimiter, timeout_ms);
+        auto result = std::vector<char>(line.begin(), line.end());
+        dropFromBuffer(line.size + delimiter.size());
+        return result;
+    }
+
+    BufferView BufferedStream::peekUntilDelimiter(const std::string &delimiter, int timeout_ms) {
+        if (delimiter.empty()) {
+            throw std::logic_error("the delimiter must not be empty");
+        }
+        std::lock_guard<std::recursive_mutex> lk(buffer_lock);
+        if (delimiter != scanned_delimiter) {
+            scanned_delimiter = delimiter;
+            scanned_bytes = 0;
+        }
+        while (true) {
+            // a delimiter may have been cut off at the end of the previous scan
+            size_t scan_start = scanned_bytes - std::min(scanned_bytes, delimiter.size() - 1);
+            auto data = getBufferedData();
+            const char *delimiter_pos = findDelimiter(data.data + scan_start, data.end(), delimiter);
+            if (delimiter_pos != nullptr) {
                 // we found the delimiter
-                auto result = std::vector<char>(stream_buffer, delimiter_pos);
-                buffer_write_offset -= result.size()+1;// -1 to account for the delimiter
-                memmove(stream_buffer, delimiter_pos + 1, buffer_write_offset);
-                return result;
+                scanned_bytes = delimiter_pos - data.data;
+                return {.data = data.data, .size = scanned_bytes};
+            }
+            scanned_bytes = data.size;
+            if (data.size >= buffer_size) {
+                throw std::logic_error("could not find delimiter, even though the buffer is full");
             }
+            readAvailableDataIntoBuffer(timeout_ms);
         }
-        throw std::logic_error("could not find delimiter, even though the buffer is full");
     }
 
     std::vector<char> BufferedStream::read(size_t bytes_to_read, int timeout_ms) {
         // first we have to ensure there is enough data in the buffer
-        if( bytes_to_read > stream_buffer_size){
+        if( bytes_to_read > buffer_size){
             throw std::logic_error("buffer is to small for the requested read");
         }
-        while (buffer_write_offset < bytes_to_read) {
+        while (getBufferedData().size < bytes_to_read) {
             readAvailableDataIntoBuffer(timeout_ms);
         }
         auto result = PopFromBuffer(bytes_to_read);
         return result;
     }
 
+    BufferView BufferedStream::peek(size_t min_bytes, int timeout_ms) {
+        if (min_bytes > buffer_size) {
+            throw std::logic_error("buffer is to small for the requested peek");
+        }
+        std::lock_guard<std::recursive_mutex> lk(buffer_lock);
+        while (getBufferedData().size < min_bytes) {
+            readAvailableDataIntoBuffer(timeout_ms);
+        }
+        return getBufferedData();
+    }
+
+    BufferView BufferedStream::readFrame(const FrameFormat &format, int timeout_ms) {
+        std::lock_guard<std::recursive_mutex> lk(buffer_lock);
+        size_t header_size;
+        uint64_t payload_size;
+        waitForFrameHeader(format, header_size, payload_size, timeout_ms);
+        size_t checksum_size = format.crc32c ? FrameFormat::kChecksumSize : 0;
+        uint64_t frame_size = header_size + payload_size + checksum_size;
+        if (frame_size > buffer_size) {
+            throw std::logic_error("the frame of " + std::to_string(frame_size) +
+                                   " bytes does not fit into the buffer, it has to be read in chunks");
+        }
+        waitForBufferedBytes(frame_size, timeout_ms);
+        // consuming only moves the start of the buffer, the payload stays in place until the next read
+        BufferView payload = {.data = getBufferedData().data + header_size, .size = payload_size};
+        dropFromBuffer(frame_size);
+        if (format.crc32c) {
+            uint32_t checksum;
+            memcpy(&checksum, payload.end(), sizeof(checksum));
+            if (le32toh(checksum) != crc32c(payload.data, payload.size)) {
+                throw SocketException(SocketException::SOCKET_INVALID_FRAME, EBADMSG);
+            }
+        }
+        return payload;
+    }
+
+    uint64_t BufferedStream::readFrame(const FrameFormat &format, const std::function<void(BufferView)> &on_chunk,
+                                       int timeout_ms) {
+        std::lock_guard<std::recursive_mutex> lk(buffer_lock);
+        size_t header_size;
+        uint64_t payload_size;
+        waitForFrameHeader(format, header_size, payload_size, timeout_ms);
+        dropFromBuffer(header_size);
+        uint32_t expected_checksum = 0;
+        for (uint64_t remaining_bytes = payload_size; remaining_bytes > 0;) {
+            waitForBufferedBytes(1, timeout_ms);
+            auto data = getBufferedData();
+            BufferView chunk = {.data = data.data, .size = std::min<uint64_t>(data.size, remaining_bytes)};
+            if (format.crc32c) {
+                expected_checksum = crc32c(chunk.data, chunk.size, expected_checksum);
+            }
+            dropFromBuffer(chunk.size);
+            remaining_bytes -= chunk.size;
+            on_chunk(chunk);
+        }
+        if (format.crc32c) {
+            waitForBufferedBytes(FrameFormat::kChecksumSize, timeout_ms);
+            uint32_t checksum;
+            memcpy(&checksum, getBufferedData().data, sizeof(checksum));
+            dropFromBuffer(FrameFormat::kChecksumSize);
+            if (le32toh(checksum) != expected_checksum) {
+                throw SocketException(SocketException::SOCKET_INVALID_FRAME, EBADMSG);
+            }
+        }
+        return payload_size;
+    }
+
+    void BufferedStream::waitForFrameHeader(const FrameFormat &format, size_t &header_size, uint64_t &payload_size,
+                                            int timeout_ms) {
+        while (true) {
+            auto data = getBufferedData();
+            if (decodeFrameHeader(format, data.data, data.size, header_size, payload_size)) {
+                return;
+            }
+            readAvailableDataIntoBuffer(timeout_ms);
+        }
+    }
+
+    void BufferedStream::waitForBufferedBytes(size_t bytes, int timeout_ms) {
+        while (getBufferedData().size < bytes) {
+            readAvailableDataIntoBuffer(timeout_ms);
+        }
+    }
+
+    void BufferedStream::consume(size_t bytes) {
+        std::lock_guard<std::recursive_mutex> lk(buffer_lock);
+        if (bytes > getBufferedData().size) {
+            throw std::out_of_range(std::string("the buffer does not contain enough data to consume ") +
+                                    std::to_string(bytes) + " bytes, contains " + std::to_string(getBufferedData().size));
+        }
+        dropFromBuffer(bytes);
+    }
+
     std::vector<char> BufferedStream::PopFromBuffer(size_t bytes_to_read) {
         std::lock_guard<std::recursive_mutex> lk(buffer_lock);
-        if(bytes_to_read>buffer_write_offset){
+        auto data = getBufferedData();
+        if(bytes_to_read>data.size){
             throw std::out_of_range(std::string("the buffer does not contain enough data yet, should read ")+
-            std::to_string(bytes_to_read) + " can read " + std::to_string(buffer_write_offset) );
+            std::to_string(bytes_to_read) + " can read " + std::to_string(data.size) );
         }
-        auto result = std::vector<char>(stream_buffer, stream_buffer + bytes_to_read);
-        buffer_write_offset -= result.size();
-        memmove(stream_buffer, stream_buffer + bytes_to_read, buffer_write_offset);
+        auto result = std::vector<char>(data.data, data.data + bytes_to_read);
+        dropFromBuffer(bytes_to_read);
         return result;
     }
 
+    void BufferedStream::dropFromBuffer(size_t bytes) {
+        if (bytes > 0) {
+            buffer->consume(bytes);
+        }
+        scanned_bytes -= std::min(scanned_bytes, bytes);
+    }
+
+    BufferView BufferedStream::getBufferedData() {
+        return buffer ? BufferView{.data = buffer->data(), .size = buffer->size()} : BufferView{.data = nullptr, .size = 0};
+    }
+
     size_t BufferedStream::readAvailableDataIntoBuffer(int timeout_ms) {
         std::lock_guard<std::recursive_mutex> lk(buffer_lock);
-        size_t read_bytes = stream.read(stream_buffer + buffer_write_offset,
-                                       stream_buffer_size - buffer_write_offset, 1,timeout_ms);
-        buffer_write_offset += read_bytes;
+        if ((!buffer || buffer->size() == 0) && stream.waitsInRead()) {
+            // the Stream spins or submits to io_uring in read, which parking in waitUntilReadable would skip
+            if (!buffer) {
+                buffer = buffer_pool->acquire(buffer_size);
+            }
+        } else if (!buffer || buffer->size() == 0) {
+            if (buffer) {
+                // a busy Stream keeps its buffer, as long as there is more data
+                size_t read_bytes = stream.tryRead(buffer->writableData(), buffer->writableSize());
+                if (read_bytes > 0) {
+                    buffer->commitWrite(read_bytes);
+                    return read_bytes;
+                }
+                buffer_pool->release(std::move(buffer));
+            }
+            // an idle Stream waits without holding a buffer, and then reads without polling a second time
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+            int wait_ms = timeout_ms;
+            while (true) {
+                stream.waitUntilReadable(wait_ms);
+                buffer = buffer_pool->acquire(buffer_size);
+                size_t read_bytes = stream.tryRead(buffer->writableData(), buffer->writableSize());
+                if (read_bytes > 0) {
+                    buffer->commitWrite(read_bytes);
+                    return read_bytes;
+                }
+                // the wakeup was spurious, e.g. the data was taken by another reader
+                buffer_pool->release(std::move(buffer));
+                wait_ms = Stream::remainingMs(timeout_ms, deadline, 0, SocketException::SOCKET_READ_TIMEOUT);
+            }
+        } else if (buffer->writableSize() == 0) {
+            // only a buffer which is not double mapped has to move its data to make room
+            size_t moved_bytes = buffer->compact();
+            if (stats) {
+                Stats::add(stats->memmove_bytes, moved_bytes);
+            }
+        }
+        size_t read_bytes = stream.read(buffer->writableData(), buffer->writableSize(), 1, timeout_ms);
+        buffer->commitWrite(read_bytes);
         return read_bytes;
     }
 
     BufferedStream::~BufferedStream() noexcept {
-        if(stream_buffer!=(char*)-1){
-            free(stream_buffer);
+        try {
+            // a destructor must not raise SIGPIPE, so the pending data is sent with MSG_NOSIGNAL
+            size_t written_bytes = 0;
+            for (int attempts = 2; attempts > 0 && written_bytes < pending_writes.size(); attempts--) {
+                iovec buffer_vec = {.iov_base = pending_writes.data() + written_bytes,
+                                    .iov_len = pending_writes.size() - written_bytes};
+                written_bytes += stream.sendNonBlocking(&buffer_vec, 1);
+                if (written_bytes < pending_writes.size()) {
+                    stream.waitUntilWritable(Stream::kSocketRetryIntervallMs);
+                }
+            }
+        } catch (const std::exception &) {
+            // the peer is gone, the data can not be delivered anyway
+        }
+        if (buffer && buffer_pool) {
+            buffer_pool->release(std::move(buffer));
+        }
+    }
+
+    void BufferedStream::setFlushPolicy(FLUSH_POLICY policy, size_t threshold, int deadline_us, bool cork) {
+        std::lock_guard<std::mutex> lk(write_lock);
+        flushPendingWrites(true);
+        if (cork != corked) {
+            StreamOptions options;
+            options.tcp_cork = cork ? 1 : 0;
+            stream.setOptions(options);
+            corked = cork;
+        }
+        flush_policy = policy;
+        flush_threshold = threshold;
+        flush_deadline = std::chrono::microseconds(deadline_us);
+    }
+
+    void BufferedStream::flush() {
+        std::lock_guard<std::mutex> lk(write_lock);
+        flushPendingWrites(true);
+    }
+
+    bool BufferedStream::flushIfDue() {
+        std::lock_guard<std::mutex> lk(write_lock);
+        if (flush_policy != FLUSH_ON_DEADLINE || pending_writes.empty() ||
+            std::chrono::steady_clock::now() - pending_since < flush_deadline) {
+            return false;
         }
+        flushPendingWrites(true);
+        return true;
+    }
+
+    size_t BufferedStream::getPendingWriteSize() {
+        std::lock_guard<std::mutex> lk(write_lock);
+        return pending_writes.size();
     }
 
     void BufferedStream::write(char const *buffer, size_t buffer_length) {
-        stream.write(buffer, buffer_length,2);
+        std::lock_guard<std::mutex> lk(write_lock);
+        if (flush_policy == FLUSH_IMMEDIATELY) {
+            stream.write(buffer, buffer_length, 2);
+            return;
+        }
+        iovec buffer_vec = {.iov_base = (void *) buffer, .iov_len = buffer_length};
+        appendPendingWrites(&buffer_vec, 1);
+    }
+
+    size_t BufferedStream::writev(const iovec *buffers, size_t buffer_count) {
+        std::lock_guard<std::mutex> lk(write_lock);
+        if (flush_policy == FLUSH_IMMEDIATELY) {
+            return stream.writev(buffers, buffer_count, 2);
+        }
+        size_t total_size = 0;
+        for (size_t i = 0; i < buffer_count; i++) {
+            total_size += buffers[i].iov_len;
+        }
+        appendPendingWrites(buffers, buffer_count);
+        return total_size;
+    }
+
+    size_t BufferedStream::writev(const std::vector<iovec> &buffers) {
+        return writev(buffers.data(), buffers.size());
+    }
+
+    size_t BufferedStream::sendFile(int fd, off_t offset, size_t len, int timeout_ms) {
+        std::lock_guard<std::mutex> lk(write_lock);
+        // the file has to follow the data written before
+        flushPendingWrites(false);
+        return stream.sendFile(fd, offset, len, timeout_ms);
+    }
+
+    void BufferedStream::appendPendingWrites(const iovec *buffers, size_t buffer_count) {
+        size_t total_size = 0;
+        for (size_t i = 0; i < buffer_count; i++) {
+            total_size += buffers[i].iov_len;
+        }
+        if (pending_writes.size() + total_size >= flush_threshold) {
+            // the new buffers are not copied, but written behind the pending data in the same syscall
+            flushPendingWrites(false, buffers, buffer_count);
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (pending_writes.empty()) {
+            pending_since = now;
+        }
+        for (size_t i = 0; i < buffer_count; i++) {
+            auto data = (const char *) buffers[i].iov_base;
+            pending_writes.insert(pending_writes.end(), data, data + buffers[i].iov_len);
+        }
+        if (flush_policy == FLUSH_ON_DEADLINE && now - pending_since >= flush_deadline) {
+            flushPendingWrites(true);
+        }
+    }
+
+    void BufferedStream::flushPendingWrites(bool push, const iovec *extra_buffers, size_t extra_buffer_count) {
+        std::vector<iovec> buffers;
+        buffers.reserve(extra_buffer_count + 1);
+        if (!pending_writes.empty()) {
+            buffers.push_back({.iov_base = pending_writes.data(), .iov_len = pending_writes.size()});
+        }
+        buffers.insert(buffers.end(), extra_buffers, extra_buffers + extra_buffer_count);
+        try {
+            if (!buffers.empty()) {
+                stream.writev(buffers, 2);
+            }
+        } catch (const SocketException &ex) {
+            // the data accepted by earlier writes stays pending, so a later flush retries it
+            size_t written_bytes = ex.processed_bytes > 0 ? (size_t) ex.processed_bytes : 0;
+            size_t written_pending_bytes = std::min(written_bytes, pending_writes.size());
+            pending_writes.erase(pending_writes.begin(), pending_writes.begin() + written_pending_bytes);
+            if (extra_buffer_count == 0) {
+                throw;
+            }
+            // the extra buffers are not kept, the caller learns how much of them was written
+            throw SocketException(ex.exception_type, ex.c_error, (ssize_t) (written_bytes - written_pending_bytes));
+        }
+        // clear keeps the capacity, so the next writes are not reallocated
+        pending_writes.clear();
+        if (push && corked) {
+            // uncorking sends an incomplete segment right away
+            StreamOptions options;
+            options.tcp_cork = 0;
+            stream.setOptions(options);
+            options.tcp_cork = 1;
+            stream.setOptions(options);
+        }
     }
 
     size_t BufferedStream::read(char *buffer, size_t max_bytes_to_read, size_t min_bytes_to_read, int timeout_ms) {
         std::lock_guard<std::recursive_mutex> lk(buffer_lock);
-        do {
+        // data which is buffered already is returned without waiting for the socket
+        while (getBufferedData().size < std::max<size_t>(min_bytes_to_read, 1)) {
             readAvailableDataIntoBuffer(timeout_ms);
-        } while (buffer_write_offset<min_bytes_to_read);
-        size_t read_data_length = std::min(buffer_write_offset,max_bytes_to_read);
-        auto data = PopFromBuffer(read_data_length);
-        for(auto d:data){
-            *(buffer++) = d;
         }
+        auto data = getBufferedData();
+        size_t read_data_length = std::min(data.size,max_bytes_to_read);
+        memcpy(buffer, data.data, read_data_length);
+        dropFromBuffer(read_data_length);
         return read_data_length;
     }
 
@@ -89,5 +409,14 @@ namespace socket_wrapper {
         stream.stopReads();
     }
 
+    void BufferedStream::enableStats(std::shared_ptr<Stats> shared_stats) {
+        stream.enableStats(shared_stats);
+        stats = std::move(shared_stats);
+    }
+
+    StatsSnapshot BufferedStream::getStats() {
+        return stream.getStats();
+    }
+
 
 }
\ No newline at end of file
@@ -0,0 +1,40 @@
+#include <algorithm>
+#include "socket_wrapper/BusyPoller.h"
+
+namespace socket_wrapper {
+    int const BusyPoller::kDefaultMaxSpinUs;
+
+    BusyPoller::BusyPoller(int max_spin_us, bool adaptive) : max_spin_us(std::max(max_spin_us, 0)),
+                                                             adaptive(adaptive) {}
+
+    void BusyPoller::recordArrival() {
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        int64_t last = last_arrival_ns.exchange(now, std::memory_order_relaxed);
+        if (last == 0) {
+            return;
+        }
+        int64_t gap = now - last;
+        int64_t average = average_gap_ns.load(std::memory_order_relaxed);
+        average = average == 0 ? gap : average + ((gap - average) >> kAverageShift);
+        average_gap_ns.store(average, std::memory_order_relaxed);
+    }
+
+    int BusyPoller::getSpinBudgetUs() const {
+        int64_t average = average_gap_ns.load(std::memory_order_relaxed);
+        if (!adaptive || average == 0) {
+            return max_spin_us; // nothing learned yet
+        }
+        int64_t budget_us = average * kGapMultiplier / 1000;
+        // if the next message is not expected within the limit, spinning only burns the core
+        return budget_us <= max_spin_us ? (int) std::max<int64_t>(budget_us, 1) : 0;
+    }
+
+    void BusyPoller::cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+}
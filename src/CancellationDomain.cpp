@@ -0,0 +1,101 @@
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "socket_wrapper/CancellationDomain.h"
+
+namespace socket_wrapper {
+
+    CancellationDomain::CancellationDomain() {
+        event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd == -1) {
+            throw std::runtime_error(std::string("Failed to create eventfd errno=") + std::strerror(errno));
+        }
+    }
+
+    CancellationDomain::~CancellationDomain() noexcept {
+        ::close(event_fd);
+    }
+
+    void CancellationDomain::cancelAll() {
+        std::lock_guard<std::mutex> lk(wakeup_mtx);
+        // the flag is set before waking anyone, so every woken thread sees it
+        if (!cancelled.exchange(true)) {
+            uint64_t value = 1;
+            ::write(event_fd, &value, sizeof(value));
+        }
+    }
+
+    void CancellationDomain::beginWakeup() {
+        std::lock_guard<std::mutex> lk(wakeup_mtx);
+        if (running_wakeups++ == 0) {
+            uint64_t value = 1;
+            ::write(event_fd, &value, sizeof(value));
+        }
+    }
+
+    void CancellationDomain::endWakeup() {
+        std::lock_guard<std::mutex> lk(wakeup_mtx);
+        if (--running_wakeups == 0 && !cancelled.load()) {
+            uint64_t value;
+            ::read(event_fd, &value, sizeof(value));
+        }
+    }
+
+    bool CancellationDomain::isCancelled() const {
+        return cancelled.load();
+    }
+
+    int CancellationDomain::getFdForPoll() const {
+        return event_fd;
+    }
+
+    std::shared_ptr<CancellationDomain> CancellationDomain::getDefault() {
+        static std::shared_ptr<CancellationDomain> default_domain = std::make_shared<CancellationDomain>();
+        return default_domain;
+    }
+
+    StopRequest::Waiter::Waiter(StopRequest &request, CancellationDomain &domain) : request(request), domain(domain) {
+        request.waiters.fetch_add(1);
+    }
+
+    StopRequest::Waiter::~Waiter() noexcept {
+        if (request.waiters.fetch_sub(1) == 1) {
+            request.finishWakeup(domain);
+        }
+    }
+
+    void StopRequest::request(CancellationDomain &domain) {
+        // the flag is set before the waiters are counted, a waiter registered after that sees the flag
+        if (requested.exchange(true) || waiters.load() == 0) {
+            return;
+        }
+        domain.beginWakeup();
+        wakeup_running.store(true);
+        // the waiters may have left before the wakeup started
+        if (waiters.load() == 0) {
+            finishWakeup(domain);
+        }
+    }
+
+    void StopRequest::finishWakeup(CancellationDomain &domain) {
+        if (wakeup_running.exchange(false)) {
+            domain.endWakeup();
+        }
+    }
+
+    bool StopRequest::isRequested() const {
+        return requested.load();
+    }
+
+    void StopRequest::assign(const StopRequest &other) {
+        requested.store(other.requested.load());
+    }
+
+    void wakeUpBlockedOperations(int socket_fd) {
+        // the socket becomes readable, which ends poll, epoll and io_uring waits on it
+        ::shutdown(socket_fd, SHUT_RD);
+    }
+}
@@ -1,12 +1,16 @@
 #include <cstring>
 #include <csignal>
 #include <algorithm>
+#include <limits>
+#include <utility>
 #include <sys/poll.h>
+#include <endian.h>
 #include "socket_wrapper/ConditionalBufferedStream.h"
 #include "socket_wrapper/SocketException.h"
 #include "unistd.h"
 
 namespace socket_wrapper {
+    size_t const ConditionalBufferedStream::kDefaultQueueCapacity;
 
     void ConditionalBufferedStream::start() {
         worker = std::thread([&]() { ConditionalBufferWorker(); });
@@ -16,17 +20,15 @@ namespace socket_wrapper {
         try {
             while (true) { // exited through exception
                 stream.readAvailableDataIntoBuffer();
-                const std::vector<char> data = std::vector<char>(stream.stream_buffer,
-                                                                 stream.stream_buffer +
-                                                                 stream.buffer_write_offset);
-                processDataSendSignals(data);
+                // the conditions look at the buffer in place, only the segments they trigger on are copied
+                processDataSendSignals();
             }
         } catch (SocketException& ex) {
             if (ex.exception_type != SocketException::SOCKET_TERMINATION_REQUEST) {
                 last_ex = ex.exception_type;
                 std::lock_guard<std::recursive_mutex> lk(buffer_event_handlers_mtx);
                 // Notify event handlers that the socket is no longer good
-                for(auto x : buffer_event_handlers){
+                for(auto &x : buffer_event_handlers){
                     uint64_t semaphore_post = 1;
                     if (::write(x.fd, &semaphore_post, sizeof(semaphore_post)) < 0) {
                         throw SocketException(SocketException::SOCKET_WRITE, errno);
@@ -36,73 +38,187 @@ namespace socket_wrapper {
         }
     }
 
-    void ConditionalBufferedStream::processDataSendSignals(const std::vector<char> &data) {
-        if (data.empty()) {
-            return;
-        }
-        std::lock_guard<std::recursive_mutex> lk(buffer_event_handlers_mtx);
-        for (auto event_handler: buffer_event_handlers) {
-            int bytes_read_by_condition = event_handler.condition(data);
-            if(abs(bytes_read_by_condition) > data.size()){
-                throw std::logic_error("a condition on a ConditionalBufferedStream tried to read more data, than exists");
+    void ConditionalBufferedStream::processDataSendSignals() {
+        std::unique_lock<std::recursive_mutex> lk(buffer_event_handlers_mtx);
+        // all segments found after a read are published together, with one eventfd write per condition
+        bool triggered = true;
+        while (triggered) {
+            triggered = false;
+            BufferView data = stream.getBufferedData();
+            if (data.empty()) {
+                break;
             }
-            if (bytes_read_by_condition != 0) {
-                {
-                    std::lock_guard<std::recursive_mutex> lk(received_data_per_condition_mtx);
-                    auto read_data = stream.PopFromBuffer(abs(bytes_read_by_condition));
-                    if(bytes_read_by_condition > 0){
-                        received_data_per_condition[event_handler.fd].push_back(read_data);
-                    }
+            for (auto &event_handler: buffer_event_handlers) {
+                int bytes_read_by_condition = event_handler.condition(data, std::min(event_handler.scanned_bytes,
+                                                                                     data.size));
+                event_handler.scanned_bytes = data.size;
+                if (stats) {
+                    Stats::add(stats->condition_evaluations);
                 }
-                if(bytes_read_by_condition > 0) {
-                    // trigger the event, by writing the number of bytes in the buffer are returned
-                    uint64_t semaphore_post = 1;
-                    if (::write(event_handler.fd, &semaphore_post, sizeof(semaphore_post)) < 0) {
-                        throw SocketException(SocketException::SOCKET_WRITE, errno);
+                if ((size_t) abs(bytes_read_by_condition) > data.size) {
+                    throw std::logic_error("a condition on a ConditionalBufferedStream tried to read more data, than exists");
+                }
+                if (bytes_read_by_condition == 0) {
+                    continue;
+                }
+                if (bytes_read_by_condition < 0) {
+                    // discarded data is not copied
+                    stream.dropFromBuffer(-bytes_read_by_condition);
+                } else {
+                    received_segment segment = {.data = stream.PopFromBuffer(bytes_read_by_condition),
+                                                .received_at = stats ? std::chrono::steady_clock::now()
+                                                                     : std::chrono::steady_clock::time_point()};
+                    while (true) {
+                        // taken before the push, so a segment read after it failed is not missed
+                        uint64_t segments_read_before = segmentsRead();
+                        if (event_handler.queue->tryPush(std::move(segment))) {
+                            break;
+                        }
+                        // the readers are behind, wake them up and wait for them, new data stays in the socket
+                        publishSegments();
+                        lk.unlock();
+                        waitForQueueSpace(segments_read_before);
+                        lk.lock();
                     }
+                    event_handler.unpublished_segments++;
                 }
-                // ensure that signals can be triggered multiple times per ::read
-                processDataSendSignals(std::vector<char>(begin(data) + abs(bytes_read_by_condition), end(data)));
+                // the data in front of the scanned bytes changed, start over with the first condition
+                for (auto &h: buffer_event_handlers) {
+                    h.scanned_bytes = 0;
+                }
+                triggered = true;
+                break;
             }
         }
+        publishSegments();
+    }
+
+    uint64_t ConditionalBufferedStream::segmentsRead() {
+        std::lock_guard<std::mutex> lk(queue_space_mtx);
+        return segments_read;
+    }
+
+    void ConditionalBufferedStream::waitForQueueSpace(uint64_t segments_read_before) {
+        std::unique_lock<std::mutex> lk(queue_space_mtx);
+        queue_space_freed.wait(lk, [&]() { return segments_read != segments_read_before || termination_requested; });
+        if (termination_requested) {
+            throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST);
+        }
     }
 
+    void ConditionalBufferedStream::wakeUpWorker() {
+        std::lock_guard<std::mutex> lk(queue_space_mtx);
+        queue_space_freed.notify_all();
+    }
 
-    int ConditionalBufferedStream::createEventfdOnCondition(buffer_event_condition condition) {
-        int fd = eventfd(0, EFD_SEMAPHORE);
+    void ConditionalBufferedStream::publishSegments() {
+        for (auto &event_handler: buffer_event_handlers) {
+            if (event_handler.unpublished_segments == 0) {
+                continue;
+            }
+            // trigger the event, the counter is the number of segments added
+            uint64_t segment_count = std::exchange(event_handler.unpublished_segments, 0);
+            if (::write(event_handler.fd, &segment_count, sizeof(segment_count)) < 0) {
+                throw SocketException(SocketException::SOCKET_WRITE, errno);
+            }
+        }
+    }
+
+    int ConditionalBufferedStream::createEventfdOnCondition(buffer_event_condition condition, size_t queue_capacity,
+                                                            bool multi_consumer) {
+        // the copy keeps its capacity, so it is only allocated until the buffer was filled once
+        std::vector<char> data;
+        return createEventfdOnCondition(buffer_view_condition([condition, data](BufferView view, size_t) mutable {
+            data.assign(view.begin(), view.end());
+            return condition(data);
+        }), queue_capacity, multi_consumer);
+    }
+
+    int ConditionalBufferedStream::createEventfdOnCondition(buffer_view_condition condition, size_t queue_capacity,
+                                                            bool multi_consumer) {
+        auto queue = std::unique_ptr<segment_queue>(new segment_queue());
+        if (multi_consumer) {
+            queue->multi_consumer.reset(new MpmcQueue<received_segment>(queue_capacity));
+        } else {
+            queue->single_consumer.reset(new SpscQueue<received_segment>(queue_capacity));
+        }
+        int fd = eventfd(0, EFD_NONBLOCK);
         if (fd == -1) {
             throw std::runtime_error(std::string("Failed to create eventfd errno=") + std::strerror(errno));
         }
-        buffer_event_handlers.emplace_back(buffer_event_handler{.condition = condition, .fd = fd});
-        received_data_per_condition[fd] = {};
+        queues_by_fd.push_back(condition_queue{.fd = fd, .queue = queue.get()});
+        buffer_event_handlers.emplace_back(
+                buffer_event_handler{.condition = std::move(condition), .fd = fd, .scanned_bytes = 0,
+                                     .queue = std::move(queue), .unpublished_segments = 0});
         return fd;
     }
 
+    ConditionalBufferedStream::segment_queue &ConditionalBufferedStream::getQueue(int condition_fd) {
+        // there are only a few conditions, a scan stays in one or two cache lines
+        for (auto &entry: queues_by_fd) {
+            if (entry.fd == condition_fd) {
+                return *entry.queue;
+            }
+        }
+        throw SocketException(SocketException::SOCKET_INVALID_CONDITION);
+    }
+
     ConditionalBufferedStream::ConditionalBufferedStream(BufferedStream stream) : stream{std::move(stream)} {
 
     }
 
     ConditionalBufferedStream::~ConditionalBufferedStream() {
-        for(auto x : buffer_event_handlers){::close(x.fd);}
+        termination_requested = true; // a worker waiting for readers stops as well
+        wakeUpWorker();
         stream.stopReads(); // results worker thread stopping
-        worker.join();
+        if (worker.joinable()) {
+            worker.join();
+        }
+        for(auto &x : buffer_event_handlers){::close(x.fd);}
     }
 
     std::vector<char> ConditionalBufferedStream::read(int condition_fd) {
-        std::lock_guard<std::recursive_mutex> lk(received_data_per_condition_mtx);
-        if (received_data_per_condition.find(condition_fd) == end(received_data_per_condition)) {
-            throw SocketException(SocketException::SOCKET_INVALID_CONDITION);
-        }
-        if (!received_data_per_condition[condition_fd].empty()) {
-            std::vector<char> data = received_data_per_condition[condition_fd].front();
-            received_data_per_condition[condition_fd].pop_front();
-            return data;
-        }if(last_ex != SocketException::SOCKET_OK){
-            throw SocketException(last_ex);
-        } else {
+        auto segments = readBatch(condition_fd, 1);
+        if (segments.empty()) {
             throw std::out_of_range("A read on condition " + std::to_string(condition_fd) +
                                     " was performed, but there is no data present yet");
         }
+        return std::move(segments.front());
+    }
+
+    std::vector<std::vector<char>> ConditionalBufferedStream::readAll(int condition_fd) {
+        return readBatch(condition_fd, std::numeric_limits<size_t>::max());
+    }
+
+    std::vector<std::vector<char>> ConditionalBufferedStream::readBatch(int condition_fd, size_t max_segments) {
+        auto &queue = getQueue(condition_fd);
+        // reset the eventfd before taking the segments, so segments added meanwhile are not missed
+        uint64_t condition_response;
+        ::read(condition_fd, &condition_response, sizeof(condition_response));
+        std::vector<std::vector<char>> segments;
+        received_segment segment;
+        while (segments.size() < max_segments && queue.tryPop(segment)) {
+            if (stats) {
+                stats->queue_residency_us.record(Stats::elapsedUs(segment.received_at));
+            }
+            segments.push_back(std::move(segment.data));
+        }
+        if (!segments.empty()) {
+            // a worker waiting for space in the queue continues
+            std::lock_guard<std::mutex> lk(queue_space_mtx);
+            segments_read += segments.size();
+            queue_space_freed.notify_all();
+        }
+        if (!queue.empty()) {
+            // the eventfd stays readable while segments are queued
+            uint64_t semaphore_post = 1;
+            ::write(condition_fd, &semaphore_post, sizeof(semaphore_post));
+        } else if (segments.empty() && last_ex != SocketException::SOCKET_OK) {
+            throw SocketException(last_ex);
+        } else if (segments.empty() && termination_requested) {
+            throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST);
+        }
+        return segments;
     }
 
     buffer_event_condition ConditionalBufferedStream::getDelimiterCondition(char delimiter) {
@@ -112,28 +228,70 @@ namespace socket_wrapper {
         };
         return newline_condition;
     }
+
+    buffer_view_condition ConditionalBufferedStream::getDelimiterViewCondition(char delimiter) {
+        auto newline_condition = [delimiter](BufferView data, size_t scanned_bytes) {
+            auto pos = (const char *) memchr(data.data + scanned_bytes, delimiter, data.size - scanned_bytes);
+            return pos != nullptr ? (int) (pos - data.data + 1) : 0;
+        };
+        return newline_condition;
+    }
+    buffer_view_condition ConditionalBufferedStream::getFrameCondition(const FrameFormat &format) {
+        return [format](BufferView data, size_t) {
+            size_t header_size;
+            uint64_t payload_size;
+            if (!decodeFrameHeader(format, data.data, data.size, header_size, payload_size)) {
+                return 0;
+            }
+            size_t frame_size = header_size + payload_size + (format.crc32c ? FrameFormat::kChecksumSize : 0);
+            if (data.size < frame_size) {
+                return 0;
+            }
+            if (format.crc32c) {
+                uint32_t checksum;
+                memcpy(&checksum, data.data + header_size + payload_size, sizeof(checksum));
+                if (le32toh(checksum) != crc32c(data.data + header_size, payload_size)) {
+                    return -(int) frame_size;
+                }
+            }
+            return (int) frame_size;
+        };
+    }
+
     std::string ConditionalBufferedStream::readBlockingStr(int condition_fd, int timeout_ms) {
         auto read = readBlocking(condition_fd, timeout_ms);
         return {begin(read), end(read)};
     }
     std::vector<char> ConditionalBufferedStream::readBlocking(int condition_fd, int timeout_ms) {
-        uint64_t condition_response;
-        // Here we poll for either the condition or termination
-        std::array<pollfd, 1> poll_fds = {
-                {{.fd = condition_fd, .events = POLLIN, .revents = 0}},
-        };
-        const int poll_result = ::poll(poll_fds.data(), poll_fds.size(), timeout_ms);
-        if (poll_result == 0) {
-            if(termination_requested){
-                throw SocketException(SocketException::Type::SOCKET_TERMINATION_REQUEST);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (true) {
+            auto segments = readBatch(condition_fd, 1);
+            if (!segments.empty()) {
+                return std::move(segments.front());
+            }
+            // Here we poll for either the condition or termination
+            int remaining_ms = timeout_ms;
+            if (timeout_ms > 0) {
+                remaining_ms = (int) std::max<int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now()).count(), 0);
             }
-            throw SocketException(SocketException::SOCKET_POLL,errno);
-        }else if (poll_fds[0].revents & POLLIN) {
-            ::read(condition_fd, &condition_response, sizeof(condition_response));
-        }else{
-            throw SocketException(SocketException::SOCKET_READ_TIMEOUT,errno);
+            std::array<pollfd, 1> poll_fds = {
+                    {{.fd = condition_fd, .events = POLLIN, .revents = 0}},
+            };
+            const int poll_result = ::poll(poll_fds.data(), poll_fds.size(), remaining_ms);
+            if (poll_result == 0) {
+                if (termination_requested) {
+                    throw SocketException(SocketException::Type::SOCKET_TERMINATION_REQUEST);
+                }
+                throw SocketException(SocketException::SOCKET_POLL, errno);
+            } else if (poll_result < 0 && errno != EINTR) {
+                throw SocketException(SocketException::SOCKET_POLL, errno);
+            } else if (poll_result > 0 && !(poll_fds[0].revents & POLLIN)) {
+                throw SocketException(SocketException::SOCKET_READ_TIMEOUT, errno);
+            }
+            // the wakeup may be spurious, the eventfd is set again after a read leaving segments queued,
+            // and by stopReads
         }
-        return read(condition_fd);
     }
 
     void ConditionalBufferedStream::write(std::vector<char> data) {
@@ -143,9 +301,42 @@ namespace socket_wrapper {
         write(std::vector<char>(begin(data), end(data)));
     }
 
+    size_t ConditionalBufferedStream::writev(const std::vector<iovec> &buffers) {
+        return stream.writev(buffers);
+    }
+
+    size_t ConditionalBufferedStream::writeBatch(const std::vector<std::vector<char>> &messages) {
+        std::vector<iovec> buffers;
+        buffers.reserve(messages.size());
+        for (auto &m: messages) {
+            buffers.push_back({.iov_base = (void *) m.data(), .iov_len = m.size()});
+        }
+        return writev(buffers);
+    }
+
+    void ConditionalBufferedStream::flush() {
+        stream.flush();
+    }
+
+    void ConditionalBufferedStream::enableStats(std::shared_ptr<Stats> shared_stats) {
+        stream.enableStats(shared_stats);
+        stats = std::move(shared_stats);
+    }
+
+    StatsSnapshot ConditionalBufferedStream::getStats() {
+        return stream.getStats();
+    }
+
     void ConditionalBufferedStream::stopReads() {
         termination_requested = true;
+        wakeUpWorker();
         stream.stopReads();
+        // wake up blocking reads, so they notice the termination
+        std::lock_guard<std::recursive_mutex> lk(buffer_event_handlers_mtx);
+        for (auto &event_handler: buffer_event_handlers) {
+            uint64_t semaphore_post = 1;
+            ::write(event_handler.fd, &semaphore_post, sizeof(semaphore_post));
+        }
     }
 
 }
\ No newline at end of file
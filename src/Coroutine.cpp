@@ -0,0 +1,129 @@
+#include <cerrno>
+#include <iostream>
+#include "socket_wrapper/Coroutine.h"
+#include "socket_wrapper/SocketException.h"
+
+namespace socket_wrapper {
+    namespace {
+        /**
+         * the frame of a spawned coroutine, it starts immediately and destroys itself once finished
+         */
+        struct DetachedTask {
+            struct promise_type {
+                DetachedTask get_return_object() noexcept { return {}; }
+
+                std::suspend_never initial_suspend() noexcept { return {}; }
+
+                std::suspend_never final_suspend() noexcept { return {}; }
+
+                void return_void() noexcept {}
+
+                void unhandled_exception() noexcept { std::terminate(); }
+            };
+        };
+
+        DetachedTask runDetached(Task<> task) {
+            try {
+                co_await task;
+            } catch (const std::exception &e) {
+                std::cout << "spawned coroutine threw " << e.what() << std::endl;
+            }
+        }
+    }
+
+    ReadinessAwaitable::ReadinessAwaitable(Reactor &reactor, int fd, bool wait_for_writable)
+            : reactor(reactor), fd(fd), wait_for_writable(wait_for_writable) {}
+
+    void ReadinessAwaitable::await_suspend(std::coroutine_handle<> awaiting) {
+        // the registration is removed before resuming, so the coroutine may wait on the fd again right away
+        Reactor *r = &reactor;
+        int registered_fd = fd;
+        readiness_callback resume = [r, registered_fd, awaiting]() {
+            r->remove(registered_fd);
+            awaiting.resume();
+        };
+        // the callback may run on a worker before add returns, members must not be accessed afterwards
+        if (wait_for_writable) {
+            r->add(registered_fd, nullptr, std::move(resume));
+        } else {
+            r->add(registered_fd, std::move(resume));
+        }
+    }
+
+    ReadinessAwaitable readable(Reactor &reactor, int fd) {
+        return {reactor, fd, false};
+    }
+
+    ReadinessAwaitable writable(Reactor &reactor, int fd) {
+        return {reactor, fd, true};
+    }
+
+    void spawn(Task<> task) {
+        runDetached(std::move(task));
+    }
+
+    Task<size_t> asyncRead(Reactor &reactor, Stream &stream, char *buffer, size_t max_bytes_to_read,
+                           size_t min_bytes_to_read) {
+        size_t read_bytes = 0;
+        while (read_bytes < min_bytes_to_read) {
+            size_t read_result = stream.tryRead(buffer + read_bytes, max_bytes_to_read - read_bytes);
+            if (read_result == 0) {
+                co_await readable(reactor, stream.getFdForPoll());
+            }
+            read_bytes += read_result;
+        }
+        co_return read_bytes;
+    }
+
+    Task<> asyncWrite(Reactor &reactor, Stream &stream, const char *buffer, size_t size) {
+        size_t written_bytes = 0;
+        while (written_bytes < size) {
+            size_t write_result = stream.tryWrite(buffer + written_bytes, size - written_bytes);
+            if (write_result == 0) {
+                co_await writable(reactor, stream.getFdForPoll());
+            }
+            written_bytes += write_result;
+        }
+    }
+
+    Task<Stream> asyncAccept(Reactor &reactor, Listener &listener) {
+        while (true) {
+            co_await readable(reactor, listener.getFdForPoll());
+            try {
+                co_return listener.accept(0);
+            } catch (SocketException &e) {
+                if (e.exception_type != SocketException::SOCKET_ACCEPT ||
+                    (e.c_error != EAGAIN && e.c_error != EWOULDBLOCK && e.c_error != ETIMEDOUT)) {
+                    throw;
+                }
+                // the connection was accepted by someone else, wait for the next one
+            }
+        }
+    }
+
+    Task<std::vector<char>> asyncRead(Reactor &reactor, UdpDatagram &datagram) {
+        while (true) {
+            co_await readable(reactor, datagram.getFdForPoll());
+            try {
+                co_return datagram.read(0);
+            } catch (SocketException &e) {
+                if (e.exception_type != SocketException::SOCKET_READ_TIMEOUT) {
+                    throw;
+                }
+                // the datagram was consumed by someone else, wait for the next one
+            }
+        }
+    }
+
+    Task<std::vector<char>> asyncReadBlocking(Reactor &reactor, ConditionalBufferedStream &stream,
+                                              int condition_fd) {
+        while (true) {
+            auto segments = stream.readBatch(condition_fd, 1);
+            if (!segments.empty()) {
+                co_return std::move(segments.front());
+            }
+            // the eventfd may be set without segments left, e.g. after a concurrent readAll
+            co_await readable(reactor, condition_fd);
+        }
+    }
+}
@@ -0,0 +1,144 @@
+#include <cerrno>
+#include <cstring>
+#include "socket_wrapper/FrameFormat.h"
+#include "socket_wrapper/SocketException.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace socket_wrapper {
+    size_t const FrameFormat::kMaxHeaderSize;
+    size_t const FrameFormat::kChecksumSize;
+
+    namespace {
+        uint32_t const kCrc32cPolynomial = 0x82f63b78; // reflected
+
+        /**
+         * the tables of the slicing-by-8 algorithm, table[k][b] is the CRC of byte b followed by k zero bytes
+         */
+        struct Crc32cTables {
+            uint32_t table[8][256];
+
+            Crc32cTables() {
+                for (uint32_t b = 0; b < 256; b++) {
+                    uint32_t crc = b;
+                    for (int bit = 0; bit < 8; bit++) {
+                        crc = (crc >> 1) ^ (kCrc32cPolynomial & (0 - (crc & 1)));
+                    }
+                    table[0][b] = crc;
+                }
+                for (uint32_t b = 0; b < 256; b++) {
+                    for (int k = 1; k < 8; k++) {
+                        table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+                    }
+                }
+            }
+        };
+
+        uint32_t crc32cSoftware(uint32_t crc, const unsigned char *data, size_t size) {
+            static const Crc32cTables tables;
+            auto &t = tables.table;
+            while (size >= 8) {
+                uint32_t low = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t) data[3] << 24);
+                crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+                      t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+                data += 8;
+                size -= 8;
+            }
+            while (size--) {
+                crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xff];
+            }
+            return crc;
+        }
+
+#if defined(__x86_64__)
+
+        __attribute__((target("sse4.2")))
+        uint32_t crc32cHardware(uint32_t crc, const unsigned char *data, size_t size) {
+            uint64_t crc64 = crc;
+            while (size >= 8) {
+                uint64_t value;
+                memcpy(&value, data, sizeof(value));
+                crc64 = _mm_crc32_u64(crc64, value);
+                data += 8;
+                size -= 8;
+            }
+            crc = (uint32_t) crc64;
+            while (size--) {
+                crc = _mm_crc32_u8(crc, *data++);
+            }
+            return crc;
+        }
+
+#endif
+
+        using crc32c_implementation = uint32_t (*)(uint32_t, const unsigned char *, size_t);
+
+        crc32c_implementation selectCrc32c() {
+#if defined(__x86_64__)
+            if (__builtin_cpu_supports("sse4.2")) {
+                return crc32cHardware;
+            }
+#endif
+            return crc32cSoftware;
+        }
+    }
+
+    bool decodeFrameHeader(const FrameFormat &format, const char *data, size_t size, size_t &header_size,
+                           uint64_t &payload_size) {
+        auto bytes = (const unsigned char *) data;
+        payload_size = 0;
+        if (format.length_encoding == FrameFormat::LENGTH_VARINT) {
+            for (header_size = 0; header_size < size; header_size++) {
+                if (header_size == FrameFormat::kMaxHeaderSize) {
+                    throw SocketException(SocketException::SOCKET_INVALID_FRAME, EBADMSG);
+                }
+                payload_size |= (uint64_t) (bytes[header_size] & 0x7f) << (7 * header_size);
+                if ((bytes[header_size] & 0x80) == 0) {
+                    header_size++;
+                    break;
+                }
+            }
+            if (header_size == 0 || (bytes[header_size - 1] & 0x80) != 0) {
+                return false;
+            }
+        } else {
+            header_size = format.length_bytes;
+            if (size < header_size) {
+                return false;
+            }
+            for (size_t i = 0; i < header_size; i++) {
+                size_t shift = 8 * (format.big_endian ? header_size - 1 - i : i);
+                payload_size |= (uint64_t) bytes[i] << shift;
+            }
+        }
+        if (payload_size > format.max_frame_size) {
+            throw SocketException(SocketException::SOCKET_INVALID_FRAME, EMSGSIZE);
+        }
+        return true;
+    }
+
+    size_t encodeFrameHeader(const FrameFormat &format, uint64_t payload_size, char *header) {
+        auto bytes = (unsigned char *) header;
+        if (format.length_encoding == FrameFormat::LENGTH_VARINT) {
+            size_t header_size = 0;
+            do {
+                bytes[header_size] = (payload_size & 0x7f) | (payload_size > 0x7f ? 0x80 : 0);
+                payload_size >>= 7;
+                header_size++;
+            } while (payload_size > 0);
+            return header_size;
+        }
+        for (size_t i = 0; i < format.length_bytes; i++) {
+            size_t shift = 8 * (format.big_endian ? format.length_bytes - 1 - i : i);
+            bytes[i] = (payload_size >> shift) & 0xff;
+        }
+        return format.length_bytes;
+    }
+
+    uint32_t crc32c(const char *data, size_t size, uint32_t previous) {
+        static const crc32c_implementation implementation = selectCrc32c();
+        return ~implementation(~previous, (const unsigned char *) data, size);
+    }
+}
@@ -0,0 +1,299 @@
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/poll.h>
+#include <unistd.h>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <atomic>
+#include <memory>
+#include "socket_wrapper/IoBackend.h"
+
+namespace socket_wrapper {
+    namespace {
+        std::atomic<IO_BACKEND> selected_backend{IO_BACKEND_POLL};
+        // the ring of the current thread, created on first use
+        thread_local std::unique_ptr<IoUring> thread_ring;
+        thread_local bool thread_ring_failed = false;
+
+        // user_data tags, the lower two bits distinguish the requests belonging to one operation
+        uint64_t const kIgnoredTag = 0;
+        uint64_t const kOperationTag = 1;
+        uint64_t const kStopPollTag = 2;
+
+        int ioUringSetup(unsigned entries, io_uring_params *params) {
+            return (int) syscall(__NR_io_uring_setup, entries, params);
+        }
+
+        int ioUringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+            return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+        }
+
+        int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+            return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+        }
+    }
+
+    IO_BACKEND setIoBackend(IO_BACKEND backend) {
+        if (backend == IO_BACKEND_IO_URING && !IoUring::isSupported()) {
+            backend = IO_BACKEND_POLL;
+        }
+        selected_backend.store(backend);
+        return backend;
+    }
+
+    IO_BACKEND getIoBackend() {
+        return selected_backend.load();
+    }
+
+    bool IoUring::isSupported() {
+        static const bool supported = []() {
+            io_uring_params params{};
+            int fd = ioUringSetup(kRingEntries, &params);
+            if (fd < 0) {
+                return false;
+            }
+            size_t probe_size = sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op);
+            std::vector<char> probe_buffer(probe_size, 0);
+            auto probe = (io_uring_probe *) probe_buffer.data();
+            bool result = ioUringRegister(fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0;
+            for (int op: {IORING_OP_RECV, IORING_OP_RECVMSG, IORING_OP_ACCEPT, IORING_OP_LINK_TIMEOUT,
+                          IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL}) {
+                result = result && op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+            }
+            ::close(fd);
+            return result;
+        }();
+        return supported;
+    }
+
+    IoUring *IoUring::forCurrentThread() {
+        if (selected_backend.load(std::memory_order_relaxed) != IO_BACKEND_IO_URING) {
+            return nullptr;
+        }
+        if (thread_ring && thread_ring->unusable) {
+            return nullptr; // the ring was torn down after io_uring_enter kept failing, use poll on this thread
+        }
+        if (!thread_ring && !thread_ring_failed) {
+            try {
+                thread_ring = std::unique_ptr<IoUring>(new IoUring());
+            } catch (std::exception &) {
+                thread_ring_failed = true; // e.g. the memlock limit was reached, use poll on this thread
+            }
+        }
+        return thread_ring.get();
+    }
+
+    IoUring::IoUring() {
+        io_uring_params params{};
+        ring_fd = ioUringSetup(kRingEntries, &params);
+        if (ring_fd < 0) {
+            throw std::runtime_error("Failed to create io_uring");
+        }
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+        sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                       IORING_OFF_SQ_RING);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            cq_ring = sq_ring;
+        } else if (sq_ring != MAP_FAILED) {
+            cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                           IORING_OFF_CQ_RING);
+        }
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe *) mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                     ring_fd, IORING_OFF_SQES);
+        if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+            int error = errno;
+            unmap();
+            throw std::runtime_error(std::string("Failed to map io_uring errno=") + std::strerror(error));
+        }
+        auto sq = (char *) sq_ring;
+        sq_head = (unsigned *) (sq + params.sq_off.head);
+        sq_tail = (unsigned *) (sq + params.sq_off.tail);
+        sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+        sq_array = (unsigned *) (sq + params.sq_off.array);
+        sq_entries = params.sq_entries;
+        auto cq = (char *) cq_ring;
+        cq_head = (unsigned *) (cq + params.cq_off.head);
+        cq_tail = (unsigned *) (cq + params.cq_off.tail);
+        cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe *) (cq + params.cq_off.cqes);
+    }
+
+    IoUring::~IoUring() noexcept {
+        unmap();
+    }
+
+    void IoUring::unmap() noexcept {
+        if (sqes != nullptr && sqes != MAP_FAILED) {
+            munmap(sqes, sqes_size);
+        }
+        if (cq_ring != nullptr && cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+            munmap(cq_ring, cq_ring_size);
+        }
+        if (sq_ring != nullptr && sq_ring != MAP_FAILED) {
+            munmap(sq_ring, sq_ring_size);
+        }
+        if (ring_fd >= 0) {
+            ::close(ring_fd); // cancels all outstanding requests
+        }
+        sqes = nullptr;
+        cq_ring = sq_ring = nullptr;
+        ring_fd = -1;
+    }
+
+    ssize_t IoUring::recv(int fd, char *buffer, size_t len, int stop_fd, int timeout_ms) {
+        io_uring_sqe operation{};
+        operation.opcode = IORING_OP_RECV;
+        operation.fd = fd;
+        operation.addr = (uint64_t) buffer;
+        operation.len = (uint32_t) std::min<size_t>(len, UINT32_MAX);
+        return submitAndWait(operation, stop_fd, timeout_ms);
+    }
+
+    ssize_t IoUring::recvmsg(int fd, msghdr *msg, int stop_fd, int timeout_ms) {
+        io_uring_sqe operation{};
+        operation.opcode = IORING_OP_RECVMSG;
+        operation.fd = fd;
+        operation.addr = (uint64_t) msg;
+        operation.len = 1;
+        return submitAndWait(operation, stop_fd, timeout_ms);
+    }
+
+    int IoUring::accept(int fd, sockaddr *addr, socklen_t *addr_length, int stop_fd, int timeout_ms) {
+        io_uring_sqe operation{};
+        operation.opcode = IORING_OP_ACCEPT;
+        operation.fd = fd;
+        operation.addr = (uint64_t) addr;
+        operation.addr2 = (uint64_t) addr_length;
+        return submitAndWait(operation, stop_fd, timeout_ms);
+    }
+
+    int IoUring::submitAndWait(io_uring_sqe &operation, int stop_fd, int timeout_ms) {
+        uint64_t base_tag = (++sequence) << 2;
+        while (!pending_cancels.empty()) {
+            io_uring_sqe *cancel = nextSqe();
+            if (cancel == nullptr) {
+                return -errno; // nothing of this operation was queued yet
+            }
+            cancel->opcode = IORING_OP_ASYNC_CANCEL;
+            cancel->addr = pending_cancels.back();
+            cancel->user_data = kIgnoredTag;
+            pending_cancels.pop_back();
+        }
+        // the operation and its linked timeout have to be queued together
+        if (!reserveSqes(1 + (timeout_ms >= 0 ? 1 : 0) + (stop_fd >= 0 ? 1 : 0))) {
+            return -errno;
+        }
+
+        io_uring_sqe *op = nextSqe();
+        *op = operation;
+        op->user_data = base_tag | kOperationTag;
+        // the timespec is read by the kernel during submission
+        __kernel_timespec timeout = {.tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000LL};
+        if (timeout_ms >= 0) {
+            op->flags |= IOSQE_IO_LINK;
+            io_uring_sqe *link_timeout = nextSqe();
+            link_timeout->opcode = IORING_OP_LINK_TIMEOUT;
+            link_timeout->addr = (uint64_t) &timeout;
+            link_timeout->len = 1;
+            link_timeout->user_data = kIgnoredTag;
+        }
+        bool stop_poll_pending = false;
+        if (stop_fd >= 0) {
+            io_uring_sqe *stop_poll = nextSqe();
+            stop_poll->opcode = IORING_OP_POLL_ADD;
+            stop_poll->fd = stop_fd;
+            stop_poll->poll32_events = POLLIN;
+            stop_poll->user_data = base_tag | kStopPollTag;
+            stop_poll_pending = true;
+        }
+
+        bool terminated = false;
+        bool operation_done = false;
+        bool cancel_queued = false; // the cancel of the operation is queued, or was submitted
+        bool cancel_wanted = false;
+        int enter_error = 0; // set once io_uring_enter failed, the operation is cancelled then
+        int enter_failures = 0;
+        int result = 0;
+        while (!operation_done) {
+            if (cancel_wanted && !cancel_queued) {
+                // the previous io_uring_enter consumed the queued entries, so there is room unless it failed
+                io_uring_sqe *cancel = nextSqe();
+                if (cancel != nullptr) {
+                    cancel->opcode = IORING_OP_ASYNC_CANCEL;
+                    cancel->addr = base_tag | kOperationTag;
+                    cancel->user_data = kIgnoredTag;
+                    cancel_queued = true;
+                }
+            }
+            unsigned to_submit = *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+            if (ioUringEnter(ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+                // the operation still points at the caller's buffer, so it has to finish before we return
+                enter_error = errno;
+                cancel_wanted = true;
+                if ((enter_error != EBUSY && enter_error != EAGAIN) || ++enter_failures > kMaxEnterFailures) {
+                    // the operation can not be waited for, tear the ring down, closing it cancels the operation
+                    // before the caller's buffer and the timespec go away
+                    unmap();
+                    unusable = true;
+                    return -enter_error;
+                }
+            }
+            unsigned head = *cq_head;
+            while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+                io_uring_cqe &cqe = cqes[head & *cq_mask];
+                if (cqe.user_data == (base_tag | kOperationTag)) {
+                    operation_done = true;
+                    result = cqe.res;
+                } else if (cqe.user_data == (base_tag | kStopPollTag)) {
+                    stop_poll_pending = false;
+                    terminated = cqe.res > 0;
+                    cancel_wanted = cancel_wanted || terminated;
+                } // anything else belongs to earlier operations
+                head++;
+            }
+            // reaping completions makes room for those which overflowed (EBUSY)
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        }
+        if (stop_poll_pending) {
+            pending_cancels.push_back(base_tag | kStopPollTag);
+        }
+        if (result == -ECANCELED || result == -EINTR) {
+            // cancelled either through the termination request, a failed io_uring_enter or the linked timeout
+            return terminated ? kTerminated : enter_error != 0 ? -enter_error : kTimedOut;
+        }
+        return result;
+    }
+
+    bool IoUring::reserveSqes(unsigned count) {
+        while (sq_entries - (*sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE)) < count) {
+            // submit the queued entries (e.g. cancels) instead of overwriting them
+            unsigned to_submit = *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+            if (ioUringEnter(ring_fd, to_submit, 0, 0) < 0 && errno != EINTR) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    io_uring_sqe *IoUring::nextSqe() {
+        if (!reserveSqes(1)) {
+            return nullptr;
+        }
+        unsigned tail = *sq_tail;
+        unsigned index = tail & *sq_mask;
+        sq_array[index] = index;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        return sqe;
+    }
+}
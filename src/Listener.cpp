@@ -4,20 +4,18 @@
 #include <iostream>
 #include <unistd.h>
 #include <sys/poll.h>
-#include <sys/eventfd.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
 #include "socket_wrapper/Listener.h"
 #include "socket_wrapper/SocketException.h"
+#include "socket_wrapper/IoBackend.h"
+#include "socket_wrapper/UnixSocket.h"
 #include "unistd.h"
 
 namespace socket_wrapper {
-    ListenerBase::ListenerBase(int port, IP_VERSION version) : stopped_accepting{false} {
+    ListenerBase::ListenerBase(int port, IP_VERSION version, const StreamOptions &options) : stopped_accepting{false},
+                                                                                             accepted_stream_options(options) {
         auto ip_v = (version == IP_VERSION::IPv6) ? AF_INET6 : AF_INET;
-        // create the end programm listener
-        listener_end_fd.store(eventfd(0, EFD_SEMAPHORE));
-        if (listener_end_fd.load() == -1) {
-            throw std::runtime_error("Failed to create event_fd");
-        }
         // create the socket, we do not want it to block as we use poll TODO: currently blocking, does poll'ing itself suffice?
         listener_socket_fd.store(socket(ip_v, SOCK_STREAM, IPPROTO_TCP));
         if (listener_socket_fd.load() < 0) {
@@ -64,6 +62,13 @@ namespace socket_wrapper {
             }
         }
 
+        // buffer sizes have to be set before listening to be inherited with the right window scaling
+        try {
+            applyStreamOptions(listener_socket_fd.load(), accepted_stream_options);
+        } catch (SocketException &) {
+            ::close(listener_socket_fd.load()); // the destructor does not run for a failed constructor
+            throw;
+        }
         // listen for connection requests
         if ((listen(listener_socket_fd.load(), 5)) != 0) {
             throw SocketException(SocketException::SOCKET_LISTEN, errno);
@@ -82,10 +87,12 @@ namespace socket_wrapper {
             while (true) {
                 // use poll to find out if there are any waiting clients
                 std::array<pollfd, 2> poll_fds = {{{.fd = listener_socket_fd.load(), .events = POLLIN, .revents = 0},
-                                                   {.fd = listener_end_fd, .events = POLLIN, .revents = 0}}};
+                                                   {.fd = cancellation_domain->getFdForPoll(), .events = POLLIN, .revents = 0}}};
                 if (poll(poll_fds.data(), poll_fds.size(), -1) == -1) {
                     // error while polling
                     continue;
+                } else if (stop_requested.load()) {
+                    return; // Listener termination request, the socket was shut down
                 } else if (poll_fds[0].revents != 0) {
                     // new client
                     int connecting_fd;
@@ -97,7 +104,9 @@ namespace socket_wrapper {
                     } else {
                         // accepted new client
                         try {
-                            onIncomingStream(Stream(connecting_fd));
+                            Stream incoming_stream(connecting_fd, cancellation_domain);
+                            incoming_stream.setOptions(accepted_stream_options);
+                            onIncomingStream(std::move(incoming_stream));
                         } catch (const std::exception &e) {
                             std::cout << "Listener: exception onIncomingStream " << +e.what() << " was thrown "
                                       << std::endl;
@@ -121,8 +130,8 @@ namespace socket_wrapper {
 
     void ListenerBase::stopAccepting() {
         if (!stopped_accepting.load()) {
-            uint64_t semaphore_value = std::numeric_limits<uint16_t>::max();
-            write(listener_end_fd, &semaphore_value, sizeof(semaphore_value));
+            stop_requested.store(true);
+            wakeUpBlockedOperations(listener_socket_fd.load());
             if (handle_incoming_streams_task.joinable()) {
                 handle_incoming_streams_task.join();
             }
@@ -132,24 +141,65 @@ namespace socket_wrapper {
         }
     }
 
+    void ListenerBase::setCancellationDomain(std::shared_ptr<CancellationDomain> domain) {
+        cancellation_domain = std::move(domain);
+    }
+
     Stream Listener::accept(int timeout) {
+        if (stop_requested.load() || cancellation_domain->isCancelled()) {
+            throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+        }
+        IoUring *ring = IoUring::forCurrentThread();
+        if (ring != nullptr) {
+            // wait for and accept the connection with a single submission
+            struct sockaddr incoming_stream_addr;
+            socklen_t incoming_stream_addr_length = sizeof(sockaddr);
+            int connecting_fd = ring->accept(listener_socket_fd.load(), &incoming_stream_addr,
+                                             &incoming_stream_addr_length, cancellation_domain->getFdForPoll(),
+                                             timeout);
+            if (stats) {
+                Stats::add(stats->accept_syscalls);
+            }
+            if (connecting_fd == IoUring::kTerminated || (connecting_fd < 0 && stop_requested.load())) {
+                throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+            } else if (connecting_fd < 0) {
+                throw SocketException(SocketException::SOCKET_ACCEPT,
+                                      connecting_fd == IoUring::kTimedOut ? ETIMEDOUT : -connecting_fd);
+            }
+            Stream incoming_stream(connecting_fd, cancellation_domain);
+            incoming_stream.setOptions(accepted_stream_options);
+            return incoming_stream;
+        }
 
         std::array<pollfd, 2> poll_fds = {{{.fd = listener_socket_fd.load(), .events = POLLIN, .revents = 0},
-                                           {.fd = listener_end_fd, .events = POLLIN, .revents = 0}}};
-        if (poll(poll_fds.data(), poll_fds.size(), timeout) == -1) {
+                                           {.fd = cancellation_domain->getFdForPoll(), .events = POLLIN, .revents = 0}}};
+        int poll_result = poll(poll_fds.data(), poll_fds.size(), timeout);
+        if (stats) {
+            Stats::add(stats->poll_syscalls);
+        }
+        if (poll_result == -1) {
             // error while polling
             throw SocketException(SocketException::SOCKET_POLL, errno);
+        } else if (stop_requested.load()) {
+            // the socket was shut down by stopAccepting
+            throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+        } else if (poll_result == 0) {
+            throw SocketException(SocketException::SOCKET_ACCEPT, ETIMEDOUT);
         } else if (poll_fds[0].revents != 0) {
             // new client
             int connecting_fd;
             struct sockaddr incoming_stream_addr;
             socklen_t incoming_stream_addr_length = sizeof(sockaddr);
-            if ((connecting_fd = ::accept(listener_socket_fd.load(), &incoming_stream_addr,
-                                        &incoming_stream_addr_length)) < 0) {
+            connecting_fd = ::accept(listener_socket_fd.load(), &incoming_stream_addr, &incoming_stream_addr_length);
+            if (stats) {
+                Stats::add(stats->accept_syscalls);
+            }
+            if (connecting_fd < 0) {
                 throw SocketException(SocketException::SOCKET_ACCEPT, errno);
             } else {
-                return Stream(connecting_fd);
-
+                Stream incoming_stream(connecting_fd, cancellation_domain);
+                incoming_stream.setOptions(accepted_stream_options);
+                return incoming_stream;
             }
         } else if (poll_fds[1].revents != 0) {
             throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, errno);
@@ -157,9 +207,9 @@ namespace socket_wrapper {
         throw SocketException(SocketException::SOCKET_ACCEPT, errno);
     }
 
-    Listener::Listener(int port, IP_VERSION version, bool reuse) {
+    Listener::Listener(int port, IP_VERSION version, bool reuse, const StreamOptions &options)
+            : accepted_stream_options(options) {
         auto ip_v = (version == IP_VERSION::IPv6) ? AF_INET6 : AF_INET;
-        listener_end_fd.store(eventfd(0, EFD_SEMAPHORE));
         stopped_accepting.store(false);
         // create the socket, we do not want it to block as we use poll
         listener_socket_fd.store(socket(ip_v, SOCK_STREAM, IPPROTO_TCP));
@@ -213,21 +263,105 @@ namespace socket_wrapper {
                 throw SocketException(SocketException::SOCKET_BIND, errno);
             }
         }
+        // buffer sizes have to be set before listening to be inherited with the right window scaling
+        try {
+            applyStreamOptions(listener_socket_fd.load(), accepted_stream_options);
+        } catch (SocketException &) {
+            ::close(listener_socket_fd.load()); // the destructor does not run for a failed constructor
+            throw;
+        }
         // listen for connection requests
         if ((listen(listener_socket_fd.load(), 5)) != 0) {
             throw SocketException(SocketException::SOCKET_LISTEN, errno);
         }
     }
 
+    namespace {
+        /**
+         * removes the socket file at path if no one listens on it anymore (e.g. left behind by a crashed process)
+         * @throws SocketException SOCKET_BIND with EADDRINUSE if path is not a socket or still in use
+         */
+        void removeStaleSocketFile(const std::string &path, const sockaddr_un &address, socklen_t address_length) {
+            struct stat file_status;
+            if (::lstat(path.c_str(), &file_status) != 0) {
+                return; // nothing there, or bind reports why it can not be created
+            }
+            if (!S_ISSOCK(file_status.st_mode)) {
+                throw SocketException(SocketException::SOCKET_BIND, EADDRINUSE);
+            }
+            int probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (probe_fd < 0) {
+                throw SocketException(SocketException::SOCKET_SOCKET, errno);
+            }
+            // only a socket without a listener refuses the connection
+            bool stale = ::connect(probe_fd, (sockaddr *) &address, address_length) != 0 && errno == ECONNREFUSED;
+            ::close(probe_fd);
+            if (!stale) {
+                throw SocketException(SocketException::SOCKET_BIND, EADDRINUSE);
+            }
+            ::unlink(path.c_str());
+        }
+    }
+
+    Listener::Listener(const std::string &path, const StreamOptions &options) : accepted_stream_options(options) {
+        stopped_accepting.store(false);
+        sockaddr_un servaddr;
+        socklen_t servaddr_length = toUnixAddress(path, servaddr, SocketException::SOCKET_BIND);
+        if (!isAbstractUnixPath(path)) {
+            // a socket file can not be bound twice, remove the one left behind by an earlier Listener
+            removeStaleSocketFile(path, servaddr, servaddr_length);
+        }
+        listener_socket_fd.store(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        if (listener_socket_fd.load() < 0) {
+            throw SocketException(SocketException::SOCKET_SOCKET, errno);
+        }
+        // bind socket to address
+        if (bind(listener_socket_fd.load(), (sockaddr *) &servaddr, servaddr_length) != 0) {
+            int error = errno;
+            ::close(listener_socket_fd.load());
+            throw SocketException(SocketException::SOCKET_BIND, error);
+        }
+        if (!isAbstractUnixPath(path)) {
+            unix_path = path;
+        }
+        try {
+            applyStreamOptions(listener_socket_fd.load(), accepted_stream_options);
+        } catch (SocketException &) {
+            stopAccepting();
+            throw;
+        }
+        // listen for connection requests
+        if ((listen(listener_socket_fd.load(), SOMAXCONN)) != 0) {
+            int error = errno;
+            stopAccepting();
+            throw SocketException(SocketException::SOCKET_LISTEN, error);
+        }
+    }
+
     void Listener::stopAccepting() {
         if (!stopped_accepting.load()) {
-            uint64_t semaphore_value = std::numeric_limits<uint16_t>::max();
-            write(listener_end_fd, &semaphore_value, sizeof(semaphore_value));
+            stop_requested.store(true);
+            wakeUpBlockedOperations(listener_socket_fd.load());
             ::close(listener_socket_fd.load());
+            if (!unix_path.empty()) {
+                ::unlink(unix_path.c_str());
+            }
             stopped_accepting.store(true);
         }
     }
 
+    void Listener::enableStats(std::shared_ptr<Stats> shared_stats) {
+        stats = std::move(shared_stats);
+    }
+
+    StatsSnapshot Listener::getStats() {
+        return stats ? stats->snapshot() : Stats().snapshot();
+    }
+
+    void Listener::setCancellationDomain(std::shared_ptr<CancellationDomain> domain) {
+        cancellation_domain = std::move(domain);
+    }
+
     Listener::~Listener() noexcept {
         stopAccepting();
     }
@@ -235,4 +369,8 @@ namespace socket_wrapper {
     int Listener::getFdForPoll() {
         return listener_socket_fd;
     }
+
+    StreamOptions Listener::getOptions() {
+        return getEffectiveStreamOptions(listener_socket_fd);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,285 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+#include <array>
+#include "socket_wrapper/Reactor.h"
+#include "socket_wrapper/Stream.h"
+#include "socket_wrapper/Listener.h"
+#include "socket_wrapper/UdpDatagram.h"
+#include "socket_wrapper/SocketException.h"
+
+namespace socket_wrapper {
+    namespace {
+        // the hook executed by the current worker, so a hook removing itself does not wait for itself
+        thread_local const void *executing_hook = nullptr;
+        // likewise the registration whose callback the current worker executes
+        thread_local const void *executing_registration = nullptr;
+    }
+
+    Reactor::Reactor(size_t worker_count) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd == -1) {
+            throw SocketException(SocketException::SOCKET_POLL, errno);
+        }
+        stop_event_fd = eventfd(0, EFD_NONBLOCK);
+        if (stop_event_fd == -1) {
+            ::close(epoll_fd);
+            throw std::runtime_error("Failed to create event_fd");
+        }
+        wakeup_event_fd = eventfd(0, EFD_NONBLOCK);
+        if (wakeup_event_fd == -1) {
+            ::close(stop_event_fd);
+            ::close(epoll_fd);
+            throw std::runtime_error("Failed to create event_fd");
+        }
+        // the stop event is level triggered, so every worker sees it, a wakeup is edge triggered and wakes one worker
+        epoll_event stop_event = {.events = EPOLLIN, .data = {.fd = stop_event_fd}};
+        epoll_event wakeup_event = {.events = EPOLLIN | EPOLLET, .data = {.fd = wakeup_event_fd}};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_event_fd, &stop_event) == -1 ||
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_event_fd, &wakeup_event) == -1) {
+            int error = errno;
+            ::close(wakeup_event_fd);
+            ::close(stop_event_fd);
+            ::close(epoll_fd);
+            throw SocketException(SocketException::SOCKET_POLL, error);
+        }
+        for (size_t i = 0; i < std::max<size_t>(worker_count, 1); i++) {
+            workers.emplace_back([this]() { worker(); });
+        }
+    }
+
+    Reactor::~Reactor() noexcept {
+        stop();
+        ::close(wakeup_event_fd);
+        ::close(stop_event_fd);
+        ::close(epoll_fd);
+    }
+
+    void Reactor::add(int fd, readiness_callback on_readable, readiness_callback on_writable) {
+        // edge triggered operation requires non blocking file descriptors
+        int flags = fcntl(fd, F_GETFL);
+        if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+            throw SocketException(SocketException::SOCKET_SET_OPTION, errno);
+        }
+        auto r = std::make_shared<registration>(registration{.fd = fd, .on_readable = std::move(on_readable),
+                                                             .on_writable = std::move(on_writable),
+                                                             .removed = false, .running = 0});
+        std::lock_guard<std::mutex> lk(registrations_mtx);
+        epoll_event event = {.events = eventMaskFor(*r), .data = {.fd = fd}};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            throw SocketException(SocketException::SOCKET_POLL, errno);
+        }
+        registrations[fd] = r;
+    }
+
+    void Reactor::add(Stream &stream, readiness_callback on_readable, readiness_callback on_writable) {
+        add(stream.getFdForPoll(), std::move(on_readable), std::move(on_writable));
+    }
+
+    void Reactor::add(Listener &listener, readiness_callback on_readable) {
+        add(listener.getFdForPoll(), std::move(on_readable));
+    }
+
+    void Reactor::add(UdpDatagram &datagram, readiness_callback on_readable) {
+        add(datagram.getFdForPoll(), std::move(on_readable));
+    }
+
+    void Reactor::remove(int fd) {
+        std::unique_lock<std::mutex> lk(registrations_mtx);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        auto it = registrations.find(fd);
+        if (it == registrations.end()) {
+            return;
+        }
+        auto r = it->second;
+        r->removed = true;
+        registrations.erase(it);
+        int own_executions = executing_registration == r.get() ? 1 : 0;
+        callback_finished.wait(lk, [&]() { return r->running == own_executions; });
+    }
+
+    size_t Reactor::addIterationHook(iteration_hook hook, int interval_ms) {
+        std::lock_guard<std::mutex> lk(hooks_mtx);
+        size_t hook_id = next_hook_id++;
+        hooks[hook_id] = std::make_shared<hook_registration>(
+                hook_registration{.hook = std::move(hook), .interval_ms = interval_ms, .removed = false, .running = 0});
+        has_hooks = true;
+        int timeout_ms = wait_timeout_ms;
+        if (interval_ms >= 0 && (timeout_ms == -1 || interval_ms < timeout_ms)) {
+            wait_timeout_ms = interval_ms;
+            // a worker blocked without timeout would not run the hook before the next event
+            uint64_t wakeup_value = 1;
+            ::write(wakeup_event_fd, &wakeup_value, sizeof(wakeup_value));
+        }
+        return hook_id;
+    }
+
+    void Reactor::removeIterationHook(size_t hook_id) {
+        std::unique_lock<std::mutex> lk(hooks_mtx);
+        auto it = hooks.find(hook_id);
+        if (it == hooks.end()) {
+            return;
+        }
+        auto h = it->second;
+        h->removed = true;
+        hooks.erase(it);
+        hooksChanged();
+        int own_executions = executing_hook == h.get() ? 1 : 0;
+        hook_finished.wait(lk, [&]() { return h->running == own_executions; });
+    }
+
+    void Reactor::hooksChanged() {
+        has_hooks = !hooks.empty();
+        int timeout_ms = -1;
+        for (auto &h: hooks) {
+            if (h.second->interval_ms >= 0 && (timeout_ms == -1 || h.second->interval_ms < timeout_ms)) {
+                timeout_ms = h.second->interval_ms;
+            }
+        }
+        // a longer timeout is picked up after the current wait
+        wait_timeout_ms = timeout_ms;
+    }
+
+    void Reactor::stop() {
+        if (stopped.exchange(true)) {
+            return;
+        }
+        uint64_t stop_value = 1;
+        ::write(stop_event_fd, &stop_value, sizeof(stop_value));
+        for (auto &w: workers) {
+            if (w.joinable()) {
+                w.join();
+            }
+        }
+    }
+
+    void Reactor::worker() {
+        std::array<epoll_event, kMaxEventsPerWait> events{};
+        std::vector<std::shared_ptr<hook_registration>> running_hooks;
+        while (true) {
+            int event_count = epoll_wait(epoll_fd, events.data(), events.size(), wait_timeout_ms);
+            if (event_count == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cout << "Reactor: epoll_wait failed with errno " << errno << std::endl;
+                return;
+            }
+            for (int i = 0; i < event_count; i++) {
+                if (events[i].data.fd == stop_event_fd) {
+                    return;
+                }
+                if (events[i].data.fd == wakeup_event_fd) {
+                    uint64_t wakeup_value;
+                    ::read(wakeup_event_fd, &wakeup_value, sizeof(wakeup_value));
+                    continue;
+                }
+                dispatch(events[i].data.fd, events[i].events);
+            }
+            if (has_hooks) {
+                runIterationHooks(running_hooks);
+            }
+        }
+    }
+
+    void Reactor::runIterationHooks(std::vector<std::shared_ptr<hook_registration>> &running) {
+        {
+            std::lock_guard<std::mutex> lk(hooks_mtx);
+            for (auto &h: hooks) {
+                running.push_back(h.second);
+            }
+        }
+        for (auto &h: running) {
+            {
+                std::lock_guard<std::mutex> lk(hooks_mtx);
+                if (h->removed) {
+                    continue; // removed after the snapshot was taken
+                }
+                h->running++;
+            }
+            bool failed = false;
+            executing_hook = h.get();
+            try {
+                h->hook();
+            } catch (const std::exception &e) {
+                std::cout << "Reactor: iteration hook threw " << e.what() << ", removing it" << std::endl;
+                failed = true;
+            }
+            executing_hook = nullptr;
+            std::lock_guard<std::mutex> lk(hooks_mtx);
+            h->running--;
+            if (failed && !h->removed) {
+                h->removed = true;
+                for (auto it = hooks.begin(); it != hooks.end(); ++it) {
+                    if (it->second == h) {
+                        hooks.erase(it);
+                        break;
+                    }
+                }
+                hooksChanged();
+            }
+            if (h->removed) {
+                hook_finished.notify_all();
+            }
+        }
+        running.clear();
+    }
+
+    void Reactor::dispatch(int fd, uint32_t events) {
+        std::shared_ptr<registration> r;
+        {
+            std::lock_guard<std::mutex> lk(registrations_mtx);
+            auto it = registrations.find(fd);
+            if (it == registrations.end()) {
+                return; // removed while the event was pending
+            }
+            r = it->second;
+            r->running++;
+        }
+        bool failed = false;
+        executing_registration = r.get();
+        try {
+            if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && r->on_readable) {
+                r->on_readable();
+            }
+            if ((events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && r->on_writable) {
+                r->on_writable();
+            }
+        } catch (const std::exception &e) {
+            std::cout << "Reactor: callback for fd " << fd << " threw " << e.what() << ", removing it" << std::endl;
+            failed = true;
+        }
+        executing_registration = nullptr;
+        std::lock_guard<std::mutex> lk(registrations_mtx);
+        r->running--;
+        auto it = registrations.find(fd);
+        if (it != registrations.end() && it->second == r) {
+            if (failed) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+                r->removed = true;
+                registrations.erase(it);
+            } else {
+                // re-arm the one shot registration, it was not removed or replaced in the meantime
+                epoll_event event = {.events = eventMaskFor(*r), .data = {.fd = fd}};
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+            }
+        }
+        if (r->removed) {
+            callback_finished.notify_all();
+        }
+    }
+
+    uint32_t Reactor::eventMaskFor(const registration &r) {
+        // EPOLLONESHOT ensures a callback is only executed on one worker at a time
+        uint32_t mask = EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+        if (r.on_readable) {
+            mask |= EPOLLIN;
+        }
+        if (r.on_writable) {
+            mask |= EPOLLOUT;
+        }
+        return mask;
+    }
+}
@@ -0,0 +1,90 @@
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+#include "socket_wrapper/RingBuffer.h"
+
+namespace socket_wrapper {
+
+    RingBuffer::RingBuffer(size_t min_capacity) {
+        size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+        buffer_capacity = std::max<size_t>((min_capacity + page_size - 1) / page_size, 1) * page_size;
+        if (!mapTwice()) {
+            // e.g. the limit of open files or mappings was reached, fall back to a buffer which moves data
+            base = (char *) malloc(buffer_capacity);
+            if (base == nullptr) {
+                throw std::bad_alloc();
+            }
+        }
+    }
+
+    RingBuffer::RingBuffer(RingBuffer &&src) noexcept: base(std::exchange(src.base, nullptr)),
+                                                       buffer_capacity(src.buffer_capacity),
+                                                       head(src.head), used(src.used),
+                                                       double_mapped(src.double_mapped) {}
+
+    RingBuffer::~RingBuffer() noexcept {
+        if (base == nullptr) {
+            return;
+        }
+        if (double_mapped) {
+            munmap(base, 2 * buffer_capacity);
+        } else {
+            free(base);
+        }
+    }
+
+    bool RingBuffer::mapTwice() {
+        int memory_fd = memfd_create("socket_wrapper_ring", MFD_CLOEXEC);
+        if (memory_fd < 0) {
+            return false;
+        }
+        if (ftruncate(memory_fd, (off_t) buffer_capacity) != 0) {
+            ::close(memory_fd);
+            return false;
+        }
+        // reserve the address range of both halves, then map the memfd over each of them
+        auto reserved = (char *) mmap(nullptr, 2 * buffer_capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (reserved == MAP_FAILED) {
+            ::close(memory_fd);
+            return false;
+        }
+        bool mapped = true;
+        for (char *half: {reserved, reserved + buffer_capacity}) {
+            mapped = mapped && mmap(half, buffer_capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                                    memory_fd, 0) != MAP_FAILED;
+        }
+        ::close(memory_fd); // the mappings keep the memory alive
+        if (!mapped) {
+            munmap(reserved, 2 * buffer_capacity);
+            return false;
+        }
+        base = reserved;
+        double_mapped = true;
+        return true;
+    }
+
+    void RingBuffer::consume(size_t len) {
+        used -= len;
+        if (used == 0) {
+            head = 0; // keeps the next data at the front, in memory which is likely still cached
+        } else {
+            head += len;
+            if (double_mapped && head >= buffer_capacity) {
+                head -= buffer_capacity;
+            }
+        }
+    }
+
+    size_t RingBuffer::compact() {
+        if (double_mapped || head == 0) {
+            return 0;
+        }
+        memmove(base, base + head, used);
+        head = 0;
+        return used;
+    }
+}
@@ -0,0 +1,297 @@
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include "socket_wrapper/ShmChannel.h"
+#include "socket_wrapper/SocketException.h"
+
+namespace socket_wrapper {
+    namespace {
+        // the data of the rings starts on its own page
+        size_t const kDataOffset = 4096;
+
+        size_t roundUpToPowerOfTwo(size_t value) {
+            size_t result = 4096;
+            while (result < value) {
+                result <<= 1;
+            }
+            return result;
+        }
+
+        // copies between a ring and a linear buffer, the ring region may wrap around its end
+        void copyToRing(char *ring_data, uint64_t capacity, uint64_t position, const char *source, size_t len) {
+            size_t index = position & (capacity - 1);
+            size_t first_part = std::min<size_t>(len, capacity - index);
+            memcpy(ring_data + index, source, first_part);
+            memcpy(ring_data, source + first_part, len - first_part);
+        }
+
+        void copyFromRing(const char *ring_data, uint64_t capacity, uint64_t position, char *destination, size_t len) {
+            size_t index = position & (capacity - 1);
+            size_t first_part = std::min<size_t>(len, capacity - index);
+            memcpy(destination, ring_data + index, first_part);
+            memcpy(destination + first_part, ring_data, len - first_part);
+        }
+    }
+
+    std::unique_ptr<ShmChannel> ShmChannel::create(size_t capacity) {
+        static_assert(sizeof(SharedHeader) <= kDataOffset, "the shared header has to fit in front of the data");
+        capacity = roundUpToPowerOfTwo(capacity);
+        int memory_fd = memfd_create("socket_wrapper_shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (memory_fd < 0) {
+            throw SocketException(SocketException::SOCKET_SOCKET, errno);
+        }
+        // sealed, so the peer can not shrink the memory under the mappings (SIGBUS on access)
+        if (ftruncate(memory_fd, (off_t) (kDataOffset + 2 * capacity)) != 0 ||
+            fcntl(memory_fd, F_ADD_SEALS, kRequiredSeals) != 0) {
+            int error = errno;
+            ::close(memory_fd);
+            throw SocketException(SocketException::SOCKET_SOCKET, error);
+        }
+        std::array<int, 4> event_fds{-1, -1, -1, -1};
+        for (auto &event_fd: event_fds) {
+            event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (event_fd < 0) {
+                int error = errno;
+                ::close(memory_fd);
+                for (int fd: event_fds) {
+                    if (fd >= 0) {
+                        ::close(fd);
+                    }
+                }
+                throw SocketException(SocketException::SOCKET_SOCKET, error);
+            }
+        }
+        return std::unique_ptr<ShmChannel>(new ShmChannel(memory_fd, event_fds, 0));
+    }
+
+    std::array<std::unique_ptr<ShmChannel>, 2> ShmChannel::createPair(size_t capacity) {
+        auto first = create(capacity);
+        std::vector<int> peer_fds;
+        for (int fd: first->getFdsForPeer()) {
+            int duplicate = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+            if (duplicate < 0) {
+                int error = errno;
+                for (int d: peer_fds) {
+                    ::close(d);
+                }
+                throw SocketException(SocketException::SOCKET_SOCKET, error);
+            }
+            peer_fds.push_back(duplicate);
+        }
+        auto second = attach(peer_fds);
+        return {std::move(first), std::move(second)};
+    }
+
+    std::unique_ptr<ShmChannel> ShmChannel::attach(const std::vector<int> &fds) {
+        if (fds.size() != kFdCount) {
+            for (int fd: fds) {
+                ::close(fd);
+            }
+            throw SocketException(SocketException::SOCKET_SOCKET, EINVAL);
+        }
+        return std::unique_ptr<ShmChannel>(new ShmChannel(fds[0], {fds[1], fds[2], fds[3], fds[4]}, 1));
+    }
+
+    ShmChannel::ShmChannel(int memory_fd, std::array<int, 4> event_fds, int side) : memory_fd(memory_fd),
+                                                                                     event_fds(event_fds),
+                                                                                     side(side) {
+        struct stat memory_stat{};
+        int error = EINVAL;
+        int seals = fcntl(memory_fd, F_GET_SEALS);
+        if (fstat(memory_fd, &memory_stat) != 0) {
+            error = errno;
+        } else if (seals == -1 || (seals & kRequiredSeals) != kRequiredSeals) {
+            error = EPROTO; // the creator did not seal the memory, it could be truncated under the mapping
+        } else if ((size_t) memory_stat.st_size > kDataOffset) {
+            mapping_size = memory_stat.st_size;
+            void *mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd, 0);
+            if (mapping == MAP_FAILED) {
+                error = errno;
+            } else {
+                header = (SharedHeader *) mapping;
+            }
+        }
+        capacity = (mapping_size - kDataOffset) / 2;
+        if (header != nullptr && side == 0) {
+            // the memory of a new memfd is zeroed, so the rings start empty
+            new(header) SharedHeader{};
+            header->magic = kMagic;
+            header->capacity = capacity;
+        }
+        if (header == nullptr || header->magic != kMagic || header->capacity != capacity ||
+            (capacity & (capacity - 1)) != 0) {
+            if (header != nullptr) {
+                munmap(header, mapping_size);
+            }
+            closeFds();
+            throw SocketException(SocketException::SOCKET_SOCKET, error);
+        }
+        auto data = (char *) header + kDataOffset;
+        outbound = &header->rings[side];
+        inbound = &header->rings[1 - side];
+        outbound_data = data + side * capacity;
+        inbound_data = data + (1 - side) * capacity;
+    }
+
+    ShmChannel::~ShmChannel() noexcept {
+        // the peer sees the end of the data, and its pending writes fail
+        outbound->writer_closed.store(1, std::memory_order_seq_cst);
+        inbound->reader_closed.store(1, std::memory_order_seq_cst);
+        ring(event_fds[side * 2 + DOORBELL_DATA]);
+        ring(event_fds[(1 - side) * 2 + DOORBELL_SPACE]);
+        munmap(header, mapping_size);
+        closeFds();
+    }
+
+    void ShmChannel::closeFds() noexcept {
+        ::close(memory_fd);
+        for (int fd: event_fds) {
+            ::close(fd);
+        }
+    }
+
+    std::vector<int> ShmChannel::getFdsForPeer() const {
+        if (side != 0) {
+            throw std::logic_error("only the end created by ShmChannel::create can be passed to a peer");
+        }
+        return {memory_fd, event_fds[0], event_fds[1], event_fds[2], event_fds[3]};
+    }
+
+    ssize_t ShmChannel::writev(const iovec *buffers, size_t buffer_count) {
+        if (outbound->reader_closed.load(std::memory_order_acquire)) {
+            errno = EPIPE;
+            return -1;
+        }
+        uint64_t tail = outbound->tail.load(std::memory_order_relaxed);
+        uint64_t used_bytes = tail - outbound->head.load(std::memory_order_acquire);
+        if (used_bytes > capacity) {
+            // the positions are in memory the peer can write, do not copy past the ring
+            throw SocketException(SocketException::SOCKET_WRITE, EPROTO);
+        }
+        uint64_t free_bytes = capacity - used_bytes;
+        if (free_bytes == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        size_t written_bytes = 0;
+        for (size_t i = 0; i < buffer_count && written_bytes < free_bytes; i++) {
+            size_t len = std::min<size_t>(buffers[i].iov_len, free_bytes - written_bytes);
+            copyToRing(outbound_data, capacity, tail + written_bytes, (const char *) buffers[i].iov_base, len);
+            written_bytes += len;
+        }
+        outbound->tail.store(tail + written_bytes, std::memory_order_release);
+        // pairs with the fence in park, either the reader sees the data or we see it parked
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (outbound->reader_parked.load(std::memory_order_relaxed)) {
+            ring(event_fds[side * 2 + DOORBELL_DATA]);
+        }
+        return (ssize_t) written_bytes;
+    }
+
+    ssize_t ShmChannel::read(char *buffer, size_t len) {
+        uint64_t head = inbound->head.load(std::memory_order_relaxed);
+        uint64_t tail = inbound->tail.load(std::memory_order_acquire);
+        if (head == tail) {
+            // the writer closes after its last write, so the tail has to be read again
+            if (inbound->writer_closed.load(std::memory_order_acquire) &&
+                inbound->tail.load(std::memory_order_acquire) == head) {
+                return 0;
+            }
+            errno = EAGAIN;
+            return -1;
+        }
+        if (tail - head > capacity) {
+            throw SocketException(SocketException::SOCKET_READ, EPROTO);
+        }
+        size_t read_bytes = std::min<uint64_t>(len, tail - head);
+        copyFromRing(inbound_data, capacity, head, buffer, read_bytes);
+        inbound->head.store(head + read_bytes, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (inbound->writer_parked.load(std::memory_order_relaxed)) {
+            ring(event_fds[(1 - side) * 2 + DOORBELL_SPACE]);
+        }
+        return (ssize_t) read_bytes;
+    }
+
+    bool ShmChannel::waitUntilReadable(int stop_fd, int timeout_ms) {
+        return park(inbound->reader_parked, event_fds[(1 - side) * 2 + DOORBELL_DATA], stop_fd, timeout_ms,
+                    &ShmChannel::isReadable, &reader_wakeup_requested);
+    }
+
+    bool ShmChannel::waitUntilWritable(int timeout_ms) {
+        return park(outbound->writer_parked, event_fds[side * 2 + DOORBELL_SPACE], -1, timeout_ms,
+                    &ShmChannel::isWritable, nullptr);
+    }
+
+    void ShmChannel::wakeUpReader() {
+        reader_wakeup_requested.store(true, std::memory_order_release);
+        ring(event_fds[(1 - side) * 2 + DOORBELL_DATA]);
+    }
+
+    size_t ShmChannel::getCapacity() const {
+        return capacity;
+    }
+
+    void ShmChannel::ring(int event_fd) {
+        uint64_t value = 1;
+        ::write(event_fd, &value, sizeof(value));
+    }
+
+    bool ShmChannel::park(std::atomic<uint32_t> &parked, int doorbell_fd, int stop_fd, int timeout_ms,
+                          bool (ShmChannel::*ready)() const, std::atomic<bool> *wakeup) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        int wait_ms = timeout_ms;
+        parked.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool result = true;
+        while (!(this->*ready)() && !(wakeup != nullptr && wakeup->exchange(false, std::memory_order_acquire))) {
+            std::array<pollfd, 2> poll_fds = {{{.fd = doorbell_fd, .events = POLLIN, .revents = 0},
+                                               {.fd = stop_fd, .events = POLLIN, .revents = 0}}};
+            int poll_result = poll(poll_fds.data(), stop_fd >= 0 ? 2 : 1, wait_ms);
+            if (poll_result == -1 && errno != EINTR) {
+                int error = errno;
+                parked.store(0, std::memory_order_relaxed);
+                throw SocketException(SocketException::SOCKET_POLL, error);
+            }
+            // reset the doorbell, a ring arriving after this causes a single spurious wakeup
+            uint64_t value;
+            ::read(doorbell_fd, &value, sizeof(value));
+            if (poll_result == 0) {
+                result = false;
+                break;
+            } else if (poll_result > 0 && stop_fd >= 0 && poll_fds[1].revents != 0) {
+                break;
+            }
+            // a spurious wakeup keeps waiting for the rest of the timeout
+            if (timeout_ms >= 0) {
+                auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now()).count();
+                if (remaining <= 0) {
+                    result = (this->*ready)();
+                    break;
+                }
+                wait_ms = (int) remaining;
+            }
+        }
+        parked.store(0, std::memory_order_relaxed);
+        return result;
+    }
+
+    bool ShmChannel::isReadable() const {
+        return inbound->tail.load(std::memory_order_acquire) != inbound->head.load(std::memory_order_relaxed) ||
+               inbound->writer_closed.load(std::memory_order_acquire);
+    }
+
+    bool ShmChannel::isWritable() const {
+        return outbound->tail.load(std::memory_order_relaxed) - outbound->head.load(std::memory_order_acquire) <
+               capacity || outbound->reader_closed.load(std::memory_order_acquire);
+    }
+}
@@ -24,7 +24,9 @@ namespace socket_wrapper {
             {SocketException::Type::SOCKET_POLL,                     "SOCKET_POLL"},
             {SocketException::Type::SOCKET_RECEIVE_BUFFER_TOO_SMALL, "SOCKET_RECEIVE_BUFFER_TOO_SMALL"},
             {SocketException::Type::SOCKET_JOIN_MULTICAST,           "SOCKET_JOIN_MULTICAST"},
-            {SocketException::Type::SOCKET_SET_OPTION,               "SOCKET_SET_OPTION"}
+            {SocketException::Type::SOCKET_SET_OPTION,               "SOCKET_SET_OPTION"},
+            {SocketException::Type::SOCKET_WRITE_TIMEOUT,            "SOCKET_WRITE_TIMEOUT"},
+            {SocketException::Type::SOCKET_INVALID_FRAME,            "SOCKET_INVALID_FRAME"}
     };
 
     const char *SocketException::what() const noexcept {
@@ -0,0 +1,125 @@
+#include <sstream>
+#include <algorithm>
+#include "socket_wrapper/Stats.h"
+
+namespace socket_wrapper {
+    // declared here to not make them "public" in header
+    namespace {
+        uint64_t load(const std::atomic<uint64_t> &counter) {
+            return counter.load(std::memory_order_relaxed);
+        }
+
+        void exportHistogram(std::ostringstream &out, const std::string &name,
+                             const LatencyHistogram::Snapshot &histogram) {
+            out << name << "_count " << histogram.count << "\n";
+            out << name << "_sum " << histogram.sum << "\n";
+            out << name << "{quantile=\"0.5\"} " << histogram.getPercentile(50) << "\n";
+            out << name << "{quantile=\"0.99\"} " << histogram.getPercentile(99) << "\n";
+            out << name << "{quantile=\"0.999\"} " << histogram.getPercentile(99.9) << "\n";
+        }
+    }
+
+    size_t const LatencyHistogram::kSubBucketBits;
+    size_t const LatencyHistogram::kBucketCount;
+
+    size_t LatencyHistogram::bucketIndex(uint64_t value) {
+        uint64_t const sub_bucket_count = 1 << kSubBucketBits;
+        if (value < sub_bucket_count) {
+            return value;
+        }
+        size_t magnitude = 63 - __builtin_clzll(value); // >= kSubBucketBits
+        size_t shift = magnitude - kSubBucketBits;
+        size_t sub_bucket = (value >> shift) & (sub_bucket_count - 1);
+        return ((shift + 1) << kSubBucketBits) + sub_bucket;
+    }
+
+    uint64_t LatencyHistogram::bucketUpperBound(size_t index) {
+        uint64_t const sub_bucket_count = 1 << kSubBucketBits;
+        if (index < sub_bucket_count) {
+            return index;
+        }
+        size_t shift = (index >> kSubBucketBits) - 1;
+        uint64_t lower_bound = (sub_bucket_count + (index & (sub_bucket_count - 1))) << shift;
+        return lower_bound + ((uint64_t) 1 << shift) - 1;
+    }
+
+    void LatencyHistogram::record(uint64_t value) {
+        counts[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t current_max = max.load(std::memory_order_relaxed);
+        while (value > current_max && !max.compare_exchange_weak(current_max, value, std::memory_order_relaxed)) {}
+    }
+
+    LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+        Snapshot result{};
+        for (size_t i = 0; i < kBucketCount; i++) {
+            result.counts[i] = load(counts[i]);
+            result.count += result.counts[i]; // consistent with the buckets, even while values are recorded
+        }
+        result.sum = load(sum);
+        result.max = load(max);
+        return result;
+    }
+
+    uint64_t LatencyHistogram::Snapshot::getPercentile(double percentile) const {
+        if (count == 0) {
+            return 0;
+        }
+        auto rank = (uint64_t) ((percentile / 100.0) * (double) count + 0.5);
+        rank = std::max<uint64_t>(rank, 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBucketCount; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return std::min(bucketUpperBound(i), max);
+            }
+        }
+        return max;
+    }
+
+    double LatencyHistogram::Snapshot::getMean() const {
+        return count == 0 ? 0 : (double) sum / (double) count;
+    }
+
+    StatsSnapshot Stats::snapshot() const {
+        return {
+                .bytes_in = load(bytes_in),
+                .bytes_out = load(bytes_out),
+                .read_syscalls = load(read_syscalls),
+                .write_syscalls = load(write_syscalls),
+                .poll_syscalls = load(poll_syscalls),
+                .accept_syscalls = load(accept_syscalls),
+                .partial_writes = load(partial_writes),
+                .empty_wakeups = load(empty_wakeups),
+                .retry_sleeps = load(retry_sleeps),
+                .memmove_bytes = load(memmove_bytes),
+                .condition_evaluations = load(condition_evaluations),
+                .read_wait_us = read_wait_us.snapshot(),
+                .queue_residency_us = queue_residency_us.snapshot()
+        };
+    }
+
+    uint64_t Stats::elapsedUs(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::string StatsSnapshot::exportText(const std::string &prefix) const {
+        std::ostringstream out;
+        out << prefix << "_bytes_in " << bytes_in << "\n";
+        out << prefix << "_bytes_out " << bytes_out << "\n";
+        out << prefix << "_read_syscalls " << read_syscalls << "\n";
+        out << prefix << "_write_syscalls " << write_syscalls << "\n";
+        out << prefix << "_poll_syscalls " << poll_syscalls << "\n";
+        out << prefix << "_accept_syscalls " << accept_syscalls << "\n";
+        out << prefix << "_partial_writes " << partial_writes << "\n";
+        out << prefix << "_empty_wakeups " << empty_wakeups << "\n";
+        out << prefix << "_retry_sleeps " << retry_sleeps << "\n";
+        out << prefix << "_memmove_bytes " << memmove_bytes << "\n";
+        out << prefix << "_condition_evaluations " << condition_evaluations << "\n";
+        exportHistogram(out, prefix + "_read_wait_us", read_wait_us);
+        exportHistogram(out, prefix + "_queue_residency_us", queue_residency_us);
+        return out.str();
+    }
+}
@@ -3,21 +3,22 @@
 //
 #include "socket_wrapper/Stream.h"
 #include "socket_wrapper/SocketException.h"
+#include "socket_wrapper/IoBackend.h"
+#include "socket_wrapper/Timestamping.h"
 #include <iostream>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <thread>
 #include <sys/poll.h>
-#include <sys/eventfd.h>
+#include <climits>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <cstring>
+#include <stdexcept>
 
 namespace socket_wrapper {
-    Stream::Stream(int socket_fd) : stream_file_descriptor(socket_fd) {
-        // create the end program listener
-        stop_all_operations_event_fd.store(eventfd(0, EFD_SEMAPHORE));
-        if (stop_all_operations_event_fd.load() == -1) {
-            throw std::runtime_error("Failed to create event_fd");
-        }
-    }
+    Stream::Stream(int socket_fd, std::shared_ptr<CancellationDomain> domain)
+            : stream_file_descriptor(socket_fd), cancellation_domain(std::move(domain)) {}
 
     Stream &Stream::operator=(Stream &&stream_to_assign) noexcept {
         std::lock_guard<std::mutex> own_sock_lock_write(stream_file_descriptor_write_mtx);
@@ -25,21 +26,45 @@ namespace socket_wrapper {
         std::lock_guard<std::mutex> other_sock_lock_write(stream_to_assign.stream_file_descriptor_write_mtx);
         std::lock_guard<std::mutex> other_sock_lock_read(stream_to_assign.stream_file_descriptor_read_mtx);
 
+        if (stream_file_descriptor >= 0) {
+            ::close(stream_file_descriptor);
+        }
         stream_file_descriptor = stream_to_assign.stream_file_descriptor;
         stream_to_assign.stream_file_descriptor = kInvalidSocketFdMarker;
-        stop_all_operations_event_fd.store(stream_to_assign.stop_all_operations_event_fd.load());
+        send_queue = std::move(stream_to_assign.send_queue);
+        send_queue_front_offset = stream_to_assign.send_queue_front_offset;
+        send_queue_size = stream_to_assign.send_queue_size;
+        send_queue_high_watermark = stream_to_assign.send_queue_high_watermark;
+        send_queue_enabled = stream_to_assign.send_queue_enabled;
+        cancellation_domain = stream_to_assign.cancellation_domain;
+        stop_request.assign(stream_to_assign.stop_request);
+        stats = std::move(stream_to_assign.stats);
+        timestamps_enabled.store(stream_to_assign.timestamps_enabled.load());
+        busy_poller = std::move(stream_to_assign.busy_poller);
+        shm_channel = std::move(stream_to_assign.shm_channel);
+        tx_timestamps = std::move(stream_to_assign.tx_timestamps);
         return *this;
     }
 
 
     Stream::Stream(Stream &&src) noexcept {
-        {
-            std::lock_guard<std::mutex> other_sock_lock_read(src.stream_file_descriptor_read_mtx);
-            std::lock_guard<std::mutex> other_sock_lock_write(src.stream_file_descriptor_write_mtx);
-            stream_file_descriptor = src.stream_file_descriptor;
-            src.stream_file_descriptor = kInvalidSocketFdMarker;
-        }
-        stop_all_operations_event_fd.store(src.stop_all_operations_event_fd.load());
+        std::lock_guard<std::mutex> other_sock_lock_read(src.stream_file_descriptor_read_mtx);
+        std::lock_guard<std::mutex> other_sock_lock_write(src.stream_file_descriptor_write_mtx);
+        stream_file_descriptor = src.stream_file_descriptor;
+        src.stream_file_descriptor = kInvalidSocketFdMarker;
+        send_queue = std::move(src.send_queue);
+        send_queue_front_offset = src.send_queue_front_offset;
+        send_queue_size = src.send_queue_size;
+        send_queue_high_watermark = src.send_queue_high_watermark;
+        send_queue_enabled = src.send_queue_enabled;
+        // the moved from Stream keeps its domain, it may still be assigned to
+        cancellation_domain = src.cancellation_domain;
+        stop_request.assign(src.stop_request);
+        stats = std::move(src.stats);
+        timestamps_enabled.store(src.timestamps_enabled.load());
+        busy_poller = std::move(src.busy_poller);
+        shm_channel = std::move(src.shm_channel);
+        tx_timestamps = std::move(src.tx_timestamps);
     }
 
     Stream::~Stream() noexcept {
@@ -47,8 +72,7 @@ namespace socket_wrapper {
             return;
         }
         // notify other functions (read) of termination
-        uint64_t semaphore_value = std::numeric_limits<uint16_t>::max();
-        ::write(stop_all_operations_event_fd, &semaphore_value, sizeof(semaphore_value));
+        stopReads();
         if (close(stream_file_descriptor)) {
             // TODO: log error
             std::terminate();
@@ -57,31 +81,145 @@ namespace socket_wrapper {
     }
 
     size_t Stream::read(char *buffer, size_t max_bytes_to_read, size_t min_bytes_to_read, int timeout_ms) {
+        if (shm_channel) {
+            return readShm(buffer, max_bytes_to_read, min_bytes_to_read, timeout_ms);
+        }
         size_t read_bytes = 0;
+        IoUring *ring = IoUring::forCurrentThread();
+        std::shared_ptr<BusyPoller> poller;
+        {
+            // a copy, so disableBusyPolling can not reset it while this read uses it
+            std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_read_mtx);
+            poller = busy_poller;
+        }
+        // the timeout applies to each wait for data, wakeups by transmit timestamps do not restart it
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        int wait_ms = timeout_ms;
         while (read_bytes < min_bytes_to_read) {
             ssize_t read_result;
+            if (isTerminationRequested()) {
+                throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+            }
+            if (poller) {
+                // spin on the socket before paying for a wakeup
+                std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_read_mtx);
+                read_result = poller->spin([&]() {
+                    return ::recv(stream_file_descriptor, buffer + read_bytes, max_bytes_to_read - read_bytes,
+                                  MSG_DONTWAIT);
+                });
+                if (read_result > 0) {
+                    if (stats) {
+                        Stats::add(stats->read_syscalls);
+                        Stats::add(stats->bytes_in, read_result);
+                    }
+                    poller->recordArrival();
+                    read_bytes += read_result;
+                    continue;
+                } else if (read_result == 0) {
+                    // stream closed
+                    throw SocketException(isTerminationRequested() ? SocketException::SOCKET_TERMINATION_REQUEST
+                                                                   : SocketException::SOCKET_CLOSED, 0);
+                } else if (errno != EAGAIN) {
+                    throw SocketException(SocketException::SOCKET_READ, errno);
+                }
+                // the budget was used up, block
+            }
+            if (ring != nullptr) {
+                // wait for and read the data with a single submission
+                std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_read_mtx);
+                StopRequest::Waiter waiter(stop_request, *cancellation_domain);
+                if (isTerminationRequested()) {
+                    throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+                }
+                auto wait_start = stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+                read_result = ring->recv(stream_file_descriptor, buffer + read_bytes, max_bytes_to_read - read_bytes,
+                                         cancellation_domain->getFdForPoll(), wait_ms);
+                if (stats) {
+                    Stats::add(stats->read_syscalls);
+                    stats->read_wait_us.record(Stats::elapsedUs(wait_start));
+                    Stats::add(stats->bytes_in, read_result > 0 ? read_result : 0);
+                }
+                if (read_result == IoUring::kTerminated) {
+                    if (isTerminationRequested()) {
+                        throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+                    }
+                    // another socket of the domain was stopped
+                    std::this_thread::yield();
+                    wait_ms = remainingMs(timeout_ms, deadline, read_bytes, SocketException::SOCKET_READ_TIMEOUT);
+                    continue;
+                } else if (read_result == IoUring::kTimedOut) {
+                    throw SocketException(SocketException::SOCKET_READ_TIMEOUT, 0);
+                } else if (read_result < 0) {
+                    throw SocketException(SocketException::SOCKET_READ, (int) -read_result);
+                } else if (read_result == 0) {
+                    // stream closed
+                    throw SocketException(isTerminationRequested() ? SocketException::SOCKET_TERMINATION_REQUEST
+                                                                   : SocketException::SOCKET_CLOSED, 0);
+                }
+                if (poller) {
+                    poller->recordArrival();
+                }
+                read_bytes += read_result;
+                wait_ms = timeout_ms;
+                deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+                continue;
+            }
             {
                 std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_read_mtx);
+                StopRequest::Waiter waiter(stop_request, *cancellation_domain);
+                if (isTerminationRequested()) {
+                    throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+                }
                 // use poll to find out if there is new data or a termination request
                 std::array<pollfd, 2> poll_fds = {{{.fd = stream_file_descriptor, .events = POLLIN, .revents = 0},
-                                                   {.fd = stop_all_operations_event_fd, .events = POLLIN, .revents = 0}}};
-                if (poll(poll_fds.data(), poll_fds.size(), timeout_ms) == -1) {
+                                                   {.fd = cancellation_domain->getFdForPoll(), .events = POLLIN, .revents = 0}}};
+                auto wait_start = stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+                int poll_result = poll(poll_fds.data(), poll_fds.size(), wait_ms);
+                if (stats) {
+                    Stats::add(stats->poll_syscalls);
+                    stats->read_wait_us.record(Stats::elapsedUs(wait_start));
+                }
+                if (poll_result == -1) {
                     // error while polling
                     throw SocketException(SocketException::SOCKET_POLL, errno);
+                } else if (poll_fds[0].revents == POLLERR && collectTxTimestamps() > 0) {
+                    // only transmit timestamps were queued, keep waiting for data until the deadline
+                    wait_ms = remainingMs(timeout_ms, deadline, read_bytes, SocketException::SOCKET_READ_TIMEOUT);
+                    continue;
                 } else if (poll_fds[0].revents != 0) {
                     // we received data
                     read_result = ::read(stream_file_descriptor, (char *) buffer + read_bytes,
                                          max_bytes_to_read - read_bytes);
+                    if (stats) {
+                        Stats::add(stats->read_syscalls);
+                        Stats::add(stats->bytes_in, read_result > 0 ? read_result : 0);
+                    }
                     if (read_result == -1) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                            if (stats) {
+                                Stats::add(stats->empty_wakeups);
+                            }
+                            continue; // non blocking socket, the data was consumed by someone else
+                        }
                         throw SocketException(SocketException::SOCKET_READ, errno);
                     } else if (read_result == 0) {
                         // stream closed
-                        throw SocketException(SocketException::SOCKET_CLOSED, 0);
+                        throw SocketException(isTerminationRequested() ? SocketException::SOCKET_TERMINATION_REQUEST
+                                                                       : SocketException::SOCKET_CLOSED, 0);
+                    }
+                    if (poller) {
+                        poller->recordArrival();
                     }
                     read_bytes += read_result;
+                    wait_ms = timeout_ms;
+                    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
                 } else if (poll_fds[1].revents != 0) {
-                    // we received a termination request
-                    throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+                    if (isTerminationRequested()) {
+                        throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+                    }
+                    // another socket of the domain was stopped, wait again once it was woken up
+                    std::this_thread::yield();
+                    wait_ms = remainingMs(timeout_ms, deadline, read_bytes, SocketException::SOCKET_READ_TIMEOUT);
                 } else {
                     // we received a timeout
                     throw SocketException(SocketException::SOCKET_READ_TIMEOUT, 0);
@@ -97,19 +235,39 @@ namespace socket_wrapper {
             ssize_t write_result;
             {
                 std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_write_mtx);
-                write_result = ::write(stream_file_descriptor, buffer + total_written_bytes,
-                                       size - total_written_bytes);
+                if (shm_channel) {
+                    iovec buffer_vec = {.iov_base = (void *) (buffer + total_written_bytes),
+                                        .iov_len = size - total_written_bytes};
+                    write_result = shm_channel->writev(&buffer_vec, 1);
+                } else {
+                    write_result = ::write(stream_file_descriptor, buffer + total_written_bytes,
+                                           size - total_written_bytes);
+                }
+            }
+            if (stats) {
+                Stats::add(stats->write_syscalls, shm_channel ? 0 : 1); // shared memory writes are no syscalls
+                Stats::add(stats->bytes_out, write_result > 0 ? write_result : 0);
+                if (write_result < (ssize_t) (size - total_written_bytes)) {
+                    Stats::add(stats->partial_writes);
+                }
             }
             if (write_result == -1) {
-                throw SocketException(SocketException::SOCKET_WRITE, errno);
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    throw SocketException(SocketException::SOCKET_WRITE, errno);
+                }
+                // non blocking socket with a full send buffer, retry later
             } else {
                 total_written_bytes += write_result;
             }
             if ((size_t)total_written_bytes == size) {
                 break;
             }
-            auto wait_time = kSocketRetryIntervallMs;
-            std::this_thread::sleep_for(std::chrono::milliseconds(wait_time));
+            if (attempts) {
+                if (stats) {
+                    Stats::add(stats->retry_sleeps);
+                }
+                waitUntilWritable(kSocketRetryIntervallMs);
+            }
         }
         if ((size_t)total_written_bytes != size) {
             // we did not manage to write all the data
@@ -117,8 +275,642 @@ namespace socket_wrapper {
         }
     }
 
+    size_t Stream::writev(const iovec *buffers, size_t buffer_count, int attempts) {
+        // work on a copy, as partially written buffers have to be adjusted
+        std::vector<iovec> remaining(buffers, buffers + buffer_count);
+        size_t total_size = 0;
+        for (auto &b: remaining) {
+            total_size += b.iov_len;
+        }
+        size_t total_written_bytes = 0;
+        size_t first_remaining = 0;
+        while (attempts-- && total_written_bytes < total_size) {
+            while (total_written_bytes < total_size) {
+                // skip buffers that were written completely (or are empty)
+                while (remaining[first_remaining].iov_len == 0) {
+                    first_remaining++;
+                }
+                int iov_count = (int) std::min<size_t>(remaining.size() - first_remaining, IOV_MAX);
+                ssize_t write_result;
+                {
+                    std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_write_mtx);
+                    write_result = shm_channel ? shm_channel->writev(remaining.data() + first_remaining, iov_count)
+                                               : ::writev(stream_file_descriptor, remaining.data() + first_remaining,
+                                                          iov_count);
+                }
+                if (stats) {
+                    Stats::add(stats->write_syscalls, shm_channel ? 0 : 1);
+                    Stats::add(stats->bytes_out, write_result > 0 ? write_result : 0);
+                    if (write_result < (ssize_t) (total_size - total_written_bytes)) {
+                        Stats::add(stats->partial_writes);
+                    }
+                }
+                if (write_result == -1) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        throw SocketException(SocketException::SOCKET_WRITE, errno, total_written_bytes);
+                    }
+                    break; // the send buffer is full, retry later
+                }
+                total_written_bytes += write_result;
+                // advance over the written bytes, the last touched buffer may be written partially
+                size_t to_skip = write_result;
+                while (to_skip > 0) {
+                    iovec &current = remaining[first_remaining];
+                    size_t skipped = std::min(to_skip, current.iov_len);
+                    current.iov_base = (char *) current.iov_base + skipped;
+                    current.iov_len -= skipped;
+                    to_skip -= skipped;
+                    if (current.iov_len == 0) {
+                        first_remaining++;
+                    }
+                }
+                if (write_result == 0) {
+                    break;
+                }
+            }
+            if (total_written_bytes == total_size) {
+                break;
+            }
+            if (attempts) {
+                if (stats) {
+                    Stats::add(stats->retry_sleeps);
+                }
+                waitUntilWritable(kSocketRetryIntervallMs);
+            }
+        }
+        if (total_written_bytes != total_size) {
+            // we did not manage to write all the data
+            throw SocketException(SocketException::SOCKET_WRITE_PARTIAL, errno, total_written_bytes);
+        }
+        return total_written_bytes;
+    }
+
+    size_t Stream::writev(const std::vector<iovec> &buffers, int attempts) {
+        return writev(buffers.data(), buffers.size(), attempts);
+    }
+
+    void Stream::writeBlocking(const char *buffer, size_t size, int timeout_ms) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        size_t total_written_bytes = 0;
+        while (true) {
+            total_written_bytes += tryWrite(buffer + total_written_bytes, size - total_written_bytes);
+            if (total_written_bytes == size) {
+                return;
+            }
+            if (stats) {
+                Stats::add(stats->retry_sleeps);
+            }
+            if (!waitUntilWritable(remainingMs(timeout_ms, deadline, total_written_bytes))) {
+                throw SocketException(SocketException::SOCKET_WRITE_TIMEOUT, 0, total_written_bytes);
+            }
+        }
+    }
+
+    size_t Stream::tryWrite(const char *buffer, size_t size) {
+        iovec buffer_vec = {.iov_base = (void *) buffer, .iov_len = size};
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_write_mtx);
+        return sendNonBlocking(&buffer_vec, 1);
+    }
+
+    size_t Stream::sendFile(int fd, off_t offset, size_t len, int timeout_ms) {
+        if (shm_channel) {
+            throw SocketException(SocketException::SOCKET_WRITE, EOPNOTSUPP);
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_write_mtx);
+        // the socket has to be non blocking for the deadline to be met, the original flags are restored afterwards
+        int flags = fcntl(stream_file_descriptor, F_GETFL);
+        if (flags == -1 || fcntl(stream_file_descriptor, F_SETFL, flags | O_NONBLOCK) == -1) {
+            throw SocketException(SocketException::SOCKET_SET_OPTION, errno);
+        }
+        struct restore_flags {
+            int fd, flags;
+            ~restore_flags() { fcntl(fd, F_SETFL, flags); }
+        } restore{stream_file_descriptor, flags};
+
+        off_t *offset_ptr = offset < 0 ? nullptr : &offset;
+        size_t sent_bytes = 0;
+        while (sent_bytes < len) {
+            ssize_t result = ::sendfile(stream_file_descriptor, fd, offset_ptr, len - sent_bytes);
+            if (stats) {
+                Stats::add(stats->write_syscalls);
+                Stats::add(stats->bytes_out, result > 0 ? result : 0);
+            }
+            if (result > 0) {
+                sent_bytes += result;
+            } else if (result == 0) {
+                break; // end of file
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (!waitUntilWritable(remainingMs(timeout_ms, deadline, sent_bytes))) {
+                    throw SocketException(SocketException::SOCKET_WRITE_TIMEOUT, 0, sent_bytes);
+                }
+            } else if ((errno == EINVAL || errno == ENOSYS) && sent_bytes == 0) {
+                // the file does not support sendfile (e.g. a pipe), move it through a pipe instead
+                return spliceFile(fd, offset_ptr, len, timeout_ms, deadline);
+            } else if (errno != EINTR) {
+                throw SocketException(SocketException::SOCKET_WRITE, errno, sent_bytes);
+            }
+        }
+        return sent_bytes;
+    }
+
+    void Stream::sendFds(const std::vector<int> &fds, const char *buffer, size_t size, int timeout_ms) {
+        if (fds.size() > kMaxFdsPerMessage) {
+            throw SocketException(SocketException::SOCKET_WRITE, EINVAL);
+        }
+        // descriptors can only be passed along with at least one byte of data
+        char const marker = 0;
+        if (size == 0) {
+            buffer = &marker;
+            size = 1;
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        // the lock is held while waiting, so no other write ends up in front of the descriptors' first byte
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_write_mtx);
+        size_t total_written_bytes = 0;
+        while (true) {
+            iovec buffer_vec = {.iov_base = (void *) (buffer + total_written_bytes),
+                                .iov_len = size - total_written_bytes};
+            // the descriptors are attached until the first byte was accepted
+            total_written_bytes += sendNonBlocking(&buffer_vec, 1, total_written_bytes == 0 ? &fds : nullptr);
+            if (total_written_bytes == size) {
+                return;
+            }
+            if (stats) {
+                Stats::add(stats->retry_sleeps);
+            }
+            if (!waitUntilWritable(remainingMs(timeout_ms, deadline, total_written_bytes))) {
+                throw SocketException(SocketException::SOCKET_WRITE_TIMEOUT, 0, total_written_bytes);
+            }
+        }
+    }
+
+    std::vector<int> Stream::recvFds(char *buffer, size_t max_bytes_to_read, size_t &read_bytes, int timeout_ms) {
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_read_mtx);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        bool waited = false;
+        while (true) {
+            if (isTerminationRequested()) {
+                throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+            }
+            iovec buffer_vec = {.iov_base = buffer, .iov_len = max_bytes_to_read};
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxFdsPerMessage)];
+            msghdr msg{};
+            msg.msg_iov = &buffer_vec;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            ssize_t read_result = ::recvmsg(stream_file_descriptor, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+            if (stats) {
+                Stats::add(stats->read_syscalls);
+                Stats::add(stats->bytes_in, read_result > 0 ? read_result : 0);
+            }
+            if (read_result > 0) {
+                std::vector<int> fds;
+                for (cmsghdr *message = CMSG_FIRSTHDR(&msg); message != nullptr; message = CMSG_NXTHDR(&msg, message)) {
+                    if (message->cmsg_level == SOL_SOCKET && message->cmsg_type == SCM_RIGHTS) {
+                        size_t fd_count = (message->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                        size_t old_size = fds.size();
+                        fds.resize(old_size + fd_count);
+                        memcpy(fds.data() + old_size, CMSG_DATA(message), fd_count * sizeof(int));
+                    }
+                }
+                if (msg.msg_flags & MSG_CTRUNC) {
+                    // some descriptors were dropped by the kernel, the message is unusable
+                    for (int fd: fds) {
+                        ::close(fd);
+                    }
+                    throw SocketException(SocketException::SOCKET_RECEIVE_BUFFER_TOO_SMALL, 0, read_result);
+                }
+                read_bytes = read_result;
+                return fds;
+            } else if (read_result == 0) {
+                // stream closed
+                throw SocketException(isTerminationRequested() ? SocketException::SOCKET_TERMINATION_REQUEST
+                                                               : SocketException::SOCKET_CLOSED, 0);
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                throw SocketException(SocketException::SOCKET_READ, errno);
+            }
+            // wait for data or a termination request, the loop checks the flags again after a wakeup
+            // wakeups without data (signals, transmit timestamps, other stopped sockets) keep the deadline
+            int wait_ms = waited ? remainingMs(timeout_ms, deadline, 0, SocketException::SOCKET_READ_TIMEOUT)
+                                 : timeout_ms;
+            waited = true;
+            StopRequest::Waiter waiter(stop_request, *cancellation_domain);
+            if (isTerminationRequested()) {
+                throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+            }
+            std::array<pollfd, 2> poll_fds = {{{.fd = stream_file_descriptor, .events = POLLIN, .revents = 0},
+                                               {.fd = cancellation_domain->getFdForPoll(), .events = POLLIN, .revents = 0}}};
+            int poll_result = poll(poll_fds.data(), poll_fds.size(), wait_ms);
+            if (stats) {
+                Stats::add(stats->poll_syscalls);
+            }
+            if (poll_result == -1 && errno != EINTR) {
+                throw SocketException(SocketException::SOCKET_POLL, errno);
+            } else if (poll_result == 0) {
+                throw SocketException(SocketException::SOCKET_READ_TIMEOUT, 0);
+            } else if (poll_result > 0 && poll_fds[0].revents == POLLERR) {
+                collectTxTimestamps(); // errors are reported by the next recvmsg
+            } else if (poll_result > 0 && poll_fds[1].revents != 0 && poll_fds[0].revents == 0) {
+                // the flags are checked again, another socket of the domain may have been stopped
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    std::vector<int> Stream::recvFds(int timeout_ms) {
+        char marker;
+        size_t read_bytes;
+        return recvFds(&marker, sizeof(marker), read_bytes, timeout_ms);
+    }
+
+    size_t Stream::spliceFile(int fd, off_t *offset, size_t len, int timeout_ms,
+                              std::chrono::steady_clock::time_point deadline) {
+        int pipe_fds[2];
+        if (pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+            throw SocketException(SocketException::SOCKET_PAIR, errno);
+        }
+        struct close_pipe {
+            int *fds;
+            ~close_pipe() {
+                ::close(fds[0]);
+                ::close(fds[1]);
+            }
+        } pipe_closer{pipe_fds};
+
+        size_t read_bytes = 0; // moved from the file into the pipe
+        size_t sent_bytes = 0; // moved from the pipe into the socket
+        bool end_of_file = false;
+        while (sent_bytes < read_bytes || (!end_of_file && read_bytes < len)) {
+            if (!end_of_file && read_bytes < len) {
+                ssize_t result = ::splice(fd, offset, pipe_fds[1], nullptr, len - read_bytes,
+                                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (result > 0) {
+                    read_bytes += result;
+                } else if (result == 0) {
+                    end_of_file = true;
+                } else if (errno == EAGAIN && read_bytes == sent_bytes) {
+                    // the source is a pipe/socket without data, wait for it
+                    std::array<pollfd, 1> poll_fds = {{{.fd = fd, .events = POLLIN, .revents = 0}}};
+                    if (poll(poll_fds.data(), poll_fds.size(), remainingMs(timeout_ms, deadline, sent_bytes)) == 0) {
+                        throw SocketException(SocketException::SOCKET_WRITE_TIMEOUT, 0, sent_bytes);
+                    }
+                } else if (errno != EAGAIN && errno != EINTR) {
+                    throw SocketException(SocketException::SOCKET_WRITE, errno, sent_bytes);
+                }
+            }
+            if (sent_bytes < read_bytes) {
+                ssize_t result = ::splice(pipe_fds[0], nullptr, stream_file_descriptor, nullptr,
+                                          read_bytes - sent_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (stats) {
+                    Stats::add(stats->write_syscalls);
+                    Stats::add(stats->bytes_out, result > 0 ? result : 0);
+                }
+                if (result > 0) {
+                    sent_bytes += result;
+                } else if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    if (!waitUntilWritable(remainingMs(timeout_ms, deadline, sent_bytes))) {
+                        throw SocketException(SocketException::SOCKET_WRITE_TIMEOUT, 0, sent_bytes);
+                    }
+                } else if (result == -1 && errno != EINTR) {
+                    throw SocketException(SocketException::SOCKET_WRITE, errno, sent_bytes);
+                }
+            }
+        }
+        return sent_bytes;
+    }
+
+    int Stream::remainingMs(int timeout_ms, std::chrono::steady_clock::time_point deadline, size_t processed_bytes,
+                            SocketException::Type timeout_type) {
+        if (timeout_ms < 0) {
+            return -1;
+        }
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0) {
+            throw SocketException(timeout_type, 0, processed_bytes);
+        }
+        return (int) remaining;
+    }
+
+    void Stream::enableSendQueue(size_t high_watermark) {
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_write_mtx);
+        send_queue_high_watermark = high_watermark;
+        send_queue_enabled = true;
+    }
+
+    bool Stream::enqueue(const char *buffer, size_t size) {
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_write_mtx);
+        if (!send_queue_enabled) {
+            throw std::logic_error("enqueue was called before enableSendQueue");
+        }
+        size_t written_bytes = 0;
+        if (send_queue.empty()) {
+            // nothing queued, so we can try to send right away without reordering data
+            iovec buffer_vec = {.iov_base = (void *) buffer, .iov_len = size};
+            written_bytes = sendNonBlocking(&buffer_vec, 1);
+        }
+        // only the bytes left over count against the watermark
+        if (send_queue_size + (size - written_bytes) > send_queue_high_watermark) {
+            if (written_bytes == 0) {
+                return false;
+            }
+            // the sent part can not be taken back, the caller has to send the rest
+            throw SocketException(SocketException::SOCKET_WRITE_PARTIAL, ENOBUFS, written_bytes);
+        }
+        if (written_bytes < size) {
+            send_queue.emplace_back(buffer + written_bytes, buffer + size);
+            send_queue_size += size - written_bytes;
+        }
+        return true;
+    }
+
+    size_t Stream::flushSendQueue() {
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_write_mtx);
+        while (!send_queue.empty()) {
+            std::vector<iovec> buffers;
+            for (auto it = send_queue.begin(); it != send_queue.end() && buffers.size() < IOV_MAX; ++it) {
+                size_t offset = buffers.empty() ? send_queue_front_offset : 0;
+                buffers.push_back({.iov_base = it->data() + offset, .iov_len = it->size() - offset});
+            }
+            size_t written_bytes = sendNonBlocking(buffers.data(), buffers.size());
+            if (written_bytes == 0) {
+                break;
+            }
+            send_queue_size -= written_bytes;
+            written_bytes += send_queue_front_offset;
+            while (!send_queue.empty() && written_bytes >= send_queue.front().size()) {
+                written_bytes -= send_queue.front().size();
+                send_queue.pop_front();
+            }
+            send_queue_front_offset = written_bytes;
+        }
+        return send_queue_size;
+    }
+
+    size_t Stream::getSendQueueSize() {
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_write_mtx);
+        return send_queue_size;
+    }
+
+    bool Stream::waitUntilWritable(int timeout_ms) {
+        if (shm_channel) {
+            if (stats) {
+                Stats::add(stats->poll_syscalls);
+            }
+            return shm_channel->waitUntilWritable(timeout_ms);
+        }
+        std::array<pollfd, 1> poll_fds = {{{.fd = stream_file_descriptor, .events = POLLOUT, .revents = 0}}};
+        int poll_result = poll(poll_fds.data(), poll_fds.size(), timeout_ms);
+        if (stats) {
+            Stats::add(stats->poll_syscalls);
+        }
+        if (poll_result == -1) {
+            if (errno == EINTR) {
+                return true; // let the caller retry
+            }
+            throw SocketException(SocketException::SOCKET_POLL, errno);
+        }
+        // errors and hang ups are reported by the next write
+        return poll_result > 0;
+    }
+
+    size_t Stream::sendNonBlocking(const iovec *buffers, size_t buffer_count, const std::vector<int> *fds) {
+        msghdr msg{};
+        msg.msg_iov = (iovec *) buffers;
+        msg.msg_iovlen = buffer_count;
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxFdsPerMessage)];
+        if (fds != nullptr && !fds->empty()) {
+            msg.msg_control = control;
+            msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds->size());
+            cmsghdr *fd_message = CMSG_FIRSTHDR(&msg);
+            fd_message->cmsg_level = SOL_SOCKET;
+            fd_message->cmsg_type = SCM_RIGHTS;
+            fd_message->cmsg_len = CMSG_LEN(sizeof(int) * fds->size());
+            memcpy(CMSG_DATA(fd_message), fds->data(), sizeof(int) * fds->size());
+        }
+        ssize_t write_result;
+        if (shm_channel) {
+            if (fds != nullptr && !fds->empty()) {
+                throw SocketException(SocketException::SOCKET_WRITE, EOPNOTSUPP);
+            }
+            write_result = shm_channel->writev(buffers, buffer_count);
+        } else {
+            write_result = ::sendmsg(stream_file_descriptor, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+        if (stats) {
+            size_t offered_bytes = 0;
+            for (size_t i = 0; i < buffer_count; i++) {
+                offered_bytes += buffers[i].iov_len;
+            }
+            Stats::add(stats->write_syscalls, shm_channel ? 0 : 1);
+            Stats::add(stats->bytes_out, write_result > 0 ? write_result : 0);
+            if (write_result < (ssize_t) offered_bytes) {
+                Stats::add(stats->partial_writes);
+            }
+        }
+        if (write_result == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            throw SocketException(SocketException::SOCKET_WRITE, errno);
+        }
+        return write_result;
+    }
+
+    size_t Stream::readShm(char *buffer, size_t max_bytes_to_read, size_t min_bytes_to_read, int timeout_ms) {
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_read_mtx);
+        size_t read_bytes = 0;
+        while (read_bytes < min_bytes_to_read) {
+            if (isTerminationRequested()) {
+                throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+            }
+            auto receive = [&]() { return shm_channel->read(buffer + read_bytes, max_bytes_to_read - read_bytes); };
+            ssize_t read_result = busy_poller ? busy_poller->spin(receive) : receive();
+            if (read_result > 0) {
+                if (stats) {
+                    Stats::add(stats->bytes_in, read_result);
+                }
+                if (busy_poller) {
+                    busy_poller->recordArrival();
+                }
+                read_bytes += read_result;
+                continue;
+            } else if (read_result == 0) {
+                // the peer closed its end
+                throw SocketException(isTerminationRequested() ? SocketException::SOCKET_TERMINATION_REQUEST
+                                                               : SocketException::SOCKET_CLOSED, 0);
+            }
+            // the ring is empty, park until the peer rings the doorbell
+            auto wait_start = stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+            bool readable = shm_channel->waitUntilReadable(cancellation_domain->getFdForPoll(), timeout_ms);
+            if (stats) {
+                Stats::add(stats->poll_syscalls);
+                stats->read_wait_us.record(Stats::elapsedUs(wait_start));
+            }
+            if (!readable) {
+                throw SocketException(SocketException::SOCKET_READ_TIMEOUT, 0);
+            }
+        }
+        return read_bytes;
+    }
+
+    void Stream::waitUntilReadable(int timeout_ms) {
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_read_mtx);
+        if (isTerminationRequested()) {
+            throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+        }
+        // the wait is counted as the read wait, the read following it does not wait anymore
+        auto wait_start = stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        if (shm_channel) {
+            bool readable = shm_channel->waitUntilReadable(cancellation_domain->getFdForPoll(), timeout_ms);
+            if (stats) {
+                Stats::add(stats->poll_syscalls);
+                stats->read_wait_us.record(Stats::elapsedUs(wait_start));
+            }
+            if (!readable) {
+                throw SocketException(SocketException::SOCKET_READ_TIMEOUT, 0);
+            }
+            return;
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        int wait_ms = timeout_ms;
+        StopRequest::Waiter waiter(stop_request, *cancellation_domain);
+        while (true) {
+            if (isTerminationRequested()) {
+                throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+            }
+            std::array<pollfd, 2> poll_fds = {{{.fd = stream_file_descriptor, .events = POLLIN, .revents = 0},
+                                               {.fd = cancellation_domain->getFdForPoll(), .events = POLLIN, .revents = 0}}};
+            int poll_result = poll(poll_fds.data(), poll_fds.size(), wait_ms);
+            if (stats) {
+                Stats::add(stats->poll_syscalls);
+            }
+            if (poll_result == -1) {
+                if (errno == EINTR) {
+                    // interrupted by a signal, wait for the rest of the timeout
+                    wait_ms = remainingMs(timeout_ms, deadline, 0, SocketException::SOCKET_READ_TIMEOUT);
+                    continue;
+                }
+                throw SocketException(SocketException::SOCKET_POLL, errno);
+            } else if (poll_result == 0) {
+                throw SocketException(SocketException::SOCKET_READ_TIMEOUT, 0);
+            } else if (poll_fds[0].revents == POLLERR && collectTxTimestamps() > 0) {
+                // only transmit timestamps were queued
+                wait_ms = remainingMs(timeout_ms, deadline, 0, SocketException::SOCKET_READ_TIMEOUT);
+                continue;
+            } else if (poll_fds[1].revents != 0 && poll_fds[0].revents == 0) {
+                // the flags are checked again, another socket of the domain may have been stopped
+                std::this_thread::yield();
+                wait_ms = remainingMs(timeout_ms, deadline, 0, SocketException::SOCKET_READ_TIMEOUT);
+                continue;
+            }
+            if (stats) {
+                stats->read_wait_us.record(Stats::elapsedUs(wait_start));
+            }
+            return;
+        }
+    }
+
+    bool Stream::waitsInRead() {
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_read_mtx);
+        return busy_poller != nullptr || (!shm_channel && IoUring::forCurrentThread() != nullptr);
+    }
+
+    size_t Stream::tryRead(char *buffer, size_t max_bytes_to_read) {
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_read_mtx);
+        ssize_t read_result = shm_channel ? shm_channel->read(buffer, max_bytes_to_read)
+                                          : ::recv(stream_file_descriptor, buffer, max_bytes_to_read, MSG_DONTWAIT);
+        if (stats) {
+            Stats::add(stats->read_syscalls, shm_channel ? 0 : 1);
+            Stats::add(stats->bytes_in, read_result > 0 ? read_result : 0);
+        }
+        if (read_result == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            throw SocketException(SocketException::SOCKET_READ, errno);
+        } else if (read_result == 0 && max_bytes_to_read > 0) {
+            // stream closed
+            throw SocketException(isTerminationRequested() ? SocketException::SOCKET_TERMINATION_REQUEST
+                                                           : SocketException::SOCKET_CLOSED, 0);
+        }
+        return read_result;
+    }
+
+    void Stream::setOptions(const StreamOptions &options) {
+        applyStreamOptions(stream_file_descriptor, options);
+    }
+
+    StreamOptions Stream::getOptions() {
+        return getEffectiveStreamOptions(stream_file_descriptor);
+    }
+
+    int Stream::getFdForPoll() {
+        return stream_file_descriptor;
+    }
+
     void Stream::stopReads() {
-        uint64_t semaphore_value = std::numeric_limits<uint16_t>::max();
-        ::write(stop_all_operations_event_fd, &semaphore_value, sizeof(semaphore_value));
+        // the flag is set before waking up the readers, the connection itself is left alone
+        stop_request.request(*cancellation_domain);
+        if (shm_channel) {
+            shm_channel->wakeUpReader();
+        }
+    }
+
+    void Stream::enableBusyPolling(int max_spin_us, bool adaptive) {
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_read_mtx);
+        busy_poller = std::make_shared<BusyPoller>(max_spin_us, adaptive);
+        // let the driver poll the device queue as well, raising the limit may require CAP_NET_ADMIN
+        setsockopt(stream_file_descriptor, SOL_SOCKET, SO_BUSY_POLL, &max_spin_us, sizeof(max_spin_us));
+    }
+
+    void Stream::disableBusyPolling() {
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_read_mtx);
+        busy_poller.reset();
+    }
+
+    void Stream::enableTimestamps() {
+        enableKernelTimestamps(stream_file_descriptor, true);
+        timestamps_enabled = true;
+    }
+
+    std::vector<TxTimestamp> Stream::readTxTimestamps() {
+        collectTxTimestamps();
+        std::lock_guard<std::mutex> lk(tx_timestamps_mtx);
+        std::vector<TxTimestamp> result;
+        result.swap(tx_timestamps);
+        return result;
+    }
+
+    size_t Stream::collectTxTimestamps() {
+        if (!timestamps_enabled) {
+            return 0;
+        }
+        std::lock_guard<std::mutex> lk(tx_timestamps_mtx);
+        return socket_wrapper::readTxTimestamps(stream_file_descriptor, tx_timestamps);
+    }
+
+    void Stream::enableStats(std::shared_ptr<Stats> shared_stats) {
+        stats = std::move(shared_stats);
+    }
+
+    StatsSnapshot Stream::getStats() {
+        return stats ? stats->snapshot() : Stats().snapshot();
+    }
+
+    void Stream::setCancellationDomain(std::shared_ptr<CancellationDomain> domain) {
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_read_mtx);
+        cancellation_domain = std::move(domain);
+    }
+
+    std::shared_ptr<CancellationDomain> Stream::getCancellationDomain() {
+        std::lock_guard<std::mutex> sock_lock(stream_file_descriptor_read_mtx);
+        return cancellation_domain;
+    }
+
+    bool Stream::isTerminationRequested() {
+        return stop_request.isRequested() || cancellation_domain->isCancelled();
     }
 }
\ No newline at end of file
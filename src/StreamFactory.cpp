@@ -1,12 +1,21 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/poll.h>
 #include "socket_wrapper/StreamFactory.h"
 #include "socket_wrapper/SocketException.h"
 #include "socket_wrapper/BaseTypes.h"
+#include "socket_wrapper/UnixSocket.h"
 namespace socket_wrapper {
+    // declared here to not make them "public" in header
+    int startConnect(const Endpoint &endpoint, const StreamOptions &options, bool &connected, int &error);
+
+    int finishConnect(int fd);
 
     std::array<Stream,2> StreamFactory::CreatePipe(){
         int fds[2];
@@ -15,43 +24,205 @@ namespace socket_wrapper {
         }
         return {Stream(fds[0]),Stream(fds[1])};
     }
-    Stream StreamFactory::CreateTcpStreamToServer(std::string ip_address, uint16_t port, IP_VERSION version) {
-        int client_socket_fd;
-        if(version == IP_VERSION::IPv6){
-            struct sockaddr_in6 server_addr;
-            if ((client_socket_fd = socket(AF_INET6, SOCK_STREAM , IPPROTO_TCP)) < 0) {
-                throw SocketException(SocketException::SOCKET_SOCKET, errno);
-            }
-            bzero(&server_addr, sizeof(server_addr));
-            // assign IP, PORT
-            server_addr.sin6_family = AF_INET6;
-            inet_pton(AF_INET6, ip_address.c_str(), &server_addr.sin6_addr);
-            server_addr.sin6_port = htons(port);
-
-            /*// wait until connect is available (required for support for non blocking sockets
-            std::array<pollfd, 1> poll_fds = {{{.fd = client_socket_fd, .events = POLLIN, .revents = 0}}};
-            if (poll(poll_fds.data(), poll_fds.size(), -1) == -1) {
-                throw std::logic_error("error while poll'ing for client");
-            }*/
-            // connect the client socket to server socket
-            if (::connect(client_socket_fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
-                throw SocketException(SocketException::SOCKET_CONNECT, errno);
-            }
-        }else{
-            struct sockaddr_in server_addr;
-            if ((client_socket_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
-                throw SocketException(SocketException::SOCKET_SOCKET, errno);
-            }
-            bzero(&server_addr, sizeof(server_addr));
-            // assign IP, PORT
-            server_addr.sin_family = AF_INET;
-            server_addr.sin_addr.s_addr = inet_addr(ip_address.c_str());
-            server_addr.sin_port = htons(port);
-            // connect the client socket to server socket
-            if (::connect(client_socket_fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
-                throw SocketException(SocketException::SOCKET_CONNECT, errno);
-            }
-        }
-       return Stream(client_socket_fd);
-    }
-}
\ No newline at end of file
+
+    std::array<Stream, 2> StreamFactory::CreateShmPipe(size_t capacity) {
+        auto channels = ShmChannel::createPair(capacity);
+        std::array<Stream, 2> streams = {Stream(Stream::kInvalidSocketFdMarker), Stream(Stream::kInvalidSocketFdMarker)};
+        streams[0].shm_channel = std::move(channels[0]);
+        streams[1].shm_channel = std::move(channels[1]);
+        return streams;
+    }
+
+    Stream StreamFactory::CreateShmStreamToPeer(Stream &unix_stream, size_t capacity) {
+        Stream stream(Stream::kInvalidSocketFdMarker);
+        stream.shm_channel = ShmChannel::create(capacity);
+        unix_stream.sendFds(stream.shm_channel->getFdsForPeer());
+        return stream;
+    }
+
+    Stream StreamFactory::CreateShmStreamFromPeer(Stream &unix_stream, int timeout_ms) {
+        Stream stream(Stream::kInvalidSocketFdMarker);
+        stream.shm_channel = ShmChannel::attach(unix_stream.recvFds(timeout_ms));
+        return stream;
+    }
+
+    Stream StreamFactory::CreateUnixStream(const std::string &path, const StreamOptions &options, int timeout_ms) {
+        sockaddr_un server_addr;
+        socklen_t server_addr_length = toUnixAddress(path, server_addr, SocketException::SOCKET_CONNECT);
+        int client_socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (client_socket_fd < 0) {
+            throw SocketException(SocketException::SOCKET_SOCKET, errno);
+        }
+        try {
+            applyStreamOptions(client_socket_fd, options);
+        } catch (SocketException &) {
+            ::close(client_socket_fd);
+            throw;
+        }
+        // a Unix connect only blocks while the backlog is full, it honours the send timeout while doing so
+        if (timeout_ms >= 0) {
+            timeval timeout = {.tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000};
+            setsockopt(client_socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        }
+        int result;
+        do {
+            result = ::connect(client_socket_fd, (sockaddr *) &server_addr, server_addr_length);
+        } while (result != 0 && errno == EINTR);
+        if (result != 0) {
+            int error = (errno == EAGAIN || errno == EINPROGRESS) ? ETIMEDOUT : errno;
+            ::close(client_socket_fd);
+            throw SocketException(SocketException::SOCKET_CONNECT, error);
+        }
+        if (timeout_ms >= 0) {
+            timeval no_timeout = {.tv_sec = 0, .tv_usec = 0};
+            setsockopt(client_socket_fd, SOL_SOCKET, SO_SNDTIMEO, &no_timeout, sizeof(no_timeout));
+        }
+        return Stream(client_socket_fd);
+    }
+
+    Stream StreamFactory::CreateTcpStreamToServer(std::string ip_address, uint16_t port, IP_VERSION version,
+                                                  const StreamOptions &options, int timeout_ms) {
+        return CreateTcpStreamToAnyServer({Endpoint{.ip_address = ip_address, .port = port, .version = version}},
+                                          timeout_ms, kDefaultConnectStaggerMs, options);
+    }
+
+    Stream StreamFactory::CreateTcpStreamToAnyServer(const std::vector<Endpoint> &candidates, int timeout_ms,
+                                                     int stagger_ms, const StreamOptions &options) {
+        using clock = std::chrono::steady_clock;
+        auto deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+        auto next_start = clock::now();
+        std::vector<pollfd> pending;
+        size_t next_candidate = 0;
+        int last_error = ECONNREFUSED;
+        auto close_pending = [&pending]() {
+            for (auto &p: pending) {
+                ::close(p.fd);
+            }
+        };
+        while (true) {
+            // start the next attempt, if it is due or nothing else is running
+            if (next_candidate < candidates.size() && (pending.empty() || clock::now() >= next_start)) {
+                bool connected = false;
+                int fd;
+                try {
+                    fd = startConnect(candidates[next_candidate++], options, connected, last_error);
+                } catch (SocketException &) {
+                    close_pending(); // e.g. the socket could not be created or configured
+                    throw;
+                }
+                next_start = clock::now() + std::chrono::milliseconds(stagger_ms);
+                if (connected) {
+                    close_pending();
+                    return Stream(finishConnect(fd));
+                } else if (fd >= 0) {
+                    pending.push_back({.fd = fd, .events = POLLOUT, .revents = 0});
+                }
+                continue;
+            }
+            if (pending.empty()) {
+                throw SocketException(SocketException::SOCKET_CONNECT, last_error);
+            }
+            // wait until an attempt finishes, the next one is due or the deadline passed
+            auto wait_until = next_candidate < candidates.size() ? next_start : clock::time_point::max();
+            if (timeout_ms >= 0) {
+                if (clock::now() >= deadline) {
+                    close_pending();
+                    throw SocketException(SocketException::SOCKET_CONNECT, ETIMEDOUT);
+                }
+                wait_until = std::min(wait_until, deadline);
+            }
+            int wait_ms = -1;
+            if (wait_until != clock::time_point::max()) {
+                auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(wait_until - clock::now());
+                wait_ms = (int) std::max<int64_t>(remaining.count() + 1, 0);
+            }
+            if (poll(pending.data(), pending.size(), wait_ms) == -1 && errno != EINTR) {
+                close_pending();
+                throw SocketException(SocketException::SOCKET_POLL, errno);
+            }
+            for (auto it = pending.begin(); it != pending.end();) {
+                if (it->revents == 0) {
+                    ++it;
+                    continue;
+                }
+                int connect_error = 0;
+                socklen_t connect_error_length = sizeof(connect_error);
+                if (getsockopt(it->fd, SOL_SOCKET, SO_ERROR, &connect_error, &connect_error_length) < 0) {
+                    connect_error = errno;
+                }
+                if (connect_error == 0) {
+                    int fd = it->fd;
+                    pending.erase(it);
+                    close_pending();
+                    return Stream(finishConnect(fd));
+                }
+                // this attempt failed, start the next one right away
+                last_error = connect_error;
+                ::close(it->fd);
+                it = pending.erase(it);
+                next_start = clock::now();
+            }
+        }
+    }
+
+    /**
+     * creates a non blocking socket and starts connecting it
+     * @return the socket, or -1 if the attempt failed right away (error is set)
+     */
+    int startConnect(const Endpoint &endpoint, const StreamOptions &options, bool &connected, int &error) {
+        sockaddr_storage server_addr{};
+        socklen_t server_addr_length;
+        int family;
+        if (endpoint.version == IP_VERSION::IPv6) {
+            auto addr = (sockaddr_in6 *) &server_addr;
+            family = addr->sin6_family = AF_INET6;
+            addr->sin6_port = htons(endpoint.port);
+            if (inet_pton(AF_INET6, endpoint.ip_address.c_str(), &addr->sin6_addr) != 1) {
+                error = EINVAL;
+                return -1;
+            }
+            server_addr_length = sizeof(sockaddr_in6);
+        } else {
+            auto addr = (sockaddr_in *) &server_addr;
+            family = addr->sin_family = AF_INET;
+            addr->sin_port = htons(endpoint.port);
+            if (inet_pton(AF_INET, endpoint.ip_address.c_str(), &addr->sin_addr) != 1) {
+                error = EINVAL;
+                return -1;
+            }
+            server_addr_length = sizeof(sockaddr_in);
+        }
+        int client_socket_fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+        if (client_socket_fd < 0) {
+            throw SocketException(SocketException::SOCKET_SOCKET, errno);
+        }
+        try {
+            applyStreamOptions(client_socket_fd, options);
+        } catch (SocketException &) {
+            ::close(client_socket_fd);
+            throw;
+        }
+        if (::connect(client_socket_fd, (struct sockaddr *) &server_addr, server_addr_length) == 0) {
+            connected = true;
+        } else if (errno != EINPROGRESS) {
+            error = errno;
+            ::close(client_socket_fd);
+            return -1;
+        }
+        return client_socket_fd;
+    }
+
+    /**
+     * switches a connected socket back to blocking mode
+     * @return the socket
+     */
+    int finishConnect(int fd) {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags == -1 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+            int error = errno;
+            ::close(fd);
+            throw SocketException(SocketException::SOCKET_SET_OPTION, error);
+        }
+        return fd;
+    }
+}
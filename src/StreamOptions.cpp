@@ -0,0 +1,75 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "socket_wrapper/StreamOptions.h"
+#include "socket_wrapper/SocketException.h"
+
+namespace socket_wrapper {
+    int const StreamOptions::kUnset;
+
+    // declared here to not make them "public" in header
+    void setIntOption(int fd, int level, int option, int value);
+
+    int getIntOption(int fd, int level, int option);
+
+    void applyStreamOptions(int fd, const StreamOptions &options) {
+        setIntOption(fd, SOL_SOCKET, SO_SNDBUF, options.send_buffer_size);
+        setIntOption(fd, SOL_SOCKET, SO_RCVBUF, options.receive_buffer_size);
+#ifdef SO_BUSY_POLL
+        setIntOption(fd, SOL_SOCKET, SO_BUSY_POLL, options.busy_poll_us);
+#endif
+        setIntOption(fd, SOL_SOCKET, SO_PRIORITY, options.priority);
+        setIntOption(fd, IPPROTO_TCP, TCP_NODELAY, options.tcp_nodelay);
+        setIntOption(fd, IPPROTO_TCP, TCP_QUICKACK, options.tcp_quickack);
+        setIntOption(fd, IPPROTO_TCP, TCP_CORK, options.tcp_cork);
+        setIntOption(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, options.tcp_notsent_lowat);
+        if (options.ip_tos != StreamOptions::kUnset) {
+            if (getIntOption(fd, SOL_SOCKET, SO_DOMAIN) == AF_INET6) {
+                setIntOption(fd, IPPROTO_IPV6, IPV6_TCLASS, options.ip_tos);
+            } else {
+                setIntOption(fd, IPPROTO_IP, IP_TOS, options.ip_tos);
+            }
+        }
+    }
+
+    StreamOptions getEffectiveStreamOptions(int fd) {
+        StreamOptions options;
+        int domain = getIntOption(fd, SOL_SOCKET, SO_DOMAIN);
+        options.send_buffer_size = getIntOption(fd, SOL_SOCKET, SO_SNDBUF);
+        options.receive_buffer_size = getIntOption(fd, SOL_SOCKET, SO_RCVBUF);
+#ifdef SO_BUSY_POLL
+        options.busy_poll_us = getIntOption(fd, SOL_SOCKET, SO_BUSY_POLL);
+#endif
+        options.priority = getIntOption(fd, SOL_SOCKET, SO_PRIORITY);
+        if (getIntOption(fd, SOL_SOCKET, SO_PROTOCOL) == IPPROTO_TCP) {
+            options.tcp_nodelay = getIntOption(fd, IPPROTO_TCP, TCP_NODELAY);
+            options.tcp_quickack = getIntOption(fd, IPPROTO_TCP, TCP_QUICKACK);
+            options.tcp_cork = getIntOption(fd, IPPROTO_TCP, TCP_CORK);
+            options.tcp_notsent_lowat = getIntOption(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+        }
+        if (domain == AF_INET6) {
+            options.ip_tos = getIntOption(fd, IPPROTO_IPV6, IPV6_TCLASS);
+        } else if (domain == AF_INET) {
+            options.ip_tos = getIntOption(fd, IPPROTO_IP, IP_TOS);
+        }
+        return options;
+    }
+
+    void setIntOption(int fd, int level, int option, int value) {
+        if (value == StreamOptions::kUnset) {
+            return;
+        }
+        if (setsockopt(fd, level, option, &value, sizeof(value)) < 0) {
+            throw SocketException(SocketException::SOCKET_SET_OPTION, errno);
+        }
+    }
+
+    int getIntOption(int fd, int level, int option) {
+        int value = 0;
+        socklen_t value_length = sizeof(value);
+        if (getsockopt(fd, level, option, &value, &value_length) < 0) {
+            return StreamOptions::kUnset;
+        }
+        return value;
+    }
+}
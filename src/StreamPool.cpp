@@ -0,0 +1,161 @@
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <array>
+#include "socket_wrapper/StreamPool.h"
+#include "socket_wrapper/StreamFactory.h"
+#include "socket_wrapper/SocketException.h"
+
+namespace socket_wrapper {
+
+    StreamPool::Lease::Lease(StreamPool *pool, Endpoint endpoint, std::unique_ptr<Stream> stream)
+            : pool(pool), endpoint(std::move(endpoint)), stream(std::move(stream)) {}
+
+    StreamPool::Lease::Lease(Lease &&src) noexcept: pool(src.pool), endpoint(std::move(src.endpoint)),
+                                                    stream(std::move(src.stream)), discarded(src.discarded) {
+        src.pool = nullptr;
+    }
+
+    StreamPool::Lease::~Lease() noexcept {
+        if (pool != nullptr && stream) {
+            pool->release(endpoint, std::move(stream), discarded);
+        }
+    }
+
+    Stream &StreamPool::Lease::operator*() {
+        return *stream;
+    }
+
+    Stream *StreamPool::Lease::operator->() {
+        return stream.get();
+    }
+
+    void StreamPool::Lease::discard() {
+        discarded = true;
+    }
+
+    StreamPool::StreamPool(size_t min_idle_per_endpoint, size_t max_connections_per_endpoint,
+                           const StreamOptions &options, int connect_timeout_ms)
+            : min_idle_per_endpoint(min_idle_per_endpoint),
+              max_connections_per_endpoint(std::max<size_t>(max_connections_per_endpoint, 1)),
+              options(options), connect_timeout_ms(connect_timeout_ms) {}
+
+    StreamPool::Lease StreamPool::acquire(const Endpoint &endpoint, int timeout_ms) {
+        auto wait_start = std::chrono::steady_clock::now();
+        auto deadline = wait_start + std::chrono::milliseconds(timeout_ms);
+        std::unique_lock<std::mutex> lk(pools_mtx);
+        auto &pool = pools[endpoint];
+        uint64_t ticket = next_ticket++;
+        pool.waiters.push_back(ticket);
+        auto my_turn = [&]() {
+            return pool.waiters.front() == ticket &&
+                   (!pool.idle.empty() || pool.open_connections < max_connections_per_endpoint);
+        };
+        if (!my_turn()) {
+            stats.waits++;
+            bool got_turn = true;
+            if (timeout_ms < 0) {
+                pools_cv.wait(lk, my_turn);
+            } else {
+                got_turn = pools_cv.wait_until(lk, deadline, my_turn);
+            }
+            stats.total_wait_us += std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - wait_start).count();
+            if (!got_turn) {
+                pool.waiters.remove(ticket);
+                pools_cv.notify_all();
+                throw SocketException(SocketException::SOCKET_CONNECT, ETIMEDOUT);
+            }
+        }
+        pool.waiters.pop_front();
+        pools_cv.notify_all(); // the next waiter may be served as well
+        while (!pool.idle.empty()) {
+            auto stream = std::move(pool.idle.front());
+            pool.idle.pop_front();
+            if (isIdleStreamAlive(*stream)) {
+                stats.hits++;
+                return Lease(this, endpoint, std::move(stream));
+            }
+            pool.open_connections--;
+            stats.discarded++;
+        }
+        stats.misses++;
+        pool.open_connections++;
+        lk.unlock();
+        try {
+            return Lease(this, endpoint, connect(endpoint));
+        } catch (...) {
+            lk.lock();
+            pool.open_connections--;
+            pools_cv.notify_all();
+            throw;
+        }
+    }
+
+    void StreamPool::prefill(const Endpoint &endpoint) {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lk(pools_mtx);
+                auto &pool = pools[endpoint];
+                if (pool.idle.size() >= min_idle_per_endpoint ||
+                    pool.open_connections >= max_connections_per_endpoint) {
+                    return;
+                }
+                pool.open_connections++;
+            }
+            std::unique_ptr<Stream> stream;
+            try {
+                stream = connect(endpoint);
+            } catch (...) {
+                std::lock_guard<std::mutex> lk(pools_mtx);
+                pools[endpoint].open_connections--;
+                pools_cv.notify_all();
+                throw;
+            }
+            release(endpoint, std::move(stream), false);
+        }
+    }
+
+    size_t StreamPool::getIdleCount(const Endpoint &endpoint) {
+        std::lock_guard<std::mutex> lk(pools_mtx);
+        return pools[endpoint].idle.size();
+    }
+
+    StreamPool::Stats StreamPool::getStats() {
+        std::lock_guard<std::mutex> lk(pools_mtx);
+        return stats;
+    }
+
+    void StreamPool::release(const Endpoint &endpoint, std::unique_ptr<Stream> stream, bool discarded) {
+        std::unique_ptr<Stream> to_close; // closed outside of the lock
+        {
+            std::lock_guard<std::mutex> lk(pools_mtx);
+            auto &pool = pools[endpoint];
+            if (discarded) {
+                pool.open_connections--;
+                stats.discarded++;
+                to_close = std::move(stream);
+            } else {
+                pool.idle.push_back(std::move(stream));
+            }
+        }
+        pools_cv.notify_all();
+    }
+
+    std::unique_ptr<Stream> StreamPool::connect(const Endpoint &endpoint) {
+        return std::unique_ptr<Stream>(new Stream(StreamFactory::CreateTcpStreamToServer(
+                endpoint.ip_address, endpoint.port, endpoint.version, options, connect_timeout_ms)));
+    }
+
+    bool StreamPool::isIdleStreamAlive(Stream &stream) {
+        std::array<pollfd, 1> poll_fds = {{{.fd = stream.getFdForPoll(), .events = POLLIN | POLLRDHUP, .revents = 0}}};
+        if (poll(poll_fds.data(), poll_fds.size(), 0) == -1) {
+            return false;
+        }
+        if (poll_fds[0].revents & (POLLERR | POLLHUP | POLLRDHUP | POLLNVAL)) {
+            return false;
+        }
+        // an idle Stream must not have data pending, the peer either closed it or the previous user left data behind
+        return (poll_fds[0].revents & POLLIN) == 0;
+    }
+}
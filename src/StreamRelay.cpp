@@ -0,0 +1,168 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include "socket_wrapper/StreamRelay.h"
+#include "socket_wrapper/SocketException.h"
+
+namespace socket_wrapper {
+
+    StreamRelay::StreamRelay(Stream first, Stream second, int idle_timeout_ms)
+            : first(std::move(first)), second(std::move(second)), idle_timeout_ms(idle_timeout_ms) {
+        directions[0].source = &this->first;
+        directions[0].destination = &this->second;
+        directions[1].source = &this->second;
+        directions[1].destination = &this->first;
+        for (size_t i = 0; i < directions.size(); i++) {
+            auto &d = directions[i];
+            if (pipe2(d.pipe_fds.data(), O_NONBLOCK | O_CLOEXEC) == -1) {
+                int error = errno;
+                if (i == 1) {
+                    ::close(directions[0].pipe_fds[0]);
+                    ::close(directions[0].pipe_fds[1]);
+                }
+                throw SocketException(SocketException::SOCKET_SOCKET, error);
+            }
+            // a larger pipe is best effort, it is limited by /proc/sys/fs/pipe-max-size for unprivileged users
+            fcntl(d.pipe_fds[1], F_SETPIPE_SZ, kPipeSize);
+            int capacity = fcntl(d.pipe_fds[1], F_GETPIPE_SZ);
+            d.pipe_capacity = capacity > 0 ? capacity : 65536;
+        }
+    }
+
+    StreamRelay::~StreamRelay() noexcept {
+        for (auto &d: directions) {
+            ::close(d.pipe_fds[0]);
+            ::close(d.pipe_fds[1]);
+        }
+    }
+
+    void StreamRelay::run() {
+        // splice only honours SPLICE_F_NONBLOCK for the pipe, the sockets have to be non blocking themselves
+        struct restore_flags {
+            int fd, flags;
+            ~restore_flags() { fcntl(fd, F_SETFL, flags); }
+        };
+        std::vector<restore_flags> restore;
+        for (Stream *s: {&first, &second}) {
+            int flags = fcntl(s->stream_file_descriptor, F_GETFL);
+            if (flags == -1 || fcntl(s->stream_file_descriptor, F_SETFL, flags | O_NONBLOCK) == -1) {
+                throw SocketException(SocketException::SOCKET_SET_OPTION, errno);
+            }
+            restore.push_back({s->stream_file_descriptor, flags});
+        }
+
+        auto last_activity = std::chrono::steady_clock::now();
+        while (!directions[0].destination_shut_down || !directions[1].destination_shut_down) {
+            if (first.isTerminationRequested() || second.isTerminationRequested()) {
+                throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+            }
+            bool progress = false;
+            for (auto &d: directions) {
+                progress = pump(d) || progress;
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (progress) {
+                last_activity = now;
+                continue;
+            }
+            int timeout_ms = -1;
+            if (idle_timeout_ms >= 0) {
+                auto idle_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_activity).count();
+                if (idle_ms >= idle_timeout_ms) {
+                    throw SocketException(SocketException::SOCKET_READ_TIMEOUT, 0);
+                }
+                timeout_ms = (int) (idle_timeout_ms - idle_ms);
+            }
+            // wait for the source of a direction with room in its pipe, or the destination of a direction with data
+            std::array<pollfd, 4> poll_fds = {{{.fd = first.stream_file_descriptor, .events = 0, .revents = 0},
+                                               {.fd = second.stream_file_descriptor, .events = 0, .revents = 0},
+                                               {.fd = first.cancellation_domain->getFdForPoll(), .events = POLLIN, .revents = 0},
+                                               {.fd = second.cancellation_domain->getFdForPoll(), .events = POLLIN, .revents = 0}}};
+            for (size_t i = 0; i < directions.size(); i++) {
+                auto &d = directions[i];
+                if (!d.source_closed && d.bytes_in_pipe < d.pipe_capacity) {
+                    poll_fds[i].events |= POLLIN;
+                }
+                if (d.bytes_in_pipe > 0) {
+                    poll_fds[1 - i].events |= POLLOUT;
+                }
+            }
+            for (size_t i = 0; i < 2; i++) {
+                if (poll_fds[i].events == 0) {
+                    poll_fds[i].fd = -1; // a hangup would be reported, even though nothing is waited for
+                }
+            }
+            // stop wakes up the poll through the domains, the flags are checked again after registering
+            StopRequest::Waiter first_waiter(first.stop_request, *first.cancellation_domain);
+            StopRequest::Waiter second_waiter(second.stop_request, *second.cancellation_domain);
+            if (first.isTerminationRequested() || second.isTerminationRequested()) {
+                continue;
+            }
+            if (poll(poll_fds.data(), poll_fds.size(), timeout_ms) == -1 && errno != EINTR) {
+                throw SocketException(SocketException::SOCKET_POLL, errno);
+            }
+            if (poll_fds[2].revents != 0 || poll_fds[3].revents != 0) {
+                std::this_thread::yield(); // possibly another socket of a domain was stopped
+            }
+        }
+        if (first.isTerminationRequested() || second.isTerminationRequested()) {
+            // stop was called while the last data was forwarded
+            throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+        }
+    }
+
+    bool StreamRelay::pump(direction &d) {
+        bool progress = false;
+        while (!d.source_closed && d.bytes_in_pipe < d.pipe_capacity) {
+            ssize_t result = splice(d.source->stream_file_descriptor, nullptr, d.pipe_fds[1], nullptr,
+                                    d.pipe_capacity - d.bytes_in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (result > 0) {
+                d.bytes_in_pipe += result;
+                progress = true;
+            } else if (result == 0) {
+                d.source_closed = true; // the source closed its sending direction
+                progress = true;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else if (errno != EINTR) {
+                throw SocketException(SocketException::SOCKET_READ, errno);
+            }
+        }
+        while (d.bytes_in_pipe > 0) {
+            ssize_t result = splice(d.pipe_fds[0], nullptr, d.destination->stream_file_descriptor, nullptr,
+                                    d.bytes_in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (result > 0) {
+                d.bytes_in_pipe -= result;
+                d.forwarded_bytes += result;
+                progress = true;
+            } else if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else if (result == -1 && errno != EINTR) {
+                throw SocketException(SocketException::SOCKET_WRITE, errno, d.forwarded_bytes.load());
+            }
+        }
+        if (d.source_closed && d.bytes_in_pipe == 0 && !d.destination_shut_down) {
+            // forward the half close
+            ::shutdown(d.destination->stream_file_descriptor, SHUT_WR);
+            d.destination_shut_down = true;
+        }
+        return progress;
+    }
+
+    void StreamRelay::stop() {
+        first.stopReads();
+        second.stopReads();
+    }
+
+    uint64_t StreamRelay::getBytesFirstToSecond() const {
+        return directions[0].forwarded_bytes.load();
+    }
+
+    uint64_t StreamRelay::getBytesSecondToFirst() const {
+        return directions[1].forwarded_bytes.load();
+    }
+}
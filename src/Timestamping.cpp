@@ -0,0 +1,106 @@
+#include <ctime>
+#include <cerrno>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include "socket_wrapper/Timestamping.h"
+#include "socket_wrapper/SocketException.h"
+
+namespace socket_wrapper {
+    // declared here to not make them "public" in header
+    namespace {
+        int64_t toNs(const timespec &ts) {
+            return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        }
+
+        // the control buffer has to hold the timestamps and the extended error, including the offending address
+        size_t const kControlBufferSize = 512;
+    }
+
+    void enableKernelTimestamps(int fd, bool transmit) {
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        if (transmit) {
+            int protocol = 0;
+            socklen_t length = sizeof(protocol);
+            getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &protocol, &length);
+            // OPT_ID numbers the writes, OPT_TSONLY avoids looping the payload back into the error queue
+            flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_SCHED | SOF_TIMESTAMPING_OPT_ID |
+                     SOF_TIMESTAMPING_OPT_TSONLY;
+            if (protocol == IPPROTO_TCP) {
+                flags |= SOF_TIMESTAMPING_TX_ACK;
+            }
+        }
+        if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0) {
+            return;
+        }
+        int error = errno;
+        int one = 1;
+        if (transmit || setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) != 0) {
+            throw SocketException(SocketException::SOCKET_SET_OPTION, error);
+        }
+    }
+
+    int64_t getReceiveTimestampNs(const msghdr &msg) {
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR((msghdr *) &msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET) {
+                continue;
+            }
+            if (cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                auto timestamps = (const scm_timestamping *) CMSG_DATA(cmsg);
+                // ts[0] holds the software timestamp, ts[2] a hardware timestamp
+                return toNs(timestamps->ts[0].tv_sec != 0 ? timestamps->ts[0] : timestamps->ts[2]);
+            } else if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                return toNs(*(const timespec *) CMSG_DATA(cmsg));
+            }
+        }
+        return -1;
+    }
+
+    size_t readTxTimestamps(int fd, std::vector<TxTimestamp> &timestamps) {
+        size_t read_timestamps = 0;
+        while (true) {
+            char control[kControlBufferSize];
+            msghdr msg{};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return read_timestamps;
+                } else if (errno == EINTR) {
+                    continue;
+                }
+                throw SocketException(SocketException::SOCKET_READ, errno);
+            }
+            int64_t kernel_time_ns = -1;
+            const sock_extended_err *extended_error = nullptr;
+            for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                    auto ts = (const scm_timestamping *) CMSG_DATA(cmsg);
+                    kernel_time_ns = toNs(ts->ts[0].tv_sec != 0 ? ts->ts[0] : ts->ts[2]);
+                } else if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                           (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                    extended_error = (const sock_extended_err *) CMSG_DATA(cmsg);
+                }
+            }
+            if (extended_error == nullptr || extended_error->ee_errno != ENOMSG ||
+                extended_error->ee_origin != SO_EE_ORIGIN_TIMESTAMPING || kernel_time_ns < 0) {
+                continue; // not a timestamp (e.g. an icmp error), it was consumed nevertheless
+            }
+            TX_TIMESTAMP_TYPE type = TX_TIMESTAMP_SENT;
+            if (extended_error->ee_info == SCM_TSTAMP_SCHED) {
+                type = TX_TIMESTAMP_SCHEDULED;
+            } else if (extended_error->ee_info == SCM_TSTAMP_ACK) {
+                type = TX_TIMESTAMP_ACKNOWLEDGED;
+            }
+            timestamps.push_back({.byte_offset = extended_error->ee_data, .type = type,
+                                  .kernel_time_ns = kernel_time_ns});
+            read_timestamps++;
+        }
+    }
+
+    int64_t getRealtimeNs() {
+        timespec now{};
+        clock_gettime(CLOCK_REALTIME, &now);
+        return toNs(now);
+    }
+}
@@ -1,10 +1,11 @@
 #include <sys/poll.h>
-#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <cstring>
 #include <arpa/inet.h>
 #include "socket_wrapper/Stream.h"
 #include "socket_wrapper/SocketException.h"
+#include "socket_wrapper/IoBackend.h"
+#include "socket_wrapper/Timestamping.h"
 #include <iostream>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -14,7 +15,8 @@
 namespace socket_wrapper {
 
     UdpDatagram::UdpDatagram(const std::string &listener_ip_addr, uint16_t listener_port,
-                             socket_wrapper::IP_VERSION version, int buffer_size) : ip_version(version) {
+                             socket_wrapper::IP_VERSION version, int buffer_size, const StreamOptions &options)
+            : ip_version(version) {
         if (version == IP_VERSION::IPv6) {
             struct sockaddr_in6 receiver_address;
             if ((socket_fd = socket(AF_INET6, SOCK_DGRAM | SO_REUSEADDR, IPPROTO_UDP)) < 0) {
@@ -25,6 +27,12 @@ namespace socket_wrapper {
 #ifdef SO_REUSEPORT
             setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(int));
 #endif
+            try {
+                applyStreamOptions(socket_fd, options);
+            } catch (SocketException &) {
+                ::close(socket_fd); // the destructor does not run for a failed constructor
+                throw;
+            }
             bzero(&receiver_address, sizeof(receiver_address));
             // assign IP, PORT
             receiver_address.sin6_family = AF_INET6;
@@ -46,6 +54,12 @@ namespace socket_wrapper {
 #ifdef SO_REUSEPORT
             setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(int));
 #endif
+            try {
+                applyStreamOptions(socket_fd, options);
+            } catch (SocketException &) {
+                ::close(socket_fd); // the destructor does not run for a failed constructor
+                throw;
+            }
             bzero(&receiver_address, sizeof(receiver_address));
             // assign IP, PORT
             receiver_address.sin_family = AF_INET;
@@ -58,26 +72,36 @@ namespace socket_wrapper {
 
         }
         buffer = std::vector<char>(buffer_size);
-        stop_all_operations_event_fd.store(eventfd(0, EFD_SEMAPHORE));
-        if (stop_all_operations_event_fd.load() == -1) {
-            throw std::runtime_error("Failed to create event_fd");
-        }
     }
 
     UdpDatagram &UdpDatagram::operator=(UdpDatagram &&stream_to_assign) noexcept {
+        if (socket_fd >= 0) {
+            ::close(socket_fd);
+        }
+        buffer = std::move(stream_to_assign.buffer);
+        ip_version = stream_to_assign.ip_version;
         socket_fd = stream_to_assign.socket_fd.load();
         stream_to_assign.socket_fd = kInvalidSocketFdMarker;
-        stop_all_operations_event_fd.store(stream_to_assign.stop_all_operations_event_fd.load());
+        cancellation_domain = stream_to_assign.cancellation_domain;
+        stop_request.assign(stream_to_assign.stop_request);
+        stats = std::move(stream_to_assign.stats);
+        timestamps_enabled.store(stream_to_assign.timestamps_enabled.load());
+        tx_timestamps = std::move(stream_to_assign.tx_timestamps);
+        busy_poller = std::move(stream_to_assign.busy_poller);
         return *this;
     }
 
 
-    UdpDatagram::UdpDatagram(UdpDatagram &&src) noexcept {
-        {
-            socket_fd = src.socket_fd.load();
-            src.socket_fd = kInvalidSocketFdMarker;
-        }
-        stop_all_operations_event_fd.store(src.stop_all_operations_event_fd.load());
+    UdpDatagram::UdpDatagram(UdpDatagram &&src) noexcept: buffer(std::move(src.buffer)),
+                                                          ip_version(src.ip_version) {
+        socket_fd = src.socket_fd.load();
+        src.socket_fd = kInvalidSocketFdMarker;
+        cancellation_domain = src.cancellation_domain;
+        stop_request.assign(src.stop_request);
+        stats = std::move(src.stats);
+        timestamps_enabled.store(src.timestamps_enabled.load());
+        tx_timestamps = std::move(src.tx_timestamps);
+        busy_poller = std::move(src.busy_poller);
     }
 
     UdpDatagram::~UdpDatagram() noexcept {
@@ -85,8 +109,7 @@ namespace socket_wrapper {
             return;
         }
         // notify other functions (read) of termination
-        uint64_t semaphore_value = std::numeric_limits<uint16_t>::max();
-        ::write(stop_all_operations_event_fd, &semaphore_value, sizeof(semaphore_value));
+        stopReads();
         if (close(socket_fd)) {
             // TODO: log error
             std::terminate();
@@ -95,21 +118,126 @@ namespace socket_wrapper {
     }
 
     std::vector<char> UdpDatagram::read(int timeout_ms) {
-        std::array<pollfd, 2> poll_fds = {{{.fd = socket_fd, .events = POLLIN, .revents = 0},
-                                           {.fd = stop_all_operations_event_fd, .events = POLLIN, .revents = 0}}};
-        if (poll(poll_fds.data(), poll_fds.size(), timeout_ms) == timeout_ms) {
-            throw socket_wrapper::SocketException(SocketException::SOCKET_POLL, errno);
-        } else if (poll_fds[0].revents != 0) {
-            struct msghdr msg;
-            struct iovec iov;
-            msg = setMsghdrParams(msg, iov);
-            ssize_t read_result = recvmsg(socket_fd, &msg, 0);
-            assertRecvmsgSucceded(msg, read_result);
-            return {buffer.begin(), buffer.begin() + read_result};
-        } else if (poll_fds[1].revents != 0) {
-            throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, errno);
-        } else {
-            throw SocketException(SocketException::SOCKET_READ_TIMEOUT, errno);
+        struct msghdr msg;
+        struct iovec iov;
+        msg = setMsghdrParams(msg, iov);
+        size_t read_bytes = receive(msg, timeout_ms);
+        return {buffer.begin(), buffer.begin() + read_bytes};
+    }
+
+    TimestampedDatagram UdpDatagram::readTimestamped(int timeout_ms) {
+        struct msghdr msg;
+        struct iovec iov;
+        msg = setMsghdrParams(msg, iov);
+        size_t read_bytes = receive(msg, timeout_ms);
+        return {.data = std::vector<char>(buffer.begin(), buffer.begin() + read_bytes),
+                .kernel_receive_ns = getReceiveTimestampNs(msg)};
+    }
+
+    size_t UdpDatagram::receive(msghdr &msg, int timeout_ms) {
+        if (isTerminationRequested()) {
+            throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+        }
+        std::shared_ptr<BusyPoller> poller;
+        {
+            // a copy, so disableBusyPolling can not reset it while this read uses it
+            std::lock_guard<std::mutex> lk(busy_poller_mtx);
+            poller = busy_poller;
+        }
+        if (poller) {
+            // spin on the socket before paying for a wakeup
+            ssize_t read_result = poller->spin([&]() { return recvmsg(socket_fd, &msg, MSG_DONTWAIT); });
+            if (read_result == 0 && isTerminationRequested()) {
+                throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+            } else if (read_result >= 0 || errno != EAGAIN) {
+                if (stats) {
+                    Stats::add(stats->read_syscalls);
+                    Stats::add(stats->bytes_in, read_result > 0 ? read_result : 0);
+                }
+                assertRecvmsgSucceded(msg, read_result);
+                poller->recordArrival();
+                return read_result;
+            }
+            // the budget was used up, block
+        }
+        IoUring *ring = IoUring::forCurrentThread();
+        if (ring != nullptr) {
+            // wait for and receive the datagram with a single submission
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+            ssize_t read_result;
+            while (true) {
+                StopRequest::Waiter waiter(stop_request, *cancellation_domain);
+                if (isTerminationRequested()) {
+                    throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+                }
+                auto wait_start = stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+                read_result = ring->recvmsg(socket_fd, &msg, cancellation_domain->getFdForPoll(),
+                                            Stream::remainingMs(timeout_ms, deadline, 0,
+                                                                SocketException::SOCKET_READ_TIMEOUT));
+                if (stats) {
+                    Stats::add(stats->read_syscalls);
+                    stats->read_wait_us.record(Stats::elapsedUs(wait_start));
+                    Stats::add(stats->bytes_in, read_result > 0 ? read_result : 0);
+                }
+                if (read_result != IoUring::kTerminated || isTerminationRequested()) {
+                    break;
+                }
+                std::this_thread::yield(); // another socket of the domain was stopped
+            }
+            if (read_result == IoUring::kTerminated) {
+                throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+            } else if (read_result == IoUring::kTimedOut) {
+                throw SocketException(SocketException::SOCKET_READ_TIMEOUT, 0);
+            } else if (read_result < 0) {
+                errno = (int) -read_result;
+            } else if (read_result == 0 && isTerminationRequested()) {
+                throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+            }
+            assertRecvmsgSucceded(msg, read_result < 0 ? -1 : read_result);
+            if (poller) {
+                poller->recordArrival();
+            }
+            return read_result;
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        int wait_ms = timeout_ms;
+        StopRequest::Waiter waiter(stop_request, *cancellation_domain);
+        while (true) {
+            if (isTerminationRequested()) {
+                throw SocketException(SocketException::SOCKET_TERMINATION_REQUEST, 0);
+            }
+            std::array<pollfd, 2> poll_fds = {{{.fd = socket_fd, .events = POLLIN, .revents = 0},
+                                               {.fd = cancellation_domain->getFdForPoll(), .events = POLLIN, .revents = 0}}};
+            auto wait_start = stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+            int poll_result = poll(poll_fds.data(), poll_fds.size(), wait_ms);
+            if (stats) {
+                Stats::add(stats->poll_syscalls);
+                stats->read_wait_us.record(Stats::elapsedUs(wait_start));
+            }
+            if (poll_result == -1) {
+                throw socket_wrapper::SocketException(SocketException::SOCKET_POLL, errno);
+            } else if (poll_fds[0].revents == POLLERR && collectTxTimestamps() > 0) {
+                // only transmit timestamps were queued, keep waiting for a datagram until the deadline
+                wait_ms = Stream::remainingMs(timeout_ms, deadline, 0, SocketException::SOCKET_READ_TIMEOUT);
+                continue;
+            } else if (poll_fds[0].revents != 0) {
+                ssize_t read_result = recvmsg(socket_fd, &msg, 0);
+                if (stats) {
+                    Stats::add(stats->read_syscalls);
+                    Stats::add(stats->bytes_in, read_result > 0 ? read_result : 0);
+                }
+                assertRecvmsgSucceded(msg, read_result);
+                if (poller) {
+                    poller->recordArrival();
+                }
+                return read_result;
+            } else if (poll_fds[1].revents != 0) {
+                // checked at the top of the loop, another socket of the domain may have been stopped
+                std::this_thread::yield();
+                wait_ms = Stream::remainingMs(timeout_ms, deadline, 0, SocketException::SOCKET_READ_TIMEOUT);
+            } else {
+                throw SocketException(SocketException::SOCKET_READ_TIMEOUT, errno);
+            }
         }
     }
 
@@ -127,8 +255,9 @@ namespace socket_wrapper {
         msg.msg_name = NULL;
         msg.msg_namelen = 0;
         msg.msg_iovlen = 1;
-        msg.msg_control = NULL;
-        msg.msg_controllen = 0;
+        // the timestamps are passed as control messages
+        msg.msg_control = timestamps_enabled ? control_buffer.data() : NULL;
+        msg.msg_controllen = timestamps_enabled ? control_buffer.size() : 0;
         msg.msg_flags = 0;
         return msg;
     }
@@ -143,15 +272,77 @@ namespace socket_wrapper {
             dst_addr.sin_family = AF_INET;
             dst_addr.sin_addr.s_addr = inet_addr(destination_ip.c_str());
             dst_addr.sin_port = htons(port);
-            if (sendto(socket_fd, msg_data.data(), msg_data.size(), 0, (struct sockaddr *) &dst_addr,
-                       sizeof(dst_addr)) == -1) {
+            ssize_t write_result = sendto(socket_fd, msg_data.data(), msg_data.size(), 0,
+                                          (struct sockaddr *) &dst_addr, sizeof(dst_addr));
+            if (stats) {
+                Stats::add(stats->write_syscalls);
+                Stats::add(stats->bytes_out, write_result > 0 ? write_result : 0);
+            }
+            if (write_result == -1) {
                 throw SocketException(SocketException::SOCKET_WRITE, errno);
             }
         }
     }
     void UdpDatagram::stopReads() {
-        uint64_t semaphore_value = std::numeric_limits<uint16_t>::max();
-        ::write(stop_all_operations_event_fd, &semaphore_value, sizeof(semaphore_value));
+        // the flag is set before waking up the readers
+        stop_request.request(*cancellation_domain);
+    }
+
+    void UdpDatagram::setCancellationDomain(std::shared_ptr<CancellationDomain> domain) {
+        cancellation_domain = std::move(domain);
+    }
+
+    void UdpDatagram::enableBusyPolling(int max_spin_us, bool adaptive) {
+        std::lock_guard<std::mutex> lk(busy_poller_mtx);
+        busy_poller = std::make_shared<BusyPoller>(max_spin_us, adaptive);
+        // let the driver poll the device queue as well, raising the limit may require CAP_NET_ADMIN
+        setsockopt(socket_fd, SOL_SOCKET, SO_BUSY_POLL, &max_spin_us, sizeof(max_spin_us));
+    }
+
+    void UdpDatagram::disableBusyPolling() {
+        std::lock_guard<std::mutex> lk(busy_poller_mtx);
+        busy_poller.reset();
+    }
+
+    void UdpDatagram::enableTimestamps() {
+        enableKernelTimestamps(socket_fd, true);
+        timestamps_enabled = true;
+    }
+
+    std::vector<TxTimestamp> UdpDatagram::readTxTimestamps() {
+        collectTxTimestamps();
+        std::lock_guard<std::mutex> lk(tx_timestamps_mtx);
+        std::vector<TxTimestamp> result;
+        result.swap(tx_timestamps);
+        return result;
+    }
+
+    size_t UdpDatagram::collectTxTimestamps() {
+        if (!timestamps_enabled) {
+            return 0;
+        }
+        std::lock_guard<std::mutex> lk(tx_timestamps_mtx);
+        return socket_wrapper::readTxTimestamps(socket_fd, tx_timestamps);
+    }
+
+    void UdpDatagram::enableStats(std::shared_ptr<Stats> shared_stats) {
+        stats = std::move(shared_stats);
+    }
+
+    StatsSnapshot UdpDatagram::getStats() {
+        return stats ? stats->snapshot() : Stats().snapshot();
+    }
+
+    bool UdpDatagram::isTerminationRequested() {
+        return stop_request.isRequested() || cancellation_domain->isCancelled();
+    }
+
+    int UdpDatagram::getFdForPoll() {
+        return socket_fd;
+    }
+
+    StreamOptions UdpDatagram::getOptions() {
+        return getEffectiveStreamOptions(socket_fd);
     }
 
     void UdpDatagram::subscribeToMulticast(const std::string &group_addr) {
@@ -0,0 +1,30 @@
+#include <cstring>
+#include <cstddef>
+#include "socket_wrapper/UnixSocket.h"
+
+namespace socket_wrapper {
+    bool isAbstractUnixPath(const std::string &path) {
+        return !path.empty() && path[0] == '@';
+    }
+
+    socklen_t toUnixAddress(const std::string &path, sockaddr_un &address, SocketException::Type error_type) {
+        if (path.empty()) {
+            throw SocketException(error_type, EINVAL);
+        }
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (isAbstractUnixPath(path)) {
+            // abstract names start with a null byte and are not null terminated, the length tells where they end
+            if (path.size() > sizeof(address.sun_path)) {
+                throw SocketException(error_type, ENAMETOOLONG);
+            }
+            memcpy(address.sun_path + 1, path.data() + 1, path.size() - 1);
+            return (socklen_t) (offsetof(sockaddr_un, sun_path) + path.size());
+        }
+        if (path.size() >= sizeof(address.sun_path)) {
+            throw SocketException(error_type, ENAMETOOLONG);
+        }
+        memcpy(address.sun_path, path.data(), path.size());
+        return (socklen_t) (offsetof(sockaddr_un, sun_path) + path.size() + 1);
+    }
+}
@@ -4,6 +4,21 @@
 #include "socket_wrapper/UdpDatagram.h"
 #include "socket_wrapper/BaseTypes.h"
 #include "socket_wrapper/Utils.h"
+#include "socket_wrapper/Reactor.h"
+#include "socket_wrapper/StreamPool.h"
+#include "socket_wrapper/IoBackend.h"
+#include "socket_wrapper/CancellationDomain.h"
+#include "socket_wrapper/StreamRelay.h"
+#include "socket_wrapper/Stats.h"
+#include "socket_wrapper/ShmChannel.h"
+#include "socket_wrapper/RingBuffer.h"
+#include "socket_wrapper/BufferPool.h"
+#include "socket_wrapper/FrameFormat.h"
+#include "socket_wrapper/LockFreeQueue.h"
+#include "socket_wrapper/UnixSocket.h"
+#ifdef SOCKET_WRAPPER_COROUTINES
+#include "socket_wrapper/Coroutine.h"
+#endif
 
 using namespace std;
 #define TEST_IP_VERSION socket_wrapper::IPv4
@@ -161,13 +176,134 @@ TEST(ConditionalBufferedStream, ReadMixtureOfTypes) {
     ASSERT_READ_NON_BLOCKING_EQ(cstream, on_newline_fd, "xyz\n");
     ASSERT_POLL_TIMED_OUT(on_newline_fd);
 }
+TEST(ConditionalBufferedStream, WriteBatch) {
+    using namespace socket_wrapper;
+    auto streams = StreamFactory::CreatePipe();
+    auto cstream = std::make_shared<ConditionalBufferedStream>(BufferedStream(std::move(streams[1]), 512));
+    auto newline_condition = ConditionalBufferedStream::getDelimiterCondition('\n');
+    int on_newline_fd = cstream->createEventfdOnCondition(newline_condition);
+    cstream->start();
+
+    std::string header = "abc", empty, payload = "def\nxyz\n";
+    std::vector<iovec> buffers = {{.iov_base = header.data(), .iov_len = header.size()},
+                                  {.iov_base = empty.data(), .iov_len = empty.size()},
+                                  {.iov_base = payload.data(), .iov_len = payload.size()}};
+    ASSERT_EQ(streams[0].writev(buffers, 1), 11);
+    ASSERT_READ_BLOCKING_STR_EQ(cstream, on_newline_fd, "abcdef\n");
+    ASSERT_READ_BLOCKING_STR_EQ(cstream, on_newline_fd, "xyz\n");
+}
+
+TEST(Stream, WritevLargeBuffers) {
+    using namespace socket_wrapper;
+    auto streams = StreamFactory::CreatePipe();
+    // larger than the socket buffer, so the writes are partial and have to be continued
+    std::vector<char> first(1 << 20, 'a'), second(1 << 20, 'b');
+    std::vector<iovec> buffers = {{.iov_base = first.data(), .iov_len = first.size()},
+                                  {.iov_base = second.data(), .iov_len = second.size()}};
+    std::vector<char> received(first.size() + second.size());
+    auto reader = std::thread([&]() {
+        streams[1].read(received.data(), received.size(), received.size(), 5000);
+    });
+    ASSERT_EQ(streams[0].writev(buffers, 100), received.size());
+    reader.join();
+    ASSERT_EQ(std::vector<char>(received.begin(), received.begin() + first.size()), first);
+    ASSERT_EQ(std::vector<char>(received.begin() + first.size(), received.end()), second);
+}
+TEST(Stream, WriteBlockingTimeout) {
+    using namespace socket_wrapper;
+    auto streams = StreamFactory::CreatePipe();
+    // nobody reads, so the socket buffer fills up and the deadline passes
+    std::vector<char> data(8 << 20, 'a');
+    try {
+        streams[0].writeBlocking(data.data(), data.size(), 100);
+        FAIL() << "writeBlocking should have thrown exception";
+    } catch (SocketException &e) {
+        ASSERT_EQ(e.exception_type, SocketException::SOCKET_WRITE_TIMEOUT);
+        ASSERT_GT(e.processed_bytes, 0);
+    }
+}
+
+TEST(Stream, SendQueue) {
+    using namespace socket_wrapper;
+    auto streams = StreamFactory::CreatePipe();
+    std::vector<char> data(4 << 20, 'a');
+    ASSERT_THROW(streams[0].enqueue(data.data(), 1000), std::logic_error);
+    streams[0].enableSendQueue(100);
+    // data the socket accepts right away is not limited by the watermark
+    ASSERT_TRUE(streams[0].enqueue(data.data(), 1000));
+    ASSERT_EQ(streams[0].getSendQueueSize(), 0);
+    ASSERT_EQ(streams[1].read(data.data(), 1000, 1000, 1000), 1000);
+    // the rest of partially sent data is not queued beyond the watermark either
+    try {
+        streams[0].enqueue(data.data(), data.size());
+        FAIL();
+    } catch (SocketException &ex) {
+        ASSERT_EQ(ex.exception_type, SocketException::SOCKET_WRITE_PARTIAL);
+        ASSERT_GT(ex.processed_bytes, 0);
+        ASSERT_EQ(streams[0].getSendQueueSize(), 0);
+        std::vector<char> sent(ex.processed_bytes);
+        ASSERT_EQ(streams[1].read(sent.data(), sent.size(), sent.size(), 1000), sent.size());
+    }
+    streams[0].enableSendQueue(6 << 20);
+    ASSERT_TRUE(streams[0].enqueue(data.data(), data.size()));
+    ASSERT_GT(streams[0].getSendQueueSize(), 0);
+    // the queue is full now
+    ASSERT_FALSE(streams[0].enqueue(data.data(), data.size()));
+
+    std::vector<char> received(data.size());
+    auto reader = std::thread([&]() {
+        streams[1].read(received.data(), received.size(), received.size(), 5000);
+    });
+    while (streams[0].flushSendQueue() > 0) {
+        std::array<pollfd, 1> poll_fds = {{{.fd = streams[0].getFdForPoll(), .events = POLLOUT, .revents = 0}}};
+        ::poll(poll_fds.data(), poll_fds.size(), 100);
+    }
+    reader.join();
+    ASSERT_EQ(received, data);
+}
+TEST(Stream, SendFile) {
+    using namespace socket_wrapper;
+    auto streams = StreamFactory::CreatePipe();
+    std::vector<char> data(1 << 20);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (char) (i % 251);
+    }
+    FILE *file = tmpfile();
+    ASSERT_EQ(fwrite(data.data(), 1, data.size(), file), data.size());
+    fflush(file);
+
+    const size_t offset = 1000;
+    std::vector<char> received(data.size() - offset);
+    auto reader = std::thread([&]() {
+        streams[1].read(received.data(), received.size(), received.size(), 5000);
+    });
+    ASSERT_EQ(streams[0].sendFile(fileno(file), offset, data.size(), 5000), received.size());
+    reader.join();
+    fclose(file);
+    ASSERT_EQ(received, std::vector<char>(data.begin() + offset, data.end()));
+}
+
+TEST(Stream, SendFileFromPipe) {
+    using namespace socket_wrapper;
+    auto streams = StreamFactory::CreatePipe();
+    int pipe_fds[2];
+    ASSERT_EQ(pipe(pipe_fds), 0);
+    std::string data = "some data moved through a pipe";
+    ASSERT_EQ(::write(pipe_fds[1], data.data(), data.size()), (ssize_t) data.size());
+    ASSERT_EQ(streams[0].sendFile(pipe_fds[0], -1, data.size(), 1000), data.size());
+    std::vector<char> received(data.size());
+    streams[1].read(received.data(), received.size(), received.size(), 1000);
+    ::close(pipe_fds[0]);
+    ::close(pipe_fds[1]);
+    ASSERT_EQ(std::string(received.begin(), received.end()), data);
+}
 
 TEST(ConditionalBufferedStream, AbortReads) {
     using namespace socket_wrapper;
     auto streams = StreamFactory::CreatePipe();
     auto cstream = std::make_shared<ConditionalBufferedStream>(std::move(BufferedStream(std::move(streams[1]), 512)));
 
-    auto newline_condition = ConditionalBufferedStream::getDelimiterCondition('\n');
+    auto newline_condition = ConditionalBufferedStream::getDelimiterViewCondition('\n');
     int on_newline_fd = cstream->createEventfdOnCondition(newline_condition);
     cstream->start();
     auto t = std::thread([&](){
@@ -198,7 +334,980 @@ TEST(Listener, ConnectDirectly){
     new_client_connection.read(buffer.data(), 3, 1);
     ASSERT_EQ(buffer[0], 'a');
 }
+TEST(Listener, StreamOptions){
+    using namespace socket_wrapper;
+    StreamOptions options;
+    options.tcp_nodelay = 1;
+    options.receive_buffer_size = 65536;
+    Listener A = Listener(8235, TEST_IP_VERSION, true, options);
+    auto client_stream = StreamFactory::CreateTcpStreamToServer("127.0.0.1", 8235, TEST_IP_VERSION, options);
+    auto accepted_stream = A.accept(500);
+    ASSERT_EQ(client_stream.getOptions().tcp_nodelay, 1);
+    ASSERT_EQ(accepted_stream.getOptions().tcp_nodelay, 1);
+    // the kernel doubles the requested buffer size
+    ASSERT_GE(accepted_stream.getOptions().receive_buffer_size, 65536);
+    ASSERT_EQ(StreamFactory::CreatePipe()[0].getOptions().tcp_nodelay, StreamOptions::kUnset);
+    // a socket whose options can not be applied is closed again, the lowest free fd stays the same
+    int free_fd = dup(0);
+    ::close(free_fd);
+    StreamOptions invalid;
+    invalid.busy_poll_us = -2;
+    ASSERT_THROW(Listener(8235, TEST_IP_VERSION, true, invalid), SocketException);
+    StreamOptions tcp_only;
+    tcp_only.tcp_nodelay = 1;
+    ASSERT_THROW(UdpDatagram("127.0.0.1", 8005, TEST_IP_VERSION, 512, tcp_only), SocketException);
+    int next_fd = dup(0);
+    ::close(next_fd);
+    ASSERT_EQ(next_fd, free_fd);
+}
+TEST(StreamFactory, ConnectToFirstAvailableServer){
+    using namespace socket_wrapper;
+    Listener A = Listener(8236, TEST_IP_VERSION);
+    // nothing listens on port 8237, so these attempts are refused
+    std::vector<Endpoint> candidates = {{.ip_address = "::1", .port = 8237, .version = IPv6},
+                                        {.ip_address = "127.0.0.1", .port = 8237, .version = IPv4},
+                                        {.ip_address = "127.0.0.1", .port = 8236, .version = IPv4}};
+    auto stream = StreamFactory::CreateTcpStreamToAnyServer(candidates, 1000, 50);
+    stream.write("abc", 3, 1);
+    auto accepted_stream = A.accept(500);
+    std::vector<char> buffer(3);
+    accepted_stream.read(buffer.data(), 3, 3, 500);
+    ASSERT_EQ(std::string(buffer.begin(), buffer.end()), "abc");
+
+    candidates.pop_back();
+    try {
+        StreamFactory::CreateTcpStreamToAnyServer(candidates, 1000, 50);
+        FAIL() << "connecting should have failed";
+    } catch (SocketException &e) {
+        ASSERT_EQ(e.exception_type, SocketException::SOCKET_CONNECT);
+    }
+}
+TEST(StreamPool, ReusesIdleStreams){
+    using namespace socket_wrapper;
+    Listener A = Listener(8238, TEST_IP_VERSION);
+    StreamPool pool(1, 1);
+    Endpoint endpoint = {.ip_address = "127.0.0.1", .port = 8238, .version = IPv4};
+    pool.prefill(endpoint);
+    ASSERT_EQ(pool.getIdleCount(endpoint), 1);
+    auto server_stream = A.accept(500);
+    {
+        auto lease = pool.acquire(endpoint);
+        lease->write("abc", 3, 1);
+        // the only connection is leased, so a second acquire has to wait
+        ASSERT_ANY_THROW(pool.acquire(endpoint, 50));
+    }
+    {
+        auto lease = pool.acquire(endpoint);
+        lease->write("def", 3, 1);
+    }
+    std::vector<char> buffer(6);
+    server_stream.read(buffer.data(), 6, 6, 500);
+    ASSERT_EQ(std::string(buffer.begin(), buffer.end()), "abcdef");
+    auto stats = pool.getStats();
+    ASSERT_EQ(stats.hits, 2);
+    ASSERT_EQ(stats.misses, 0);
+    ASSERT_EQ(stats.waits, 1);
+
+    // once the server closes the connection, the idle Stream is replaced
+    {
+        auto closed_stream = std::move(server_stream);
+    }
+    this_thread::sleep_for(20ms);
+    {
+        auto lease = pool.acquire(endpoint);
+    }
+    ASSERT_EQ(pool.getStats().misses, 1);
+    ASSERT_EQ(pool.getStats().discarded, 1);
+}
+
+TEST(Reactor, DrivesManyStreams) {
+    using namespace socket_wrapper;
+    const int stream_count = 100;
+    std::vector<std::array<Stream, 2>> pipes;
+    for (int i = 0; i < stream_count; i++) {
+        pipes.push_back(StreamFactory::CreatePipe());
+    }
+    std::atomic<size_t> received_bytes{0};
+    {
+        Reactor reactor(2);
+        for (auto &pipe: pipes) {
+            Stream *receiver = &pipe[1];
+            reactor.add(*receiver, [receiver, &received_bytes]() {
+                char buffer[16];
+                size_t read_bytes;
+                while ((read_bytes = receiver->tryRead(buffer, sizeof(buffer))) > 0) {
+                    received_bytes += read_bytes;
+                }
+            });
+        }
+        for (auto &pipe: pipes) {
+            pipe[0].write("abc", 3, 1);
+        }
+        for (int i = 0; i < 100 && received_bytes < 3 * stream_count; i++) {
+            this_thread::sleep_for(10ms);
+        }
+        // removal waits for a running callback, a callback may remove its own file descriptor
+        auto slow = StreamFactory::CreatePipe();
+        auto self_removing = StreamFactory::CreatePipe();
+        std::atomic<bool> executing{false};
+        reactor.add(slow[1], [&]() {
+            executing = true;
+            this_thread::sleep_for(20ms);
+            executing = false;
+        });
+        reactor.add(self_removing[1], [&]() { reactor.remove(self_removing[1].getFdForPoll()); });
+        self_removing[0].write("x", 1, 1);
+        slow[0].write("x", 1, 1);
+        while (!executing) {
+            this_thread::sleep_for(1ms);
+        }
+        reactor.remove(slow[1].getFdForPoll());
+        ASSERT_FALSE(executing);
+        reactor.stop();
+    }
+    ASSERT_EQ(received_bytes.load(), 3 * stream_count);
+}
+TEST(IoBackend, IoUringReads) {
+    using namespace socket_wrapper;
+    if (setIoBackend(IO_BACKEND_IO_URING) != IO_BACKEND_IO_URING) {
+        GTEST_SKIP() << "io_uring is not supported";
+    }
+    {
+        auto streams = StreamFactory::CreatePipe();
+        std::vector<char> buffer(16);
+        streams[0].write("abcdef", 6, 1);
+        ASSERT_EQ(streams[1].read(buffer.data(), buffer.size(), 6, 100), 6);
+        ASSERT_EQ(std::string(buffer.begin(), buffer.begin() + 6), "abcdef");
+        ASSERT_THROW(streams[1].read(buffer.data(), buffer.size(), 1, 20), SocketException);
+        auto t = std::thread([&]() { this_thread::sleep_for(50ms); streams[1].stopReads(); });
+        try {
+            streams[1].read(buffer.data(), buffer.size(), 1, 1000);
+            FAIL() << "read should have been aborted";
+        } catch (SocketException &e) {
+            ASSERT_EQ(e.exception_type, SocketException::SOCKET_TERMINATION_REQUEST);
+        }
+        t.join();
+
+        Listener A = Listener(8239, TEST_IP_VERSION);
+        auto client_stream = StreamFactory::CreateTcpStreamToServer("127.0.0.1", 8239, TEST_IP_VERSION);
+        auto accepted_stream = A.accept(500);
+        client_stream.write("xyz", 3, 1);
+        ASSERT_EQ(accepted_stream.read(buffer.data(), buffer.size(), 3, 100), 3);
+
+        auto conn = UdpDatagram("127.0.0.1", 8002, TEST_IP_VERSION);
+        std::vector<char> sent_packet = {'a', 'b', 'c'};
+        conn.write(sent_packet, "127.0.0.1", 8002);
+        ASSERT_EQ(conn.read(100), sent_packet);
+    }
+    setIoBackend(IO_BACKEND_POLL);
+}
+TEST(CancellationDomain, CancelAllAndSingleStream) {
+    using namespace socket_wrapper;
+    auto domain = std::make_shared<CancellationDomain>();
+    auto first = StreamFactory::CreatePipe();
+    auto second = StreamFactory::CreatePipe();
+    auto other = StreamFactory::CreatePipe();
+    first[1].setCancellationDomain(domain);
+    second[1].setCancellationDomain(domain);
+    std::vector<char> buffer(16);
+    auto expect_termination = [&](Stream &stream) {
+        try {
+            stream.read(buffer.data(), buffer.size(), 1, 1000);
+            FAIL() << "read should have been aborted";
+        } catch (SocketException &e) {
+            ASSERT_EQ(e.exception_type, SocketException::SOCKET_TERMINATION_REQUEST);
+        }
+    };
+    // stopping a single Stream leaves the rest of its domain untouched, a blocked read there keeps waiting
+    auto second_reader = std::thread([&]() {
+        ASSERT_EQ(second[1].read(buffer.data() + 8, 8, 3, 1000), 3);
+    });
+    auto t = std::thread([&]() { this_thread::sleep_for(20ms); first[1].stopReads(); });
+    expect_termination(first[1]);
+    t.join();
+    second[0].write("abc", 3, 1);
+    second_reader.join();
+    // the connection of the stopped Stream is not shut down, the peer can still write
+    first[0].write("abc", 3, 1);
+    second[0].write("abc", 3, 1);
+    ASSERT_EQ(second[1].read(buffer.data(), buffer.size(), 3, 100), 3);
+    // cancelling the domain aborts all of its Streams, but not the Streams of other domains
+    auto reader = std::thread([&]() { expect_termination(second[1]); });
+    this_thread::sleep_for(20ms);
+    domain->cancelAll();
+    reader.join();
+    expect_termination(first[1]);
+    other[0].write("xyz", 3, 1);
+    ASSERT_EQ(other[1].read(buffer.data(), buffer.size(), 3, 100), 3);
+    // a moved Stream keeps its domain and owns its socket
+    Stream moved = std::move(second[1]);
+    expect_termination(moved);
+    ASSERT_FALSE(CancellationDomain::getDefault()->isCancelled());
+}
+TEST(StreamRelay, ForwardsBothDirectionsAndHalfClose) {
+    using namespace socket_wrapper;
+    auto left = StreamFactory::CreatePipe();
+    auto right = StreamFactory::CreatePipe();
+    StreamRelay relay(std::move(left[1]), std::move(right[1]));
+    auto relay_thread = std::thread([&]() { relay.run(); });
+    std::vector<char> buffer(16);
+    left[0].write("hello", 5, 1);
+    ASSERT_EQ(right[0].read(buffer.data(), buffer.size(), 5, 1000), 5);
+    ASSERT_EQ(std::string(buffer.begin(), buffer.begin() + 5), "hello");
+    right[0].write("world!", 6, 1);
+    ASSERT_EQ(left[0].read(buffer.data(), buffer.size(), 6, 1000), 6);
+    // closing the sending direction of one side is forwarded, the other direction stays open
+    ::shutdown(left[0].getFdForPoll(), SHUT_WR);
+    ASSERT_THROW(right[0].read(buffer.data(), buffer.size(), 1, 1000), SocketException);
+    right[0].write("bye", 3, 1);
+    ASSERT_EQ(left[0].read(buffer.data(), buffer.size(), 3, 1000), 3);
+    ::shutdown(right[0].getFdForPoll(), SHUT_WR);
+    relay_thread.join();
+    ASSERT_EQ(relay.getBytesFirstToSecond(), 5);
+    ASSERT_EQ(relay.getBytesSecondToFirst(), 9);
 
+    auto idle = StreamFactory::CreatePipe();
+    auto idle_peer = StreamFactory::CreatePipe();
+    StreamRelay idle_relay(std::move(idle[1]), std::move(idle_peer[1]), 50);
+    try {
+        idle_relay.run();
+        FAIL() << "the idle relay should have timed out";
+    } catch (SocketException &e) {
+        ASSERT_EQ(e.exception_type, SocketException::SOCKET_READ_TIMEOUT);
+    }
+    auto stop_thread = std::thread([&]() { this_thread::sleep_for(20ms); idle_relay.stop(); });
+    try {
+        idle_relay.run();
+        FAIL() << "the relay should have been stopped";
+    } catch (SocketException &e) {
+        ASSERT_EQ(e.exception_type, SocketException::SOCKET_TERMINATION_REQUEST);
+    }
+    stop_thread.join();
+}
+TEST(Stats, CountsHotPaths) {
+    using namespace socket_wrapper;
+    auto streams = StreamFactory::CreatePipe();
+    ASSERT_EQ(streams[0].getStats().bytes_out, 0);
+    streams[0].enableStats();
+    auto cstream = std::make_shared<ConditionalBufferedStream>(BufferedStream(std::move(streams[1]), 512));
+    cstream->enableStats();
+    int on_newline_fd = cstream->createEventfdOnCondition(ConditionalBufferedStream::getDelimiterViewCondition('\n'));
+    cstream->start();
+    streams[0].write("ab\ncd\n", 6, 1);
+    ASSERT_EQ(cstream->readBlockingStr(on_newline_fd, 1000), "ab\n");
+    ASSERT_EQ(cstream->readBlockingStr(on_newline_fd, 1000), "cd\n");
+    auto written = streams[0].getStats();
+    ASSERT_EQ(written.bytes_out, 6);
+    ASSERT_EQ(written.write_syscalls, 1);
+    auto received = cstream->getStats();
+    ASSERT_EQ(received.bytes_in, 6);
+    ASSERT_GE(received.read_syscalls, 1);
+    ASSERT_GE(received.condition_evaluations, 2);
+    ASSERT_EQ(received.queue_residency_us.count, 2);
+    ASSERT_GE(received.read_wait_us.count, 1);
+    ASSERT_NE(received.exportText("cbs").find("cbs_bytes_in 6\n"), std::string::npos);
+
+    LatencyHistogram histogram;
+    for (uint64_t v = 1; v <= 1000; v++) {
+        histogram.record(v);
+    }
+    auto snapshot = histogram.snapshot();
+    ASSERT_EQ(snapshot.count, 1000);
+    ASSERT_EQ(snapshot.max, 1000);
+    ASSERT_NEAR(snapshot.getPercentile(50), 500, 500 / 8);
+    ASSERT_NEAR(snapshot.getPercentile(99), 990, 990 / 8);
+    ASSERT_EQ(snapshot.getPercentile(100), 1000);
+    ASSERT_DOUBLE_EQ(snapshot.getMean(), 500.5);
+}
+TEST(Timestamping, UdpReceiveAndTcpTransmit) {
+    using namespace socket_wrapper;
+    auto conn = UdpDatagram("127.0.0.1", 8004, TEST_IP_VERSION);
+    conn.enableTimestamps();
+    int64_t before_send = getRealtimeNs();
+    TimestampedDatagram datagram;
+    for (int i = 0; i < 100 && (i == 0 || datagram.kernel_receive_ns == -1); i++) {
+        // receive timestamping is switched on by a kernel worker, which has to get a chance to run
+        if (i > 0) {
+            this_thread::sleep_for(1ms);
+        }
+        conn.write({'a', 'b', 'c'}, "127.0.0.1", 8004);
+        datagram = conn.readTimestamped(1000);
+        ASSERT_EQ(datagram.data, std::vector<char>({'a', 'b', 'c'}));
+    }
+    ASSERT_GE(datagram.kernel_receive_ns, before_send);
+    ASSERT_LE(datagram.kernel_receive_ns, getRealtimeNs());
+
+    Listener listener(8241, TEST_IP_VERSION);
+    auto client = StreamFactory::CreateTcpStreamToServer("127.0.0.1", 8241, TEST_IP_VERSION);
+    auto server = listener.accept(500);
+    client.enableTimestamps();
+    client.write("abcdef", 6, 1);
+    std::vector<char> buffer(16);
+    ASSERT_EQ(server.read(buffer.data(), buffer.size(), 6, 1000), 6);
+    std::vector<TxTimestamp> timestamps;
+    bool acknowledged = false;
+    for (int i = 0; i < 100 && !acknowledged; i++) {
+        for (auto &t: client.readTxTimestamps()) {
+            timestamps.push_back(t);
+            acknowledged = acknowledged || t.type == TX_TIMESTAMP_ACKNOWLEDGED;
+        }
+        this_thread::sleep_for(10ms);
+    }
+    ASSERT_TRUE(acknowledged);
+    for (auto &t: timestamps) {
+        ASSERT_EQ(t.byte_offset, 5);
+        ASSERT_GE(t.kernel_time_ns, before_send);
+    }
+}
+TEST(BusyPoller, AdaptsToInterArrivalTimes) {
+    using namespace socket_wrapper;
+    BusyPoller fixed(100, false);
+    BusyPoller adaptive(1000, true);
+    ASSERT_EQ(adaptive.getSpinBudgetUs(), 1000); // nothing learned yet
+    for (int i = 0; i < 10; i++) {
+        fixed.recordArrival();
+        adaptive.recordArrival();
+        this_thread::sleep_for(5ms);
+    }
+    ASSERT_EQ(fixed.getSpinBudgetUs(), 100);
+    ASSERT_EQ(adaptive.getSpinBudgetUs(), 0); // messages arrive too rarely to spin
+    for (int i = 0; i < 50; i++) {
+        adaptive.recordArrival();
+    }
+    ASSERT_GT(adaptive.getSpinBudgetUs(), 0);
+    ASSERT_LT(adaptive.getSpinBudgetUs(), 1000);
+
+    auto streams = StreamFactory::CreatePipe();
+    streams[1].enableBusyPolling(200);
+    std::vector<char> buffer(16);
+    auto writer = std::thread([&]() {
+        for (int i = 0; i < 100; i++) {
+            streams[0].write("x", 1, 1);
+        }
+    });
+    size_t read_bytes = 0;
+    while (read_bytes < 100) {
+        read_bytes += streams[1].read(buffer.data(), buffer.size(), 1, 1000);
+    }
+    writer.join();
+    ASSERT_THROW(streams[1].read(buffer.data(), buffer.size(), 1, 10), SocketException);
+    auto t = std::thread([&]() { this_thread::sleep_for(20ms); streams[1].stopReads(); });
+    try {
+        streams[1].read(buffer.data(), buffer.size(), 1, 1000);
+        FAIL() << "read should have been aborted";
+    } catch (SocketException &e) {
+        ASSERT_EQ(e.exception_type, SocketException::SOCKET_TERMINATION_REQUEST);
+    }
+    t.join();
+
+    auto conn = UdpDatagram("127.0.0.1", 8005, TEST_IP_VERSION);
+    conn.enableBusyPolling();
+    conn.write({'a', 'b', 'c'}, "127.0.0.1", 8005);
+    ASSERT_EQ(conn.read(1000), std::vector<char>({'a', 'b', 'c'}));
+
+    // busy polling can be switched while reads are running
+    auto toggled = StreamFactory::CreatePipe();
+    std::atomic<bool> toggling{true};
+    auto toggler = std::thread([&]() {
+        while (toggling) {
+            toggled[1].enableBusyPolling(50, false);
+            conn.enableBusyPolling(50, false);
+            toggled[1].disableBusyPolling();
+            conn.disableBusyPolling();
+        }
+    });
+    for (int i = 0; i < 20; i++) {
+        toggled[0].write("x", 1, 1);
+        ASSERT_EQ(toggled[1].read(buffer.data(), buffer.size(), 1, 1000), 1);
+        conn.write({'d'}, "127.0.0.1", 8005);
+        ASSERT_EQ(conn.read(1000), std::vector<char>({'d'}));
+    }
+    toggling = false;
+    toggler.join();
+}
+TEST(UnixSocket, ListenConnectAndPassFds) {
+    using namespace socket_wrapper;
+    std::string abstract_path = "@socket_wrapper_test_" + std::to_string(getpid());
+    Listener listener(abstract_path);
+    auto client = StreamFactory::CreateUnixStream(abstract_path, StreamOptions(), 1000);
+    auto server = listener.accept(1000);
+    client.write("hello", 5, 1);
+    char buffer[5];
+    ASSERT_EQ(server.read(buffer, 5, 5, 1000), 5);
+    ASSERT_EQ(std::string(buffer, 5), "hello");
+
+    // pass the write end of a pipe, the receiver writes into it
+    int pipe_fds[2];
+    ASSERT_EQ(pipe(pipe_fds), 0);
+    client.sendFds({pipe_fds[1]}, "fd", 2);
+    ::close(pipe_fds[1]);
+    size_t read_bytes = 0;
+    auto fds = server.recvFds(buffer, sizeof(buffer), read_bytes, 1000);
+    ASSERT_EQ(read_bytes, 2);
+    ASSERT_EQ(fds.size(), 1);
+    ASSERT_EQ(::write(fds[0], "abc", 3), 3);
+    ::close(fds[0]);
+    ASSERT_EQ(::read(pipe_fds[0], buffer, sizeof(buffer)), 3);
+    ASSERT_EQ(std::string(buffer, 3), "abc");
+    ::close(pipe_fds[0]);
+
+    // descriptors without data, data without descriptors
+    server.sendFds({0, 1});
+    fds = client.recvFds(1000);
+    ASSERT_EQ(fds.size(), 2);
+    for (int fd: fds) {
+        ::close(fd);
+    }
+    server.write("x", 1, 1);
+    ASSERT_TRUE(client.recvFds(buffer, sizeof(buffer), read_bytes, 1000).empty());
+    ASSERT_EQ(read_bytes, 1);
+    ASSERT_THROW(client.recvFds(10), SocketException);
+
+    // filesystem paths, the socket file is removed with the Listener
+    std::string path = "/tmp/socket_wrapper_test_" + std::to_string(getpid()) + ".sock";
+    {
+        Listener path_listener(path);
+        auto path_client = StreamFactory::CreateUnixStream(path);
+        path_listener.accept(1000);
+        ASSERT_EQ(access(path.c_str(), F_OK), 0);
+    }
+    ASSERT_NE(access(path.c_str(), F_OK), 0);
+    // a socket file nobody listens on is replaced, anything else at path is kept
+    {
+        int stale_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un stale_address;
+        socklen_t stale_length = toUnixAddress(path, stale_address, SocketException::SOCKET_BIND);
+        ASSERT_EQ(bind(stale_fd, (sockaddr *) &stale_address, stale_length), 0);
+        ::close(stale_fd);
+        Listener path_listener(path);
+        try {
+            Listener second_listener(path);
+            FAIL() << "the path is in use";
+        } catch (SocketException &e) {
+            ASSERT_EQ(e.exception_type, SocketException::SOCKET_BIND);
+            ASSERT_EQ(e.c_error, EADDRINUSE);
+        }
+        auto path_client = StreamFactory::CreateUnixStream(path);
+    }
+    {
+        fclose(fopen(path.c_str(), "w"));
+        ASSERT_THROW(Listener file_listener(path), SocketException);
+        ASSERT_EQ(access(path.c_str(), F_OK), 0);
+        ::unlink(path.c_str());
+    }
+    try {
+        StreamFactory::CreateUnixStream(path);
+        FAIL() << "connect should have failed";
+    } catch (SocketException &e) {
+        ASSERT_EQ(e.exception_type, SocketException::SOCKET_CONNECT);
+    }
+
+    auto stop = std::thread([&]() { this_thread::sleep_for(20ms); listener.stopAccepting(); });
+    try {
+        listener.accept(1000);
+        FAIL() << "accept should have been aborted";
+    } catch (SocketException &e) {
+        ASSERT_EQ(e.exception_type, SocketException::SOCKET_TERMINATION_REQUEST);
+    }
+    stop.join();
+}
+TEST(ShmChannel, StreamsThroughSharedMemory) {
+    using namespace socket_wrapper;
+    auto streams = StreamFactory::CreateShmPipe(4096);
+    streams[0].enableStats();
+    streams[0].write("hello", 5, 1);
+    char buffer[16];
+    ASSERT_EQ(streams[1].read(buffer, sizeof(buffer), 5, 1000), 5);
+    ASSERT_EQ(std::string(buffer, 5), "hello");
+    ASSERT_EQ(streams[0].getStats().write_syscalls, 0);
+    ASSERT_THROW(streams[1].read(buffer, sizeof(buffer), 1, 10), SocketException);
+
+    // more data than the ring holds, the writer parks until the reader made room
+    std::vector<char> sent(100000);
+    for (size_t i = 0; i < sent.size(); i++) {
+        sent[i] = (char) (i * 7);
+    }
+    auto writer = std::thread([&]() { streams[1].writeBlocking(sent.data(), sent.size(), 5000); });
+    BufferedStream buffered(std::move(streams[0]), 1024);
+    std::vector<char> received;
+    while (received.size() < sent.size()) {
+        auto part = buffered.read(std::min<size_t>(1000, sent.size() - received.size()), 1000);
+        received.insert(received.end(), part.begin(), part.end());
+    }
+    writer.join();
+    ASSERT_EQ(received, sent);
+
+    auto stop = std::thread([&]() { this_thread::sleep_for(20ms); buffered.stopReads(); });
+    try {
+        buffered.read(1, 1000);
+        FAIL() << "read should have been aborted";
+    } catch (SocketException &e) {
+        ASSERT_EQ(e.exception_type, SocketException::SOCKET_TERMINATION_REQUEST);
+    }
+    stop.join();
+
+    // the peer can not resize the shared memory under the mappings
+    auto sealed = ShmChannel::create(4096);
+    ASSERT_NE(ftruncate(sealed->getFdsForPeer()[0], 0), 0);
+
+    // the channel is passed over a Unix socket, as it would be to another process
+    auto control = StreamFactory::CreatePipe();
+    auto offered = StreamFactory::CreateShmStreamToPeer(control[0], 8192);
+    auto accepted = StreamFactory::CreateShmStreamFromPeer(control[1], 1000);
+    accepted.write("ping", 4, 1);
+    ASSERT_EQ(offered.read(buffer, sizeof(buffer), 4, 1000), 4);
+    ASSERT_EQ(std::string(buffer, 4), "ping");
+    {
+        auto closed = std::move(accepted);
+    }
+    try {
+        offered.read(buffer, sizeof(buffer), 1, 1000);
+        FAIL() << "the peer closed";
+    } catch (SocketException &e) {
+        ASSERT_EQ(e.exception_type, SocketException::SOCKET_CLOSED);
+    }
+    ASSERT_THROW(offered.write("x", 1, 1), SocketException);
+}
+TEST(RingBuffer, WrapsWithoutMovingData) {
+    using namespace socket_wrapper;
+    RingBuffer ring(1000);
+    ASSERT_EQ(ring.capacity() % 4096, 0);
+    ASSERT_TRUE(ring.isDoubleMapped());
+    size_t capacity = ring.capacity();
+    // fill the buffer to 3/4, then move the data to the end, so the next write wraps around
+    memset(ring.writableData(), 'a', capacity * 3 / 4);
+    ring.commitWrite(capacity * 3 / 4);
+    ring.consume(capacity / 2);
+    ASSERT_EQ(ring.writableSize(), capacity * 3 / 4);
+    memset(ring.writableData(), 'b', capacity / 2);
+    ring.commitWrite(capacity / 2);
+    ASSERT_EQ(ring.size(), capacity * 3 / 4);
+    ASSERT_EQ(ring.compact(), 0);
+    std::string content(ring.data(), ring.size());
+    ASSERT_EQ(content, std::string(capacity / 4, 'a') + std::string(capacity / 2, 'b'));
+    ring.consume(ring.size());
+    ASSERT_EQ(ring.writableSize(), capacity);
+
+    // many lines through a small buffer, every line wraps around at some point
+    auto streams = StreamFactory::CreatePipe();
+    BufferedStream buffered(std::move(streams[1]), 4096);
+    buffered.enableStats();
+    auto writer = std::thread([&]() {
+        for (int i = 0; i < 2000; i++) {
+            std::string line = "line number " + std::to_string(i) + "\n";
+            streams[0].write(line.data(), line.size(), 100);
+        }
+    });
+    for (int i = 0; i < 2000; i++) {
+        auto line = buffered.readUntilDelimiter('\n');
+        ASSERT_EQ(std::string(line.begin(), line.end()), "line number " + std::to_string(i));
+    }
+    writer.join();
+    ASSERT_EQ(buffered.getStats().memmove_bytes, 0);
+}
+TEST(BufferedStream, PeekAndConsume) {
+    using namespace socket_wrapper;
+    auto streams = StreamFactory::CreatePipe();
+    BufferedStream buffered(std::move(streams[1]), 4096);
+    // length prefixed messages, parsed in place
+    streams[0].write("\x03" "abc" "\x02" "de", 7, 1);
+    auto view = buffered.peek(7, 1000);
+    ASSERT_EQ(view.size, 7);
+    ASSERT_EQ(std::string(view.data + 1, view.data[0]), "abc");
+    buffered.consume(1 + view.data[0]);
+    view = buffered.peek(1, 1000);
+    ASSERT_EQ(std::string(view.begin(), view.end()), "\x02" "de");
+    ASSERT_THROW(buffered.consume(4), std::out_of_range);
+    buffered.consume(1);
+    // the raw read returns buffered data without waiting for the socket
+    char out[8];
+    ASSERT_EQ(buffered.read(out, sizeof(out), 1, 10), 2);
+    ASSERT_EQ(std::string(out, 2), "de");
+    ASSERT_THROW(buffered.peek(1, 10), SocketException);
+}
+TEST(BufferedStream, MultiByteDelimiters) {
+    using namespace socket_wrapper;
+    auto streams = StreamFactory::CreatePipe();
+    BufferedStream buffered(std::move(streams[1]), 4096);
+    // the delimiter arrives split across two reads
+    auto writer = std::thread([&]() {
+        std::string request_line = "GET / HTTP/1.1\r", rest = "\nHost: a\r\n\r\nbody\r\r\n";
+        streams[0].write(request_line.data(), request_line.size(), 1);
+        this_thread::sleep_for(10ms);
+        streams[0].write(rest.data(), rest.size(), 1);
+    });
+    auto line = buffered.readUntilDelimiter("\r\n", 1000);
+    ASSERT_EQ(std::string(line.begin(), line.end()), "GET / HTTP/1.1");
+    auto header = buffered.peekUntilDelimiter("\r\n\r\n", 1000);
+    ASSERT_EQ(std::string(header.begin(), header.end()), "Host: a");
+    buffered.consume(header.size + 4);
+    line = buffered.readUntilDelimiter("\r\n", 1000);
+    ASSERT_EQ(std::string(line.begin(), line.end()), "body\r");
+    writer.join();
+    ASSERT_THROW(buffered.readUntilDelimiter("", 10), std::logic_error);
+}
+TEST(BufferPool, IdleStreamsHoldNoBuffer) {
+    using namespace socket_wrapper;
+    ASSERT_EQ(BufferPool::getSizeClass(10000), 16384);
+    auto pool = std::make_shared<BufferPool>(32768);
+    auto streams = StreamFactory::CreatePipe();
+    {
+        BufferedStream buffered(std::move(streams[1]), 10000, pool);
+        streams[0].write("abc\n", 4, 1);
+        auto line = buffered.readUntilDelimiter('\n');
+        ASSERT_EQ(std::string(line.begin(), line.end()), "abc");
+        ASSERT_EQ(pool->getCachedBytes(), 0);
+        // the drained buffer goes back to the pool while waiting for more data
+        ASSERT_THROW(buffered.read(1, 10), SocketException);
+        ASSERT_EQ(pool->getCachedBytes(), 16384);
+        streams[0].write("de", 2, 1);
+        ASSERT_EQ(buffered.read(2, 1000), std::vector<char>({'d', 'e'}));
+        ASSERT_EQ(pool->getCachedBytes(), 0);
+    }
+    ASSERT_EQ(pool->getCachedBytes(), 16384);
+    // buffers beyond the limit are freed
+    auto first = pool->acquire(16384);
+    auto second = pool->acquire(16384);
+    auto third = pool->acquire(16384);
+    pool->release(std::move(first));
+    pool->release(std::move(second));
+    pool->release(std::move(third));
+    ASSERT_EQ(pool->getCachedBytes(), 32768);
+}
+TEST(BufferedStream, CoalescesWritesUntilFlushed) {
+    using namespace socket_wrapper;
+    Listener listener(8242, TEST_IP_VERSION);
+    BufferedStream client(StreamFactory::CreateTcpStreamToServer("127.0.0.1", 8242, TEST_IP_VERSION), 4096);
+    auto server = listener.accept(500);
+    client.enableStats();
+    std::vector<char> buffer(256);
+
+    client.setFlushPolicy(BufferedStream::FLUSH_ON_SIZE, 64, BufferedStream::kDefaultFlushDeadlineUs, true);
+    for (int i = 0; i < 10; i++) {
+        client.write("abcd", 4);
+    }
+    ASSERT_EQ(client.getPendingWriteSize(), 40);
+    ASSERT_EQ(client.getStats().write_syscalls, 0);
+    client.write("0123456789012345678901234", 25);
+    ASSERT_EQ(client.getPendingWriteSize(), 0);
+    ASSERT_EQ(client.getStats().write_syscalls, 1);
+    // the socket is corked, flush pushes out the incomplete segment
+    client.flush();
+    ASSERT_EQ(server.read(buffer.data(), buffer.size(), 65, 1000), 65);
+
+    client.setFlushPolicy(BufferedStream::FLUSH_ON_DEADLINE, 64, 1000);
+    client.write("ab", 2);
+    ASSERT_FALSE(client.flushIfDue());
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    ASSERT_TRUE(client.flushIfDue());
+    ASSERT_EQ(server.read(buffer.data(), buffer.size(), 2, 1000), 2);
+
+    // flushed at the end of the event loop iteration
+    client.setFlushPolicy(BufferedStream::FLUSH_EXPLICIT);
+    client.write("xyz", 3);
+    ASSERT_EQ(client.getPendingWriteSize(), 3);
+    Reactor reactor(1);
+    size_t hook_id = reactor.addIterationHook([&]() { client.flush(); }, 1);
+    ASSERT_EQ(server.read(buffer.data(), buffer.size(), 3, 1000), 3);
+    ASSERT_EQ(std::string(buffer.data(), 3), "xyz");
+    reactor.removeIterationHook(hook_id);
+    // removal waits for a running execution, the hook is not called afterwards
+    std::atomic<int> executions{0};
+    std::atomic<bool> executing{false};
+    hook_id = reactor.addIterationHook([&]() {
+        executing = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        executions++;
+        executing = false;
+    }, 1);
+    while (executions == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    reactor.removeIterationHook(hook_id);
+    ASSERT_FALSE(executing);
+    int executions_at_removal = executions;
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    ASSERT_EQ(executions, executions_at_removal);
+    // a hook removing itself does not wait for itself
+    std::atomic<size_t> self_removing_id{SIZE_MAX};
+    std::atomic<bool> removed_itself{false};
+    self_removing_id = reactor.addIterationHook([&]() {
+        if (self_removing_id == SIZE_MAX) {
+            return; // the id was not assigned yet
+        }
+        reactor.removeIterationHook(self_removing_id);
+        removed_itself = true;
+    }, 1);
+    while (!removed_itself) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    reactor.stop();
+    // the destructor sends the pending data without raising SIGPIPE, though the peer is gone
+    {
+        auto streams = StreamFactory::CreatePipe();
+        BufferedStream buffered(std::move(streams[0]), 4096);
+        buffered.setFlushPolicy(BufferedStream::FLUSH_EXPLICIT);
+        buffered.write("abc", 3);
+        Stream peer = std::move(streams[1]);
+    }
+}
+TEST(BufferedStream, ReadsLengthPrefixedFrames) {
+    using namespace socket_wrapper;
+    ASSERT_EQ(crc32c("123456789", 9), 0xe3069283);
+    ASSERT_EQ(crc32c("6789", 4, crc32c("12345", 5)), 0xe3069283);
+    auto streams = StreamFactory::CreatePipe();
+    BufferedStream buffered(std::move(streams[1]), 4096);
+    auto write_frame = [&](const FrameFormat &format, const std::string &payload, bool corrupt = false) {
+        char header[FrameFormat::kMaxHeaderSize];
+        size_t header_size = encodeFrameHeader(format, payload.size(), header);
+        streams[0].write(header, header_size, 1);
+        streams[0].write(payload.data(), payload.size(), 1);
+        if (format.crc32c) {
+            uint32_t checksum = htole32(crc32c(payload.data(), payload.size()) + (corrupt ? 1 : 0));
+            streams[0].write((const char *) &checksum, sizeof(checksum), 1);
+        }
+    };
+
+    FrameFormat fixed;
+    fixed.length_bytes = 2;
+    write_frame(fixed, "hello");
+    write_frame(fixed, "");
+    auto payload = buffered.readFrame(fixed, 1000);
+    ASSERT_EQ(std::string(payload.begin(), payload.end()), "hello");
+    ASSERT_TRUE(buffered.readFrame(fixed, 1000).empty());
+
+    FrameFormat varint;
+    varint.length_encoding = FrameFormat::LENGTH_VARINT;
+    varint.crc32c = true;
+    varint.max_frame_size = 1000;
+    std::string message(300, 'm');
+    write_frame(varint, message, true);
+    write_frame(varint, message);
+    try {
+        buffered.readFrame(varint, 1000);
+        FAIL() << "the corrupted frame was accepted";
+    } catch (SocketException &ex) {
+        ASSERT_EQ(ex.exception_type, SocketException::SOCKET_INVALID_FRAME);
+    }
+    payload = buffered.readFrame(varint, 1000);
+    ASSERT_EQ(std::string(payload.begin(), payload.end()), message);
+
+    // frames larger than the buffer are passed on in chunks
+    std::string large(20000, 'x');
+    varint.max_frame_size = large.size();
+    std::thread writer([&]() { write_frame(varint, large); });
+    std::string received;
+    ASSERT_EQ(buffered.readFrame(varint, [&](BufferView chunk) { received.append(chunk.begin(), chunk.end()); },
+                                 1000), large.size());
+    writer.join();
+    ASSERT_EQ(received, large);
+
+    varint.max_frame_size = 10;
+    write_frame(varint, message);
+    ASSERT_THROW(buffered.readFrame(varint, 1000), SocketException);
+}
+TEST(ConditionalBufferedStream, ViewConditionsScanIncrementally) {
+    using namespace socket_wrapper;
+    auto streams = StreamFactory::CreatePipe();
+    auto cstream = std::make_shared<ConditionalBufferedStream>(BufferedStream(std::move(streams[1]), 512));
+    std::atomic<size_t> inspected_bytes{0};
+    int line_fd = cstream->createEventfdOnCondition([&](BufferView data, size_t scanned_bytes) {
+        inspected_bytes += data.size - scanned_bytes;
+        auto pos = std::find(data.begin() + scanned_bytes, data.end(), ';');
+        return pos != data.end() ? (int) (pos - data.begin() + 1) : 0;
+    });
+    int newline_fd = cstream->createEventfdOnCondition(ConditionalBufferedStream::getDelimiterViewCondition('\n'));
+    cstream->start();
+    // a message arriving in fragments is inspected once in total
+    for (auto fragment: {"ab", "cd", "ef", "g;"}) {
+        streams[0].write(fragment, 2, 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(cstream->readBlockingStr(line_fd, 1000), "abcdefg;");
+    ASSERT_EQ(inspected_bytes, 8);
+    streams[0].write("xy\n", 3, 1);
+    ASSERT_EQ(cstream->readBlockingStr(newline_fd, 1000), "xy\n");
+}
+TEST(ConditionalBufferedStream, ReadsBurstsInBatches) {
+    using namespace socket_wrapper;
+    auto streams = StreamFactory::CreatePipe();
+    auto cstream = std::make_shared<ConditionalBufferedStream>(BufferedStream(std::move(streams[1]), 65536));
+    int line_fd = cstream->createEventfdOnCondition(ConditionalBufferedStream::getDelimiterViewCondition('\n'));
+    cstream->start();
+    std::string burst;
+    for (int i = 0; i < 10000; i++) {
+        burst += std::to_string(i % 10) + "\n";
+    }
+    streams[0].write(burst.data(), burst.size(), 1);
+    size_t received = 0, wakeups = 0;
+    while (received < 10000) {
+        std::array<pollfd, 1> poll_fds = {{{.fd = line_fd, .events = POLLIN, .revents = 0}}};
+        ASSERT_EQ(::poll(poll_fds.data(), poll_fds.size(), 1000), 1);
+        wakeups++;
+        auto lines = cstream->readAll(line_fd);
+        for (auto &line: lines) {
+            ASSERT_EQ(line, std::vector<char>({(char) ('0' + received++ % 10), '\n'}));
+        }
+    }
+    // one wakeup per read of the worker or per queue filled up, not per line
+    ASSERT_LE(wakeups, 2 * (10000 / ConditionalBufferedStream::kDefaultQueueCapacity + 1));
+    ASSERT_POLL_TIMED_OUT(line_fd);
+    // the eventfd stays readable while segments are left
+    streams[0].write("a\nb\nc\n", 6, 1);
+    ASSERT_READ_BLOCKING_STR_EQ(cstream, line_fd, "a\n");
+    ASSERT_EQ(cstream->readBatch(line_fd, 1).size(), 1);
+    ASSERT_POLL_GOT_EVENT(line_fd);
+    ASSERT_EQ(cstream->readBatch(line_fd, 5).size(), 1);
+    ASSERT_POLL_TIMED_OUT(line_fd);
+    ASSERT_TRUE(cstream->readAll(line_fd).empty());
+}
+TEST(LockFreeQueue, SpscAndMpmcTransferAllElements) {
+    using namespace socket_wrapper;
+    SpscQueue<int> spsc(3);
+    ASSERT_EQ(spsc.capacity(), 4);
+    int value;
+    ASSERT_FALSE(spsc.tryPop(value));
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(spsc.tryPush(std::move(i)));
+    }
+    ASSERT_FALSE(spsc.tryPush(4));
+    ASSERT_TRUE(spsc.tryPop(value));
+    ASSERT_EQ(value, 0);
+
+    MpmcQueue<int> mpmc(64);
+    std::atomic<int64_t> sum{0};
+    std::atomic<int> popped{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; t++) {
+        threads.emplace_back([&]() {
+            for (int i = 1; i <= 10000; i++) {
+                while (!mpmc.tryPush(std::move(i))) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        threads.emplace_back([&]() {
+            int element;
+            while (popped < 20000) {
+                if (mpmc.tryPop(element)) {
+                    sum += element;
+                    popped++;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto &t: threads) {
+        t.join();
+    }
+    ASSERT_EQ(sum, 2 * 10000 * 10001 / 2);
+    ASSERT_TRUE(mpmc.empty());
+}
+
+TEST(ConditionalBufferedStream, BoundedQueuesWithSeveralConsumers) {
+    using namespace socket_wrapper;
+    auto streams = StreamFactory::CreatePipe();
+    auto cstream = std::make_shared<ConditionalBufferedStream>(BufferedStream(std::move(streams[1]), 4096));
+    // the worker waits while the queue of 4 segments is full
+    int line_fd = cstream->createEventfdOnCondition(ConditionalBufferedStream::getDelimiterViewCondition('\n'), 4, true);
+    cstream->start();
+    std::string burst;
+    for (int i = 0; i < 1000; i++) {
+        burst += "x\n";
+    }
+    streams[0].write(burst.data(), burst.size(), 1);
+    std::atomic<int> received{0};
+    std::vector<std::thread> consumers;
+    for (int t = 0; t < 3; t++) {
+        consumers.emplace_back([&]() {
+            while (received < 1000) {
+                try {
+                    received += cstream->readBatch(line_fd, 2).size();
+                } catch (SocketException &) {
+                }
+                std::this_thread::yield();
+            }
+        });
+    }
+    for (auto &t: consumers) {
+        t.join();
+    }
+    ASSERT_EQ(received, 1000);
+    ASSERT_THROW(cstream->readAll(line_fd + 1000), SocketException);
+}
+#ifdef SOCKET_WRAPPER_COROUTINES
+TEST(Coroutine, AwaitReadsWritesAndAccepts) {
+    using namespace socket_wrapper;
+    Reactor reactor(1);
+    std::atomic<int> finished{0};
+    auto wait_for = [&](int count) {
+        for (int i = 0; i < 200 && finished.load() < count; i++) {
+            this_thread::sleep_for(10ms);
+        }
+        ASSERT_EQ(finished.load(), count);
+    };
+    // the coroutine lambdas are kept alive, as the coroutines access their captures
+    // a large write has to wait for the reader to drain the socket
+    auto streams = StreamFactory::CreatePipe();
+    std::vector<char> sent(1 << 20, 'x');
+    std::vector<char> received(sent.size());
+    auto writer = [&]() -> Task<> {
+        co_await asyncWrite(reactor, streams[0], sent.data(), sent.size());
+        finished++;
+    };
+    spawn(writer());
+    auto reader = [&]() -> Task<> {
+        size_t n = co_await asyncRead(reactor, streams[1], received.data(), received.size(), received.size());
+        if (n == sent.size() && received == sent) {
+            finished++;
+        }
+    };
+    spawn(reader());
+    wait_for(2);
+
+    Listener listener(8240, TEST_IP_VERSION);
+    std::string line;
+    auto acceptor = [&]() -> Task<> {
+        Stream accepted = co_await asyncAccept(reactor, listener);
+        char buffer[16];
+        size_t n = co_await asyncRead(reactor, accepted, buffer, sizeof(buffer), 3);
+        line = std::string(buffer, n);
+        finished++;
+    };
+    spawn(acceptor());
+    auto client = StreamFactory::CreateTcpStreamToServer("127.0.0.1", 8240, TEST_IP_VERSION);
+    client.write("xyz", 3, 1);
+    wait_for(3);
+    ASSERT_EQ(line, "xyz");
+
+    auto datagram = UdpDatagram("127.0.0.1", 8003, TEST_IP_VERSION);
+    std::vector<char> packet;
+    auto datagram_reader = [&]() -> Task<> {
+        packet = co_await asyncRead(reactor, datagram);
+        finished++;
+    };
+    spawn(datagram_reader());
+    datagram.write({'a', 'b', 'c'}, "127.0.0.1", 8003);
+    wait_for(4);
+    ASSERT_EQ(packet, std::vector<char>({'a', 'b', 'c'}));
+
+    auto pipe = StreamFactory::CreatePipe();
+    ConditionalBufferedStream cstream(BufferedStream(std::move(pipe[1]), 512));
+    int on_newline_fd = cstream.createEventfdOnCondition(ConditionalBufferedStream::getDelimiterViewCondition('\n'));
+    cstream.start();
+    std::vector<char> segment;
+    auto condition_reader = [&]() -> Task<> {
+        segment = co_await asyncReadBlocking(reactor, cstream, on_newline_fd);
+        finished++;
+    };
+    spawn(condition_reader());
+    pipe[0].write("ab\n", 3, 1);
+    wait_for(5);
+    ASSERT_EQ(segment, std::vector<char>({'a', 'b', '\n'}));
+    reactor.stop();
+}
+#endif
 
 TEST(Datagram, SendthenRead) {
     auto conn = socket_wrapper::UdpDatagram("127.0.0.0", 8001, TEST_IP_VERSION);